@@ -8,8 +8,16 @@
 //If not, please contact arsf-processing@pml.ac.uk 
 //-------------------------------------------------------------------------
 
+#include <algorithm>
+#include <cmath>
 #include "bilwriter.h"
 
+//Only build the vectorised rounding where gcc can target AVX
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   #define BILWRITER_AVX
+   #include <immintrin.h>
+#endif
+
 #ifndef BILWRITERDEBUG
    #define DEBUGPRINT(X)  
 #else
@@ -33,6 +41,12 @@ BILWriter::BILWriter(std::string fname, const unsigned int dtype,const unsigned
    this->numrows=nrows;
    this->numsamples=nsamps;
    this->numbands=nbands;
+   this->fillvalue=0;
+   this->dostatistics=false;
+   this->statstosidecar=false;
+   this->usestatsignorevalue=false;
+   this->statsignorevalue=0;
+   this->statsposition=0;
 
    //Add these to the hdr object too
    //These are the ENVI standard
@@ -96,6 +110,9 @@ int BILWriter::Close()
    {
       this->fileout.close();
       this->fileout.clear();
+      //Output the statistics if they have been accumulated
+      if(dostatistics)
+         OutputStatistics();
       //Output the hdr file
       PrepareHeader();
       retval=WriteHeader();
@@ -166,6 +183,8 @@ int BILWriter::WriteBandLine(char* const data)
       this->bilinfo<<"A problem has occurred writing the line of data to file: "<<this->filename<<std::endl;
       return -1;   
    }
+   if(dostatistics)
+      UpdateStatistics(data,numsamples);
    return 1;
 }
 
@@ -223,10 +242,257 @@ int BILWriter::WriteBandLineSection(char* const data,const unsigned int numsampl
       this->bilinfo<<"A problem has occurred writing the line of data to file: "<<this->filename<<std::endl;
       return -1;   
    }
+   if(dostatistics)
+      UpdateStatistics(&data[start*datasize],end-start+1);
    return 1;
 }
 
 
+//Function to write out nbands lines of data of the constant value xval. The 
+//converted line is cached so that repeated filler lines need no conversion
+int BILWriter::WriteBandLinesWithValue(const double xval,const unsigned int nbands)
+{
+   const uint64_t nvalues=(uint64_t)nbands*numsamples;
+   if((fillbuffer.size() < nvalues*datasize)||(xval!=fillvalue))
+   {
+      std::vector<double> values(nvalues,xval);
+      fillbuffer.resize(nvalues*datasize);
+      ConvertToDataType(&values[0],&fillbuffer[0],nvalues);
+      fillvalue=xval;
+   }
+   return WriteValues(&fillbuffer[0],nvalues);
+}
+
+//Function to write nvalues of data that has already been converted to the output data type
+int BILWriter::WriteValues(const char* const data,const uint64_t nvalues)
+{
+   //Check datasize is known
+   if(this->datasize==0)
+   {
+      //Cannot output a line if we dont know what bytesize to use (e.g. 1btye data, 4 byte data etc)
+      this->bilinfo<<"Size of data to output is unknown so cannot output a line of data."<<std::endl;
+      return -1;
+   }   
+   //Check file is open
+   if(!this->fileout.is_open())
+   {
+      //File is not open for some reason
+      this->bilinfo<<"The BIL file is closed. Cannot output a line of data."<<std::endl;
+      return -1;
+   }
+
+   this->fileout.write(data,nvalues*datasize);
+
+   if(this->fileout.bad())
+   {
+      this->bilinfo<<"A problem has occurred writing the line of data to file: "<<this->filename<<std::endl;
+      return -1;   
+   }
+   if(dostatistics)
+      UpdateStatistics(data,nvalues);
+   return 1;
+}
+
+//Start accumulating per band statistics of the data written from now on. These
+//are output to the header file, or to filename.stats if tosidecar is true, on Close()
+void BILWriter::EnableStatistics(const bool tosidecar)
+{
+   if((numsamples==0)||(numbands==0))
+      throw BILexception("Cannot accumulate band statistics as the number of samples or bands is unknown.");
+   dostatistics=true;
+   statstosidecar=tosidecar;
+   statsposition=0;
+   bandstats.assign(numbands,BandStatistics());
+}
+
+//Function to add nvalues of (converted) data that have been written to the band
+//statistics. The band is taken from the position in the file - the data are
+//written a band line at a time so each run of numsamples values is one band
+void BILWriter::UpdateStatistics(const char* const data,const uint64_t nvalues)
+{
+   uint64_t done=0;
+   while(done<nvalues)
+   {
+      const unsigned int band=static_cast<unsigned int>((statsposition/numsamples)%numbands);
+      const unsigned int n=static_cast<unsigned int>(std::min<uint64_t>(numsamples-statsposition%numsamples,nvalues-done));
+      const char* const values=&data[done*datasize];
+      switch(datatype)
+      {
+      case 1:
+         AccumulateStatistics(reinterpret_cast<const unsigned char*>(values),n,bandstats[band]);
+         break;
+      case 2:
+         AccumulateStatistics(reinterpret_cast<const short*>(values),n,bandstats[band]);
+         break;
+      case 3:
+         AccumulateStatistics(reinterpret_cast<const int*>(values),n,bandstats[band]);
+         break;
+      case 4:
+         AccumulateStatistics(reinterpret_cast<const float*>(values),n,bandstats[band]);
+         break;
+      case 5:
+         AccumulateStatistics(reinterpret_cast<const double*>(values),n,bandstats[band]);
+         break;
+      case 12:
+         AccumulateStatistics(reinterpret_cast<const unsigned short*>(values),n,bandstats[band]);
+         break;
+      case 13:
+         AccumulateStatistics(reinterpret_cast<const unsigned int*>(values),n,bandstats[band]);
+         break;
+      default:
+         break;
+      }
+      done+=n;
+      statsposition+=n;
+   }
+}
+
+//Function to output the accumulated band statistics either to the header or
+//to a sidecar text file with one row per band
+void BILWriter::OutputStatistics()
+{
+   std::vector<double> stddev(numbands,0);
+   for(unsigned int b=0;b<numbands;b++)
+   {
+      if(bandstats[b].count>1)
+         stddev[b]=sqrt(bandstats[b].m2/(bandstats[b].count-1));
+   }
+
+   if(statstosidecar)
+   {
+      std::string statsfilename=this->filename+".stats";
+      std::ofstream statsout(statsfilename.c_str());
+      if(!statsout.is_open())
+         throw BILexception("Cannot open output statistics file: "+statsfilename);
+      statsout<<"#band valid_count ignored_count minimum maximum mean stddev"<<std::endl;
+      for(unsigned int b=0;b<numbands;b++)
+      {
+         statsout<<b<<" "<<bandstats[b].count<<" "<<bandstats[b].ignored<<" "<<bandstats[b].minimum<<" "
+                 <<bandstats[b].maximum<<" "<<bandstats[b].mean<<" "<<stddev[b]<<std::endl;
+      }
+      statsout.close();
+      return;
+   }
+
+   std::stringstream count,ignored,minimum,maximum,mean,sd;
+   for(unsigned int b=0;b<numbands;b++)
+   {
+      const std::string sep=(b==0) ? "" : ", ";
+      count<<sep<<bandstats[b].count;
+      ignored<<sep<<bandstats[b].ignored;
+      minimum<<sep<<bandstats[b].minimum;
+      maximum<<sep<<bandstats[b].maximum;
+      mean<<sep<<bandstats[b].mean;
+      sd<<sep<<stddev[b];
+   }
+   AddToHdr(";Per band statistics of the data excluding no data values");
+   AddToHdr("statistics valid count = {"+count.str()+"}");
+   AddToHdr("statistics ignored count = {"+ignored.str()+"}");
+   AddToHdr("statistics minimum = {"+minimum.str()+"}");
+   AddToHdr("statistics maximum = {"+maximum.str()+"}");
+   AddToHdr("statistics mean = {"+mean.str()+"}");
+   AddToHdr("statistics stddev = {"+sd.str()+"}");
+}
+
+//Function to reverse the order of n values that have already been converted to the output data type
+void BILWriter::ReverseValues(char* const values,const unsigned int n)
+{
+   switch(datasize)
+   {
+   case 1:
+      std::reverse(values,values+n);
+      break;
+   case 2:
+      std::reverse(reinterpret_cast<unsigned short*>(values),reinterpret_cast<unsigned short*>(values)+n);
+      break;
+   case 4:
+      std::reverse(reinterpret_cast<unsigned int*>(values),reinterpret_cast<unsigned int*>(values)+n);
+      break;
+   case 8:
+      std::reverse(reinterpret_cast<uint64_t*>(values),reinterpret_cast<uint64_t*>(values)+n);
+      break;
+   default:
+      throw BILexception("Unknown data size when reversing values: "+ToString(datasize));
+   }
+}
+
+#ifdef BILWRITER_AVX
+//Round doubles to uint16 eight at a time. The low 16 bits are kept so that,
+//as for the scalar loop, values are wrapped rather than saturated
+__attribute__((target("avx")))
+static void RoundToUint16AVX(const double* const data,unsigned short* const out,const unsigned int n)
+{
+   const __m256d half=_mm256_set1_pd(0.5);
+   const __m128i low16=_mm_set1_epi32(0xFFFF);
+   unsigned int i=0;
+   for(;i+8<=n;i+=8)
+   {
+      __m128i a=_mm_and_si128(_mm256_cvttpd_epi32(_mm256_add_pd(_mm256_loadu_pd(data+i),half)),low16);
+      __m128i b=_mm_and_si128(_mm256_cvttpd_epi32(_mm256_add_pd(_mm256_loadu_pd(data+i+4),half)),low16);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out+i),_mm_packus_epi32(a,b));
+   }
+   for(;i<n;i++)
+      out[i]=static_cast<unsigned short>(data[i]+0.5);
+}
+
+//As above for floats - these are widened to doubles so that the rounding
+//is identical to the scalar loop
+__attribute__((target("avx")))
+static void RoundToUint16AVX(const float* const data,unsigned short* const out,const unsigned int n)
+{
+   const __m256d half=_mm256_set1_pd(0.5);
+   const __m128i low16=_mm_set1_epi32(0xFFFF);
+   unsigned int i=0;
+   for(;i+8<=n;i+=8)
+   {
+      __m128i a=_mm_and_si128(_mm256_cvttpd_epi32(_mm256_add_pd(_mm256_cvtps_pd(_mm_loadu_ps(data+i)),half)),low16);
+      __m128i b=_mm_and_si128(_mm256_cvttpd_epi32(_mm256_add_pd(_mm256_cvtps_pd(_mm_loadu_ps(data+i+4)),half)),low16);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out+i),_mm_packus_epi32(a,b));
+   }
+   for(;i<n;i++)
+      out[i]=static_cast<unsigned short>(data[i]+0.5);
+}
+#endif
+
+//Returns true if the cpu supports AVX instructions
+static bool UseAVX()
+{
+#ifdef BILWRITER_AVX
+   static const bool avx=(__builtin_cpu_supports("avx")!=0);
+   return avx;
+#else
+   return false;
+#endif
+}
+
+//Round doubles to uint16 - using AVX where the cpu supports it
+void BILWriter::RoundToType(const double* const data,unsigned short* const out,const unsigned int n)
+{
+#ifdef BILWRITER_AVX
+   if(UseAVX())
+   {
+      RoundToUint16AVX(data,out,n);
+      return;
+   }
+#endif
+   for(unsigned int i=0;i<n;i++)
+      out[i]=static_cast<unsigned short>(data[i]+0.5);
+}
+
+//Round floats to uint16 - using AVX where the cpu supports it
+void BILWriter::RoundToType(const float* const data,unsigned short* const out,const unsigned int n)
+{
+#ifdef BILWRITER_AVX
+   if(UseAVX())
+   {
+      RoundToUint16AVX(data,out,n);
+      return;
+   }
+#endif
+   for(unsigned int i=0;i<n;i++)
+      out[i]=static_cast<unsigned short>(data[i]+0.5);
+}
+
 int BILWriter::WriteLine(char* const data)
 {
    //Check nsamps is known
@@ -266,6 +532,8 @@ int BILWriter::WriteLine(char* const data)
       this->bilinfo<<"A problem has occurred writing the line of data to file: "<<this->filename<<std::endl;
       return -1;   
    }
+   if(dostatistics)
+      UpdateStatistics(data,(uint64_t)numbands*numsamples);
    return 1;
 }
 
@@ -16,6 +16,8 @@
 #include <string>
 #include <sstream>
 #include <ctime>
+#include <vector>
+#include <algorithm>
 #include "commonfunctions.h"
 #include "filewriter.h"
 
@@ -45,15 +47,22 @@ public:
       for(unsigned int i=0;i<this->numsamples;i++)
          data[i]=static_cast<T>(xval);
       WriteDataToBandLineSection(data,this->numsamples,0,this->numsamples-1);
-      delete data;
+      delete[] data;
       data=NULL;
    }
 
+   int WriteBandLinesWithValue(const double xval,const unsigned int nbands); //write out nbands lines of constant value from a cached buffer
+
    int Close(); //Close the file, output the hdr information, check nrows/samples/bands agree with written filesize and call the destructor
 
    void AddToHdr(std::string item){hdrtext<<item<<std::endl;} //Adds the string item to the stringstream of header text
    void AddMetadata(std::string name,std::string value);
 
+   //Accumulate per band statistics of the data as it is written and output them
+   //to the header (or a sidecar filename.stats text file) when the file is closed
+   void EnableStatistics(const bool tosidecar=false);
+   void SetStatisticsIgnoreValue(const double value){statsignorevalue=value;usestatsignorevalue=true;} //values to count as no data
+
    bool IsGood()const{return isgood;}//Get the status of the BILWriter (1=good 0=bad)
    unsigned int GetDataSize() const {return datasize;}
 
@@ -162,7 +171,166 @@ public:
          WriteDataToBandLineSection(&data[numsamples_array*b],numsamples_array,start,end);
    }
 
+   //Data is an array of nbands consecutive band lines, each numsamples_array long.
+   //The section of each band line is converted into a reusable buffer and 
+   //all bands are written with a single write. The band order and/or the 
+   //sample order of the whole band line can be reversed as it is converted.
+   //If bandindex is given only those bands (nbands of them) of data are written
+   template<class T>
+   int WriteDataToBandLinesSection(T const data,const unsigned int nbands,const unsigned int numsamples_array,const unsigned int start, const unsigned int end,
+                                   const bool reversebands=false,const bool reversesamples=false,const unsigned int* const bandindex=NULL)
+   {
+      if((start > end)||(end >= numsamples_array))
+      {
+         this->bilinfo<<"Section to output is not within the passed array. Start: "<<start<<" End: "<<end<<" Num samples: "<<numsamples_array<<std::endl;
+         return -1;
+      }
+      const unsigned int nout=end-start+1;
+      if(linebuffer.size() < (uint64_t)nbands*nout*datasize)
+         linebuffer.resize((uint64_t)nbands*nout*datasize);
+
+      //First sample of the section in the (unreversed) band line
+      const unsigned int first=reversesamples ? numsamples_array-1-end : start;
+      for(unsigned int b=0;b<nbands;b++)
+      {
+         //bandindex (if given) maps output bands to the bands of data to use
+         const unsigned int outband=reversebands ? nbands-1-b : b;
+         const unsigned int sourceband=(bandindex!=NULL) ? bandindex[outband] : outband;
+         char* const out=&linebuffer[(uint64_t)b*nout*datasize];
+         ConvertToDataType(&data[(uint64_t)sourceband*numsamples_array+first],out,nout);
+         if(reversesamples)
+            ReverseValues(out,nout);
+      }
+
+      return WriteValues(&linebuffer[0],(uint64_t)nbands*nout);
+   }
+
 private:
+   //Convert n values to the output data type into out - rounding to nearest for integer types
+   template<class T>
+   void ConvertToDataType(T const data,char* const out,const unsigned int n)
+   {
+      switch(datatype)
+      {
+      case 1:
+         RoundToType(data,reinterpret_cast<unsigned char*>(out),n);
+         break;
+      case 2:
+         RoundToType(data,reinterpret_cast<short*>(out),n);
+         break;
+      case 3:
+         RoundToType(data,reinterpret_cast<int*>(out),n);
+         break;
+      case 4:
+         CastToType(data,reinterpret_cast<float*>(out),n);
+         break;
+      case 5:
+         CastToType(data,reinterpret_cast<double*>(out),n);
+         break;
+      case 12:
+         RoundToType(data,reinterpret_cast<unsigned short*>(out),n);
+         break;
+      case 13:
+         RoundToType(data,reinterpret_cast<unsigned int*>(out),n);
+         break;
+      default:
+         break;
+      }
+   }
+
+   template<class T,class U>
+   static void RoundToType(T const data,U* const out,const unsigned int n)
+   {
+      for(unsigned int i=0;i<n;i++)
+         out[i]=static_cast<U>(data[i]+0.5);// add on 0.5 to round to nearest
+   }
+
+   template<class T,class U>
+   static void CastToType(T const data,U* const out,const unsigned int n)
+   {
+      for(unsigned int i=0;i<n;i++)
+         out[i]=static_cast<U>(data[i]);
+   }
+
+   //Vectorised versions for the usual case of calibrated doubles (or floats) to uint16
+   static void RoundToType(const double* const data,unsigned short* const out,const unsigned int n);
+   static void RoundToType(double* const data,unsigned short* const out,const unsigned int n){RoundToType(const_cast<const double*>(data),out,n);}
+   static void RoundToType(const float* const data,unsigned short* const out,const unsigned int n);
+   static void RoundToType(float* const data,unsigned short* const out,const unsigned int n){RoundToType(const_cast<const float*>(data),out,n);}
+
+   //Running statistics of the valid values written to a band
+   struct BandStatistics
+   {
+      BandStatistics():count(0),ignored(0),minimum(0),maximum(0),mean(0),m2(0){}
+      uint64_t count,ignored;
+      double minimum,maximum,mean,m2; //m2 is the sum of squared differences from the mean
+   };
+
+   template<class U>
+   void AccumulateStatistics(const U* const values,const unsigned int n,BandStatistics& stats)
+   {
+      //Get the statistics of this run of values then merge them with the
+      //running ones (Chan et al.) so that the variance remains accurate
+      uint64_t count=0;
+      double sum=0,minimum=0,maximum=0;
+      for(unsigned int i=0;i<n;i++)
+      {
+         const double v=static_cast<double>(values[i]);
+         if((v!=v)||((usestatsignorevalue)&&(v==statsignorevalue)))
+            continue;
+         if((count==0)||(v<minimum))
+            minimum=v;
+         if((count==0)||(v>maximum))
+            maximum=v;
+         sum+=v;
+         count++;
+      }
+      stats.ignored+=n-count;
+      if(count==0)
+         return;
+
+      const double mean=sum/count;
+      double m2=0;
+      for(unsigned int i=0;i<n;i++)
+      {
+         const double v=static_cast<double>(values[i]);
+         if((v!=v)||((usestatsignorevalue)&&(v==statsignorevalue)))
+            continue;
+         m2+=(v-mean)*(v-mean);
+      }
+
+      if(stats.count==0)
+      {
+         stats.minimum=minimum;
+         stats.maximum=maximum;
+      }
+      else
+      {
+         stats.minimum=std::min(stats.minimum,minimum);
+         stats.maximum=std::max(stats.maximum,maximum);
+      }
+      const double total=static_cast<double>(stats.count+count);
+      const double delta=mean-stats.mean;
+      stats.m2+=m2+delta*delta*stats.count*count/total;
+      stats.mean+=delta*count/total;
+      stats.count+=count;
+   }
+
+   void UpdateStatistics(const char* const data,const uint64_t nvalues); //add nvalues of written data to the band statistics
+   void OutputStatistics(); //add the statistics to the header or sidecar file
+
+   int WriteValues(const char* const data,const uint64_t nvalues); //write nvalues of already converted data
+   void ReverseValues(char* const values,const unsigned int n); //reverse the order of n values of already converted data
+
+   std::vector<char> linebuffer; //reused buffer for converted data
+   std::vector<char> fillbuffer; //cached converted line(s) of constant value
+   double fillvalue; //value held in fillbuffer
+
+   bool dostatistics,statstosidecar,usestatsignorevalue;
+   double statsignorevalue;
+   uint64_t statsposition; //number of values written since statistics were enabled
+   std::vector<BandStatistics> bandstats;
+
    unsigned int numrows,numsamples,numbands,datasize,datatype;
    std::string filename; //name of output bil file (without an extension, so will output to filename.bil, filename.hdr)
    std::ofstream fileout; //stream object
@@ -10,6 +10,8 @@
 
 #include <cmath>
 #include <typeinfo>
+#include <algorithm>
+#include <set>
 
 #include "calibration.h"
 //-------------------------------------------------------------------------
@@ -22,7 +24,7 @@ Data::Data(unsigned long size)
    fodis=NULL;
    mask=NULL;
    badpixmethod=NULL;
-   image=new double[size];
+   image=new calfloat[size];
    avdark=NULL;
    gains=NULL;
 
@@ -58,7 +60,7 @@ void Data::InitialiseDarkFrames()
 {
    if(avdark==NULL) 
    {
-      avdark=new double[arraysize];
+      avdark=new calfloat[arraysize];
       for(unsigned long i=0;i<arraysize;i++)
          avdark[i]=0;
    }
@@ -97,7 +99,7 @@ void Data::InitialiseFodis()
 {
    if(fodis==NULL) 
    {
-      fodis=new double[arraysize];
+      fodis=new calfloat[arraysize];
       for(unsigned long i=0;i<arraysize;i++)
          fodis[i]=0;
    }
@@ -110,7 +112,7 @@ void Data::InitialiseGains()
 {
    if(gains==NULL) 
    {
-      gains=new double[arraysize];
+      gains=new calfloat[arraysize];
       for(unsigned long i=0;i<arraysize;i++)
          gains[i]=0;
    }
@@ -118,43 +120,82 @@ void Data::InitialiseGains()
 
 
 //-------------------------------------------------------------------------
-//Function to transform the ordering of data in arrays
+// Function to check if a bit has been set in the mask, if not (and it should be) it sets it
 //-------------------------------------------------------------------------
-void Data::TransformArrays(const unsigned int bands, const unsigned int samples,TransformArray order)
+void Data::AssignMaskValue(const unsigned int ele,const Specim::MaskType type)
 {
-   if(samples*bands != arraysize)
-      throw "Cannot transform data arrays as given number of bands/samples does not agree with array size.";
-
-   if(fodis!=NULL)
+   //Check the mask has been initialised
+   if(mask==NULL)
    {
-      if(order == BAND) 
-         FlipBandData(fodis,bands,samples);
-      else if(order == SAMPLE)
-         FlipSampleData(fodis,bands,samples);
+      throw "Error assigning mask value prior to mask being initialised.";
    }
-   if(mask!=NULL)
+
+   //Simple check to see if the mask has any value yet
+   if(mask[ele]==0)
    {
-      if(order == BAND) 
-         FlipBandData(mask,bands,samples);
-      else if(order == SAMPLE)
-         FlipSampleData(mask,bands,samples);
+      mask[ele]+=type;
+      return;
    }
-   if(badpixmethod!=NULL)
+   //the mask has a value - check if the bit we want to set is already set
+   if(mask[ele]&type)
    {
-      if(order == BAND) 
-         FlipBandData(badpixmethod,bands,samples);
-      else if(order == SAMPLE)
-         FlipSampleData(badpixmethod,bands,samples);
+      //This bit has already been set - do nothing
+      return;
    }
-   if(image!=NULL)
+   else
    {
-      if(order == BAND) 
-         FlipBandData(image,bands,samples);
-      else if(order == SAMPLE)
-         FlipSampleData(image,bands,samples);
+      //Set the bit
+      mask[ele]+=type;   
+      return;
    }
 }
 
+//-------------------------------------------------------------------------
+// Function to clear the arrays that are updated per line of the
+// calibration procedure
+//-------------------------------------------------------------------------
+void Data::ClearPerlineArrays()
+{
+   if(image!=NULL)
+      ClearArray(image);
+   if(fodis!=NULL)
+      ClearArray(fodis);
+   if(mask!=NULL)
+      ClearArray(mask);
+   if(badpixmethod!=NULL)
+      ClearArray(badpixmethod);
+}
+
+//-------------------------------------------------------------------------
+// Function to overwrite the mask and bad pixel method arrays with those of
+// the source data object
+//-------------------------------------------------------------------------
+void Data::CopyMaskArrays(const Data* const source)
+{
+   if(source->ArraySize()!=arraysize)
+      throw "Cannot copy mask arrays from a data object of a different size.";
+
+   if((mask!=NULL)&&(source->Mask()!=NULL))
+      std::copy(source->Mask(),source->Mask()+arraysize,mask);
+   if((badpixmethod!=NULL)&&(source->BadPixMethod()!=NULL))
+      std::copy(source->BadPixMethod(),source->BadPixMethod()+arraysize,badpixmethod);
+}
+
+//-------------------------------------------------------------------------
+// Constructor for the subsensor information
+//-------------------------------------------------------------------------
+SubSensorInfo::SubSensorInfo()
+{
+   nbands=nsamples=0;
+   rawmax=calibratedmax=0;
+   radscalar=0;
+   integrationtime=0;
+   lowerbandlimit=0;
+   firstrawband=0;
+   bin=NULL;
+   calibratebands=0;
+}
+
 //-------------------------------------------------------------------------
 // Calibration constructor 
 //-------------------------------------------------------------------------
@@ -164,7 +205,9 @@ Calibration::Calibration(Specim* sen,std::string calFile)
    sensor=sen;
    thissubsensor=0;
    calibrationFilenamePrefix=calFile;
+   blocklines=32;
    badpixels=NULL;
+   masktemplates=NULL;
 
    if(CheckSensorID(FENIX,this->sensor->SensorID()))
    {      
@@ -204,6 +247,27 @@ Calibration::Calibration(Specim* sen,std::string calFile)
       revbandmap=sensorrevbandmap;
    }
 
+   //Take a copy of the sensor values for each subsensor so that the per line
+   //functions do not depend on which subsensor the sensor is set up for
+   subsensorinfo=new SubSensorInfo[numofsensordata];
+   for(unsigned int i=0;i<numofsensordata;i++)
+   {
+      ChangeSubSensor(i);
+      subsensorinfo[i].nbands=sensor->NumBands();
+      subsensorinfo[i].calibratebands=sensor->NumBands();
+      subsensorinfo[i].nsamples=sensor->NumSamples();
+      subsensorinfo[i].rawmax=sensor->RawMax();
+      subsensorinfo[i].calibratedmax=sensor->CalibratedMax();
+      subsensorinfo[i].radscalar=sensor->RadianceScalar();
+      subsensorinfo[i].integrationtime=sensor->IntegrationTime();
+      subsensorinfo[i].lowerbandlimit=sensor->LowerBandLimit();
+      subsensorinfo[i].bin=sensor->bin;
+      //Fenix subsensors are a range of bands of the raw frame
+      if(dynamic_cast<FenixBinFile*>(sensor->bin)!=NULL)
+         subsensorinfo[i].firstrawband=dynamic_cast<FenixBinFile*>(sensor->bin)->SubsensorLowerBand();
+   }
+   ChangeSubSensor(0);
+
    //If mask is requested - initialise it - always do this?
    InitialiseMask();
 }
@@ -274,6 +338,17 @@ Calibration::~Calibration()
    delete sensordata;
    delete[] sensorbandmap;
    delete[] sensorrevbandmap;
+   delete[] subsensorinfo;
+
+   if(masktemplates!=NULL)
+   {
+      for(unsigned int s=0;s<numofsensordata;s++)
+         delete masktemplates[s];
+      delete[] masktemplates;
+   }
+
+   delete[] rawblocks[0].data;
+   delete[] rawblocks[1].data;
 
    if(badpixels!=NULL)
       delete[] badpixels;
@@ -511,17 +586,196 @@ void Calibration::CheckCalWavelengths(float* const wl_cal, const unsigned int nu
 }
 
 //-------------------------------------------------------------------------
-//Function to read line of raw
+//Function to read line of raw. Only finding/reading the block of raw frames
+//is done with the readmutex locked so frames are converted on several threads at once
 //-------------------------------------------------------------------------
-void Calibration::ReadLineOfRaw(unsigned int line)
+void Calibration::ReadLineOfRaw(Data* const linedata,const unsigned int subsensor,const unsigned int line)
 {
-   sensor->bin->ReadlineToDoubles(data->Image(),line);
+   const SubSensorInfo& info=subsensorinfo[subsensor];
+   RawBlock* block=NULL;
+   {
+      ScopedLock lock(readmutex);
+      while(block==NULL)
+      {
+         //Find the block holding this line - if there is none then read a new
+         //block starting from this line in place of the empty/earliest block
+         for(unsigned int i=0;i<2;i++)
+         {
+            if((line>=rawblocks[i].startline)&&(line<rawblocks[i].startline+rawblocks[i].numlines))
+               block=&rawblocks[i];
+         }
+         if(block==NULL)
+         {
+            RawBlock* replace=NULL;
+            if(rawblocks[0].numlines==0)
+               replace=&rawblocks[0];
+            else if(rawblocks[1].numlines==0)
+               replace=&rawblocks[1];
+            else if(rawblocks[0].startline<=rawblocks[1].startline)
+               replace=&rawblocks[0];
+            else
+               replace=&rawblocks[1];
+
+            //Wait for other threads to finish with the block before replacing it -
+            //then search again as the line may have been read in the meantime
+            if(replace->users!=0)
+            {
+               blockfree.Wait(readmutex);
+               continue;
+            }
+            ReadRawBlock(replace,info.bin,line);
+            block=replace;
+         }
+      }
+      block->users++;
+   }
+
+   //Convert this subsensors bands of the frame - or just those that are to be calibrated
+   char* const frame=&block->data[(line-block->startline)*info.bin->FrameSize()];
+   if(info.bandsteps.empty())
+      info.bin->FrameToValues(frame,linedata->Image(),info.firstrawband,info.nbands);
+   else
+   {
+      for(unsigned int b=0;b<info.calibratebands;b++)
+      {
+         if(info.bandsteps[b]!=0)
+            info.bin->FrameToValues(frame,&(linedata->Image()[b*(uint64_t)info.nsamples]),info.firstrawband+b,1);
+      }
+   }
+
+   //Release the block so that it can be replaced
+   ScopedLock lock(readmutex);
+   block->users--;
+   if(block->users==0)
+      blockfree.Broadcast();
 }
 
 //-------------------------------------------------------------------------
-//Function to initialise the dark frame array for subtraction
+// Function to only calibrate and output the given raw bands (numbered from
+// 0 in the raw file). Bands below a selected band are still partly 
+// calibrated for Eagle as they are needed for the smear correction and 
+// smear affected flagging.
 //-------------------------------------------------------------------------
-void Calibration::InitialiseDarkFrames(std::string darkfile)
+void Calibration::SetBandList(const std::vector<unsigned int>& rawbands)
+{
+   const unsigned char allsteps=CalibrationKernel::FLAGPIXELS | CalibrationKernel::REMOVEDARK | CalibrationKernel::APPLYGAINS;
+   const bool iseagle=CheckSensorID(EAGLE,sensor->SensorID());
+   unsigned int numselected=0;
+
+   for(unsigned int i=0;i<numofsensordata;i++)
+   {
+      SubSensorInfo& info=subsensorinfo[i];
+      info.bands.clear();
+      info.bandsteps.assign(info.nbands,0);
+
+      for(std::vector<unsigned int>::const_iterator it=rawbands.begin();it!=rawbands.end();it++)
+      {
+         if((*it >= info.firstrawband)&&(*it < info.firstrawband+info.nbands))
+         {
+            if(info.bandsteps[*it-info.firstrawband]==0)
+            {
+               info.bands.push_back(*it-info.firstrawband);
+               info.bandsteps[*it-info.firstrawband]=allsteps;
+               numselected++;
+            }
+         }
+      }
+      std::sort(info.bands.begin(),info.bands.end());
+
+      //Only the bands up to the last selected one need calibrating
+      info.calibratebands=info.bands.empty() ? 0 : info.bands.back()+1;
+      if(iseagle)
+      {
+         for(unsigned int b=0;b<info.calibratebands;b++)
+         {
+            if(info.bandsteps[b]==0)
+               info.bandsteps[b]=CalibrationKernel::FLAGPIXELS | CalibrationKernel::REMOVEDARK;
+         }
+      }
+   }
+
+   if(numselected!=std::set<unsigned int>(rawbands.begin(),rawbands.end()).size())
+      throw "Band list contains bands that are not in the raw data - bands should be between 0 and "+ToString(sensor->TotalNumBands()-1);
+
+   Logger::Log("Will only calibrate and output "+ToString(numselected)+" bands.");
+}
+
+//-------------------------------------------------------------------------
+// Function to return the selected raw band numbers - empty if all bands
+// are being calibrated
+//-------------------------------------------------------------------------
+std::vector<unsigned int> Calibration::SelectedRawBands()const
+{
+   std::vector<unsigned int> rawbands;
+   for(unsigned int i=0;i<numofsensordata;i++)
+   {
+      if(subsensorinfo[i].bandsteps.empty())
+         return std::vector<unsigned int>();
+      for(unsigned int b=0;b<subsensorinfo[i].bands.size();b++)
+         rawbands.push_back(subsensorinfo[i].firstrawband+subsensorinfo[i].bands[b]);
+   }
+   return rawbands;
+}
+
+//-------------------------------------------------------------------------
+// Function to return the total number of bands that will be output
+//-------------------------------------------------------------------------
+unsigned int Calibration::NumOutputBands()const
+{
+   unsigned int total=0;
+   for(unsigned int i=0;i<numofsensordata;i++)
+      total+=subsensorinfo[i].NumOutputBands();
+   return total;
+}
+
+//-------------------------------------------------------------------------
+// Function to read a block of raw frames starting from line into block
+// Should be called with the readmutex locked
+//-------------------------------------------------------------------------
+void Calibration::ReadRawBlock(RawBlock* const block,SpecimBinFile* const bin,const unsigned int line)
+{
+   if(line>=bin->NumLines())
+   {
+      throw "Trying to read a line beyond the end of the raw file: "+ToString(line);
+   }
+
+   //Invalidate the block until the read has succeeded
+   block->numlines=0;
+   block->startline=line;
+
+   unsigned int numlines=blocklines;
+   if(line+numlines > bin->NumLines())
+      numlines=bin->NumLines()-line;
+
+   //The buffer is reused unless it is too small
+   uint64_t size=numlines*bin->FrameSize();
+   if(size > block->size)
+   {
+      delete[] block->data;
+      block->data=new char[size];
+      block->size=size;
+   }
+
+   bin->ReadFrames(block->data,line,numlines);
+   block->numlines=numlines;
+}
+
+//-------------------------------------------------------------------------
+// Set the number of raw lines to read from the file in one go
+//-------------------------------------------------------------------------
+void Calibration::SetReadBlockLines(const unsigned int nlines)
+{
+   ScopedLock lock(readmutex);
+   if(nlines==0)
+      throw "Number of lines to read in a block must be at least 1.";
+   blocklines=nlines;
+}
+
+//-------------------------------------------------------------------------
+//Function to initialise the dark frame array for subtraction. The dark
+//lines are split between numthreads threads.
+//-------------------------------------------------------------------------
+void Calibration::InitialiseDarkFrames(std::string darkfile,const unsigned int numthreads)
 {
    if(data->AverageDark()!=NULL)
       throw "Average dark frame array already initialised - cannot do it twice.";
@@ -569,9 +823,12 @@ void Calibration::InitialiseDarkFrames(std::string darkfile)
          mean[looper]=stdev[looper]=0;
       }
 
-      sensor->AverageAllDarkFrames(mean,darkfile,data->ArraySize(),i);
-      sensor->DarkFramesStdDeviation(stdev,mean,darkfile,data->ArraySize(),i);
-      sensor->AverageRefinedDarkFrames(data->AverageDark(),stdev,mean,darkfile,data->ArraySize(),i);
+      sensor->DarkFrameStatistics(mean,stdev,darkfile,data->ArraySize(),i,numthreads);
+      //The average is calculated in double precision and then stored in the calibration type
+      double* average=new double[data->ArraySize()];
+      sensor->AverageRefinedDarkFrames(average,stdev,mean,darkfile,data->ArraySize(),i,numthreads);
+      std::copy(average,average+data->ArraySize(),data->AverageDark());
+      delete[] average;
 
       //Scale the darkframes if scalar is not = 1 - actually will exit now
       if(sensor->DarkScalar() != 1)
@@ -589,165 +846,115 @@ void Calibration::InitialiseDarkFrames(std::string darkfile)
 }
 
 //-------------------------------------------------------------------------
-//Function to remove dark frames
+// Function to apply the per pixel calibration steps (flagging of over/under
+// flows, removal of dark frames, applying gains) to the line of data. Steps
+// are from CalibrationKernel::Step and are all done in a single pass.
 //-------------------------------------------------------------------------
-void Calibration::RemoveDarkFrames()
+void Calibration::CalibratePixels(Data* const linedata,const unsigned int subsensor,const unsigned int steps)
 {
-
-   //Test if data avdark and image arrays exist
-   if(data->AverageDark()==NULL)
-      throw "The data -> average dark value array has not been initialised.";
-
-   if(data->Image()==NULL)
-      throw "The data -> image array has not been initialised.";
-
-   //For each element of the data buffer
-   for(unsigned int ele=0;ele<(sensor->NumBands()*sensor->NumSamples());ele++)
-   {  
-      if((data->Image()[ele]!=0)&&(data->Image()[ele]<sensor->CalibratedMax()))//Data is not under flown or above max calibrated value
-      {
-         //If the average dark value is larger than the maximum allowed this is bad
-         if(data->AverageDark()[ele]>sensor->RawMax())
-         {
-            throw "ERROR in RemoveDarkFrames. Average dark value is greater than raw maximum: "+ToString(data->AverageDark()[ele])+" > "+ToString(sensor->RawMax())+" element number "+ToString(ele);
-         }
-         else if(data->AverageDark()[ele]==sensor->RawMax())
-         {
-            //Send a message that the average dark for this pixel is the maximum value - only need to output it once though
-            Logger::WarnOnce("Average dark value for pixel "+ToString(ele)+" is the maximum raw value: "+ToString(sensor->RawMax()));
-         }
-
-         //If the data after subtraction is less than (or equals) 0 then set as underflow
-         if( (data->Image()[ele]-data->AverageDark()[ele]) <= 0) 
-         {
-            //DEBUGPRINT("Dark value: "<<data->AverageDark()[p]<<" Image value: "<<data->Image()[ele]<<" element: "<<ele);
-            data->Image()[ele]=0; // assign as an underflow
-            AssignMaskValue(ele,sensor->UnderFlow);   
-         }
-         else 
-            data->Image()[ele]=((data->Image()[ele]- data->AverageDark()[ele])); //subtract dark values to normalise to 0
-      }
-   }
+   const SubSensorInfo& info=subsensorinfo[subsensor];
+
+   CalibrationKernel kernel;
+   kernel.nbands=info.calibratebands;
+   kernel.nsamples=info.nsamples;
+   kernel.bandsteps=info.bandsteps.empty() ? NULL : &info.bandsteps[0];
+   kernel.rawmax=info.rawmax;
+   kernel.calibratedmax=info.calibratedmax;
+   kernel.avdark=sensordata[subsensor]->AverageDark();
+   kernel.gains=sensordata[subsensor]->Gains();
+   //Only the scalar is needed if gains are not being applied (integration time may be 0)
+   if(steps & CalibrationKernel::APPLYGAINS)
+      kernel.radmultiplier=info.radscalar / info.integrationtime;
+   //The frame counting pixels are in band 0 of the raw file - except for fenix SWIR
+   kernel.framecounterpixels=(info.lowerbandlimit==0);
+   //Also need to flag each corresponding sample for each lower band for the Eagle sensor
+   kernel.flagsmearaffected=CheckSensorID(EAGLE,sensor->SensorID());
+
+   //Start the mask from the bad pixels and qc failures that are flagged on every line
+   if(steps & CalibrationKernel::FLAGPIXELS)
+   {
+      if(masktemplates==NULL)
+         throw "Mask templates have not been initialised - cannot flag pixels.";
+      linedata->CopyMaskArrays(masktemplates[subsensor]);
+   }
+
+   kernel.Apply(linedata->Image(),linedata->Mask(),steps);
 }
 
-
-
 //-------------------------------------------------------------------------
-//Function to apply a frame smear correction to (eagle raw data - dark frames)
+//Function to check if smear correction can be applied to this sensor data
 //-------------------------------------------------------------------------
-bool Calibration::SmearCorrect()
+bool Calibration::CanSmearCorrect()
 {
-   //Frame smear correction scalar - frame transfer time / integration time
    //Check we have Eagle data
    if(!CheckSensorID(EAGLE,this->sensor->SensorID()))
    {
       Logger::Warning("Cannot apply smear correction to this sensor data - it claims not to be from an Eagle sensor. Skipping in future.");
       return false;
    }
-   else
-   {
-      //Logger::Log("Eagle data has been identified in Smear Correction.");
-   }
+   return true;
+}
 
+//-------------------------------------------------------------------------
+//Function to apply a frame smear correction to (eagle raw data - dark frames)
+//CanSmearCorrect() should be checked before calling this
+//-------------------------------------------------------------------------
+void Calibration::SmearCorrect(Data* const linedata,const unsigned int subsensor)
+{
    //Its OK to cast the sensor type to Eagle from here on - dynamic casting allows further safety
    Eagle* eagle=dynamic_cast<Eagle*>(this->sensor);
+   if(eagle==NULL)
+      throw "Cannot apply smear correction to non-Eagle sensor data.";
 
+   //Frame smear correction scalar - frame transfer time / integration time
    //Calculate smear scalar
    double fsc=(eagle->FrameTransferTime()/eagle->IntegrationTime())*(eagle->SpectralBinning());
    
    //calculate per pixel correction and apply
    //The fsc is multiplied by sum of (spectrally) previous bands. This is removed from current band.
    //Use the corrected bands not the uncorrected ones to correct the current band.
-
-   double bandsum=0; //value to hold the sum of the previous bands
-   unsigned long current_band_sample=0 ,previous_band_sample=0;
-
-   //For each sample of the frame
-   for(unsigned int s=0;s<eagle->NumSamples();s++)
-   {         
-      bandsum=0;//reset the bandsum variable to zero before entering band loop
-      //First band has no correction applied
-      for(unsigned int b=1;b<eagle->NumBands();b++)
-      {
-         //PROBLEM...DOES THIS NEED TO RUN FROM THE 1ST BAND OF CCD (IE 1024 BANDS)
-         //OR FROM THE FIRST BAND OF THE DATA. WILL ASSUME DATA FOR THE MOMENT SINCE NOTHING WE CAN DO IF REQUIRED FOR WHOLE CCD 
-
-         //Assign sample indices to variables to make the following clearer code
-         current_band_sample=b*eagle->NumSamples()+s;
-         previous_band_sample=(b-1)*eagle->NumSamples()+s;
-
-         //for each previous band, sum up the total - use a rolling total adding previous band each iteration
-         bandsum=bandsum+data->Image()[previous_band_sample];
-
-         //Now correct the current band 
-         data->Image()[current_band_sample]=((data->Image()[current_band_sample] - fsc*(bandsum)));
-         if(data->Image()[current_band_sample]<0)
-         {
-            //Assign as underflow
-            data->Image()[current_band_sample]=0;  
-            AssignMaskValue(current_band_sample,sensor->UnderFlow);   
-         }
-      }
-   }
-
-   return true;
+   //PROBLEM...DOES THIS NEED TO RUN FROM THE 1ST BAND OF CCD (IE 1024 BANDS)
+   //OR FROM THE FIRST BAND OF THE DATA. WILL ASSUME DATA FOR THE MOMENT SINCE NOTHING WE CAN DO IF REQUIRED FOR WHOLE CCD 
+   CalibrationKernel kernel;
+   kernel.nbands=subsensorinfo[subsensor].calibratebands;
+   kernel.nsamples=subsensorinfo[subsensor].nsamples;
+   kernel.SmearCorrect(linedata->Image(),linedata->Mask(),fsc);
 }
 
 //-------------------------------------------------------------------------
-// Function to apply the gains from the calibration file to the image data
-// Also handles some checking of the gains, binning etc
+// Function to read in the gains from the calibration file for each
+// subsensor. Also handles some checking of the gains, binning etc
 //-------------------------------------------------------------------------
-void Calibration::ApplyGains()
+void Calibration::InitialiseGains()
 {
    //Do some checks that everything is in place
    if(this->calibrationFilenamePrefix.compare("")==0)
    {
       throw "Cannot apply gains if calibration file is not set.";
    }
-   
-   //Read in the gains from file
-   //Bin the gains to the correct size (checking cal vs Raw)
-   if(data->Gains()==NULL)
-   {
-      data->InitialiseGains();
-      ReadBinAndTrimGains(data->Gains());
-   }
 
-   //Apply the gains
-   if((sensor->IntegrationTime() == 0))
+   for(unsigned int i=0;i<numofsensordata;i++)
    {
-      throw "Error integration time is 0 in ApplyGains()."; 
-   }
-
-   // we need to scale the radiances by this value
-   double radmultiplier= sensor->RadianceScalar() / sensor->IntegrationTime(); 
-
-   //temporary double to test value
-   double tempval=0; 
+      if(subsensorinfo[i].integrationtime == 0)
+      {
+         throw "Error integration time is 0 in InitialiseGains()."; 
+      }
 
-   //For each element of the data buffer we want to apply the calibration
-   for(unsigned int ele=0;ele<sensor->NumBands()*sensor->NumSamples();ele++)
-   {  
-      if((data->Image()[ele]!=0)&&(data->Image()[ele]!=sensor->CalibratedMax()))
+      //Read in the gains from file
+      //Bin the gains to the correct size (checking cal vs Raw)
+      ChangeSubSensor(i);
+      if(data->Gains()==NULL)
       {
-         tempval=(data->Image()[ele]*data->Gains()[ele]*radmultiplier);//scale by the calibration multipliers
-         if((tempval) >= sensor->CalibratedMax())
-         {
-            data->Image()[ele]=sensor->CalibratedMax(); // assign as an overflow
-            AssignMaskValue(ele,sensor->OverFlow);   
-         }
-         else
-         {
-            data->Image()[ele]=tempval;
-         }
-      }  
+         data->InitialiseGains();
+         ReadBinAndTrimGains(data->Gains());
+      }
    }
 }
 
 //-------------------------------------------------------------------------
 // Function to read in the calibration gains, bin them and trim unused bands
 //-------------------------------------------------------------------------
-void Calibration::ReadBinAndTrimGains(double* const trimmedcal)
+void Calibration::ReadBinAndTrimGains(calfloat* const trimmedcal)
 {
    std::string calibrationFilename=calibrationFilenamePrefix+".cal";
    BinFile calfile(calibrationFilename);
@@ -840,65 +1047,12 @@ void Calibration::ReadBinAndTrimGains(double* const trimmedcal)
 }
 
 //-------------------------------------------------------------------------
-// Function to apply pixel flags to the data
+// Function to flag the bad pixels (from the bad pixel file) and any qc
+// failure pixels in the mask
 //-------------------------------------------------------------------------
-void Calibration::FlagPixels()
+void Calibration::FlagBadPixels(Data* const linedata,const unsigned int subsensor)
 {
-   unsigned int p=0;
-
-   //For each element of this scan line of data we need to flag erroneous pixels
-   for(unsigned int band=0;band<sensor->NumBands();band++)
-   {
-      for(unsigned int sample=0;sample<sensor->NumSamples();sample++)
-      {
-         p=band*sensor->NumSamples() + sample;
-         //This is a pre-calibration test of the raw data - will not work for post calibrated data
-//         if((data->Image()[p] > sensor->RawMax())&&(data->Image()[p]!=sensor->CalibratedMax())&&((band!=0)&&(sample!=0)))
-//         {
-//            std::string error=std::string("Image contains data greater than the raw maximum. This should not happen...but has...Check the raw data at band,sample:")
-//                              +ToString(band)+" "+ToString(sample)+" value: "+ToString(data->Image()[p]);
-//            //throw error;
-//            Logger::Warning(error);
-//         }
-         if((band==0)&&((sample==0)||(sample==1)))
-         {
-            //this is the frame counting ccd pixel or the 0 pixel next to it
-            //  ... unless it is a fenix subsensor 1(SWIR). So check if the lower band 
-            // limit is 0 - meaning that band=0 truely means band 0 of the raw file
-            if(sensor->LowerBandLimit()==0)
-            {
-               data->Image()[p]=0; 
-               AssignMaskValue(p,sensor->Badpixel);   
-            }
-         }
-         else if(data->Image()[p] == sensor->RawMax())
-         {
-            //Overflowed data
-            AssignMaskValue(p,sensor->OverFlow);   
-            //also need to flag each corresponding sample for each lower band for the Eagle sensor
-            if(CheckSensorID(EAGLE,sensor->SensorID()))
-            {
-               for(unsigned int b=band+1;b<sensor->NumBands();b++)
-               {
-                  AssignMaskValue(b*sensor->NumSamples() + sample,sensor->SmearAffected);
-               }
-            }        
-         }
-         else if(data->AverageDark()!=NULL) //dark frames have been initialised
-         {
-            if(data->Image()[p] <= data->AverageDark()[p])
-            {
-               //Data have underflown
-               data->Image()[p]=0;
-               AssignMaskValue(p,sensor->UnderFlow);
-            }
-         }
-         else if((data->Image()[p] != sensor->CalibratedMax())&&(data->Image()[p] != sensor->RawMax()))
-         {
-            AssignMaskValue(p,sensor->Good);   
-         }
-      }
-   }
+   const SubSensorInfo& info=subsensorinfo[subsensor];
 
    //Flag "bad pixels" from the bad pixel file - if no bad pixels this loop is essentially skipped
    if((badpixels==NULL)&&(CheckSensorID(EAGLE,sensor->SensorID())))
@@ -917,19 +1071,19 @@ void Calibration::FlagPixels()
    }
    else //badpixels is not null
    {
-      for(unsigned int bp=0;bp<badpixels[thissubsensor].NumBadPixels();bp++) //loop through bad pixel array
+      for(unsigned int bp=0;bp<badpixels[subsensor].NumBadPixels();bp++) //loop through bad pixel array
       {
          //Test to make sure band is in image range - since fenix band range is synthetic (i.e 0 -> x, 0 -> y and not 0 -> x+y)
          //Only mask if the band is in use in the raw data
-         if(badpixels[thissubsensor].GetBadPixels()[2*bp+1]!=badpixels[thissubsensor].BandNotInUse())
+         if(badpixels[subsensor].GetBadPixels()[2*bp+1]!=badpixels[subsensor].BandNotInUse())
          {
-            AssignMaskValue((badpixels[thissubsensor].GetBadPixels()[2*bp+1])*sensor->NumSamples()
-                            + badpixels[thissubsensor].GetBadPixels()[2*bp],sensor->Badpixel);   
+            linedata->AssignMaskValue((badpixels[subsensor].GetBadPixels()[2*bp+1])*info.nsamples
+                            + badpixels[subsensor].GetBadPixels()[2*bp],sensor->Badpixel);   
            //Assign the detection method if ARSF bad pixel file
-            if((badpixels[thissubsensor].arsfbadpixelfiletype == true)&&(data->BadPixMethod()!=NULL))
+            if((badpixels[subsensor].arsfbadpixelfiletype == true)&&(linedata->BadPixMethod()!=NULL))
             {
-               data->BadPixMethod()[badpixels[thissubsensor].GetBadPixels()[2*bp+1]*sensor->NumSamples() 
-                                    + badpixels[thissubsensor].GetBadPixels()[2*bp]] = badpixels[thissubsensor].BadPixelMethod()[bp];
+               linedata->BadPixMethod()[badpixels[subsensor].GetBadPixels()[2*bp+1]*info.nsamples 
+                                    + badpixels[subsensor].GetBadPixels()[2*bp]] = badpixels[subsensor].BadPixelMethod()[bp];
             }
          }
       } 
@@ -939,13 +1093,36 @@ void Calibration::FlagPixels()
    if(sensor->qcfailures.size()!=0)
    {
       //If there are some qc failures - loop through them all and flag
-      for(std::vector<Pair>::iterator it=sensor->qcfailures.begin();it!=sensor->qcfailures.end();it++)
+      for(std::vector<Pair>::const_iterator it=sensor->qcfailures.begin();it!=sensor->qcfailures.end();it++)
       {
-         AssignMaskValue((*it).band*sensor->NumSamples() + (*it).sample,sensor->QCFailure);
+         linedata->AssignMaskValue((*it).band*info.nsamples + (*it).sample,sensor->QCFailure);
       }
    }
 }
 
+//-------------------------------------------------------------------------
+// Function to build, for each subsensor, the mask and bad pixel method 
+// arrays of the flags that do not change from line to line. This should
+// be called after the bad pixel and qc failure files have been read.
+//-------------------------------------------------------------------------
+void Calibration::InitialiseMaskTemplates()
+{
+   if(masktemplates==NULL)
+   {
+      masktemplates=new Data*[numofsensordata];
+      for(unsigned int i=0;i<numofsensordata;i++)
+         masktemplates[i]=NULL;
+   }
+
+   for(unsigned int i=0;i<numofsensordata;i++)
+   {
+      delete masktemplates[i];
+      masktemplates[i]=NewLineData(i);
+      if(masktemplates[i]->Mask()!=NULL)
+         FlagBadPixels(masktemplates[i],i);
+   }
+}
+
 //-------------------------------------------------------------------------
 // Function to read in the bad pixel file for sensor data
 //-------------------------------------------------------------------------
@@ -979,73 +1156,58 @@ bool Calibration::ReadBadPixelFile()
 }
 
 //-------------------------------------------------------------------------
-// Function to check if a bit has been set in the mask, if not (and it should be) it sets it
+// Function to check if the FODIS region can be averaged for this sensor
 //-------------------------------------------------------------------------
-void Calibration::AssignMaskValue(const unsigned int ele,const Specim::MaskType type)
+bool Calibration::CanAverageFodis()
 {
-   //Check the mask has been initialised
-   if(data->Mask()==NULL)
+   //Only run this for Eagle sensors
+   if(sensor->fodis==NULL)
    {
-      throw "Error assigning mask value prior to mask being initialised.";
+      Logger::Warning("No FODIS defined in sensor object - skipping in future.");
+      return false;
    }
 
-   //Simple check to see if the mask has any value yet
-   if(data->Mask()[ele]==0)
-   {
-      data->Mask()[ele]+=type;
-      return;
-   }
-   //the mask has a value - check if the bit we want to set is already set
-   if(data->Mask()[ele]&type)
-   {
-      //This bit has already been set - do nothing
-      return;
-   }
-   else
+   //Check that the sensor fodis values are useable
+   if((sensor->fodis->LowerFodis()==sensor->fodis->UpperFodis())||(sensor->fodis->LowerFodis()>sensor->fodis->UpperFodis()))
    {
-      //Set the bit
-      data->Mask()[ele]+=type;   
-      return;
+      Logger::Warning("Attempt to average FODIS for sensor without FODIS or with incorrect FODIS values in raw hdr file.");
+      return false;      
    }
+   return true;
 }
 
 //-------------------------------------------------------------------------
 // Function to average the FODIS region (over the samples) for this line
 // Get an average value per band of the data
+// CanAverageFodis() should be checked before calling this
 //-------------------------------------------------------------------------
-bool Calibration::AverageFodis()
+void Calibration::AverageFodis(Data* const linedata,const unsigned int subsensor)
 {
-   //Only run this for Eagle sensors
-   if(sensor->fodis==NULL)
-   {
-      Logger::Warning("No FODIS defined in sensor object - skipping in future.");
-      return false;
-   }
+   const calfloat* const image=linedata->Image();
+   const SubSensorInfo& info=subsensorinfo[subsensor];
+
    //Check that the fodis array exists
-   if(data->Fodis()==NULL)
+   if(linedata->Fodis()==NULL)
    {
       throw "Error averaging the FODIS - fodis array has not been initialised.";
    }
 
-   //Check that the sensor fodis values are useable
-   if((sensor->fodis->LowerFodis()==sensor->fodis->UpperFodis())||(sensor->fodis->LowerFodis()>sensor->fodis->UpperFodis()))
-   {
-      Logger::Warning("Attempt to average FODIS for sensor without FODIS or with incorrect FODIS values in raw hdr file.");
-      return false;      
-   }
-
    double sum=0;
    unsigned int numbertoaverageover=0;
-   for(unsigned int band=0;band<sensor->NumBands();band++)   
+   for(unsigned int band=0;band<info.nbands;band++)   
    {
+      //Skip bands that are not being output
+      if(!info.IsOutputBand(band))
+         continue;
+
       numbertoaverageover=0;
       //for each pixel of the fodis region for this line
       for(unsigned int p=sensor->fodis->LowerFodis();p<sensor->fodis->UpperFodis();p++)
       {
-         if(data->Image()[band*sensor->NumSamples() + p] != 0)
+         if(image[band*info.nsamples + p] != 0)
          {
             //Sum up the fodis pixels per band per line
-            sum=sum + data->Image()[band*sensor->NumSamples() + p]; 
+            sum=sum + image[band*info.nsamples + p]; 
             //Keep track of number of non-zero values  -only average over these
             numbertoaverageover++;
          }
@@ -1064,15 +1226,14 @@ bool Calibration::AverageFodis()
          sum=0;
       }
 
-      if(sum<sensor->CalibratedMax())
-         data->Fodis()[band*sensor->NumSamples()]=(sum);
+      if(sum<info.calibratedmax)
+         linedata->Fodis()[band*info.nsamples]=(sum);
       else
-         data->Fodis()[band*sensor->NumSamples()]=sensor->CalibratedMax();
+         linedata->Fodis()[band*info.nsamples]=info.calibratedmax;
 
       //reset sum for next band iteration
       sum=0;  
    } 
-   return true;
 }
 
 //-------------------------------------------------------------------------
@@ -1089,11 +1250,9 @@ int Calibration::CheckFrameCounter(unsigned int start,unsigned int end)
    if(start > end)
       throw "Error in checkframecounter - start frame should be less than end frame.";
 
-   //Get frame counter for frame start
-   double startcounter=sensor->bin->ReadCell(0,start,0);
-
-   //Get frame counter for frame end
-   double endcounter=sensor->bin->ReadCell(0,end,0);
+   //Frame counters are held in memory (read in a single pass on first use)
+   double startcounter=sensor->FrameCounter(start);
+   double endcounter=sensor->FrameCounter(end);
 
    return static_cast<int>(endcounter-startcounter);
 }
@@ -1104,22 +1263,27 @@ int Calibration::CheckFrameCounter(unsigned int start,unsigned int end)
 //-------------------------------------------------------------------------
 void Calibration::ClearPerlineData()
 {
-   if(data->Image()!=NULL)
-   {
-      data->ClearArray(data->Image());
-   }
-   if(data->Fodis()!=NULL)
-   {
-      data->ClearArray(data->Fodis());
-   }
-   if(data->Mask()!=NULL)
-   {
-      data->ClearArray(data->Mask());
-   }
-   if(data->BadPixMethod()!=NULL)
-   {
-      data->ClearArray(data->BadPixMethod());
-   }
+   data->ClearPerlineArrays();
+}
+
+//-------------------------------------------------------------------------
+// Function to create a new data object for calibrating a line of the 
+// given subsensor into. The per line arrays are set up to match those 
+// that have been initialised for the calibration.
+//-------------------------------------------------------------------------
+Data* Calibration::NewLineData(const unsigned int subsensor)const
+{
+   if(subsensor >= numofsensordata)
+      throw "Subsensor index in NewLineData is greater than number of sensors: "+ToString(subsensor);
+
+   Data* linedata=new Data(sensordata[subsensor]->ArraySize());
+   if(sensordata[subsensor]->Mask()!=NULL)
+      linedata->InitialiseMask();
+   if(sensordata[subsensor]->BadPixMethod()!=NULL)
+      linedata->InitialiseBadPixMethod();
+   if(sensordata[subsensor]->Fodis()!=NULL)
+      linedata->InitialiseFodis();
+   return linedata;
 }
 
 //-------------------------------------------------------------------------
@@ -11,10 +11,14 @@
 #ifndef CALIBRATION_H
 #define CALIBRATION_H
 
+#include <vector>
+#include <algorithm>
 #include "logger.h"
 #include "binfile.h"
 #include "bilwriter.h"
 #include "specimsensors.h"
+#include "os_dependant.h"
+#include "calibrationkernel.h"
 
 //-------------------------------------------------------------------------
 // Class to hold the various data used in the calibration
@@ -25,14 +29,12 @@ public:
    Data(unsigned long size);
    ~Data();
 
-   enum TransformArray{BAND,SAMPLE};
-
-   double* Fodis()const{return fodis;}
+   calfloat* Fodis()const{return fodis;}
    unsigned char* Mask()const{return mask;}
    unsigned char* BadPixMethod()const{return badpixmethod;}
-   double* Image()const{return image;}
-   double* AverageDark()const{return avdark;}
-   double* Gains()const{return gains;};
+   calfloat* Image()const{return image;}
+   calfloat* AverageDark()const{return avdark;}
+   calfloat* Gains()const{return gains;};
 
    unsigned long ArraySize()const{return arraysize;}
    void InitialiseFodis();
@@ -41,63 +43,9 @@ public:
    void InitialiseDarkFrames();
    void InitialiseGains();
 
-   void TransformArrays(const unsigned int bands, const unsigned int samples,TransformArray order);
-
-   template<class T>
-   void FlipBandData(T* array, const unsigned int bands, const unsigned int samples)
-   {
-      T* datacopy=new T[2*samples]; //create an array the size of two lines
-      unsigned int icount=0;
-      unsigned int max=bands-1;  
-      unsigned int rb=max;//set rb (reverse band) variable to be max of array position
-
-      for(unsigned int b=0;b<rb;b++)// for each band (upto rb) of data array
-      {
-         for(icount=0;icount<samples;icount++)
-         {
-            //copy the frame of the band of data
-            datacopy[icount]=array[b*samples + icount]; //enter a value into copy array of band x
-            datacopy[icount+samples]=array[rb*samples + icount]; //enter a value into copy array of band y 
-         }
-
-         //Now need to swap this data over
-         for(icount=0;icount<samples;icount++)
-         {
-            array[b*samples + icount]=datacopy[icount+samples];
-            array[rb*samples + icount]=datacopy[icount];
-         }
-         
-         //Now decrease rb
-         rb--;  
-      }
-      delete[] datacopy;
-   }
-
-   template<class T>
-   void FlipSampleData(T* array, const unsigned int bands, const unsigned int samples)
-   {
-      T* datacopy=new T[samples]; //create an array the size of one line
-      unsigned int icount=0,jcount=0;
-      unsigned int max=samples-1;
-      
-      jcount=max;//set jcount variable to be max of array position
- 
-      for(unsigned int b=0;b<bands;b++)// for each band of data array
-      {
-         jcount=max;//set jcount variable to be max of array position
-         for(icount=0;icount<samples;icount++)
-         {
-            datacopy[icount]=array[b*samples + jcount]; //enter a value into copy array
-            jcount--; //decrease original data array position
-         }
-         //Now swap the data over from copy back to orig
-         for(icount=0;icount<samples;icount++)
-         {
-            array[b*samples + icount]=datacopy[icount];
-         }
-      }
-      delete[] datacopy;
-   }
+   void AssignMaskValue(const unsigned int ele,const Specim::MaskType type);
+   void ClearPerlineArrays();
+   void CopyMaskArrays(const Data* const source);
 
    template<class T>
    void ClearArray(T* array)
@@ -109,17 +57,45 @@ public:
    }
  
 private:
-   double* fodis;
+   calfloat* fodis;
    unsigned char* mask;
    unsigned char* badpixmethod;
-   double* image;
-   double* avdark;
-   double* gains;
+   calfloat* image;
+   calfloat* avdark;
+   calfloat* gains;
 
    unsigned long arraysize;
 
 };
 
+//-------------------------------------------------------------------------
+// Class to hold a copy of the sensor values that change between the
+// subsensors (e.g. Fenix VNIR/SWIR) so that lines can be calibrated
+// without calling ChangeSubSensor
+//-------------------------------------------------------------------------
+class SubSensorInfo
+{
+public:
+   SubSensorInfo();
+
+   unsigned int nbands,nsamples;
+   unsigned short int rawmax,calibratedmax;
+   unsigned int radscalar;
+   double integrationtime;
+   unsigned int lowerbandlimit;
+   unsigned int firstrawband; //first band of this subsensor in the raw file frames
+   SpecimBinFile* bin;
+
+   //Subset of bands to calibrate and output - all bands if bandsteps is empty
+   std::vector<unsigned int> bands; //selected bands of this subsensor
+   std::vector<unsigned char> bandsteps; //CalibrationKernel steps needed for each band
+   unsigned int calibratebands; //number of bands from band 0 that need to be calibrated
+
+   unsigned int NumOutputBands()const{return bandsteps.empty() ? nbands : bands.size();}
+   const unsigned int* OutputBands()const{return ((bandsteps.empty())||(bands.empty())) ? NULL : &bands[0];}
+   bool IsOutputBand(const unsigned int b)const{return bandsteps.empty() || std::binary_search(bands.begin(),bands.end(),b);}
+};
+
 //-------------------------------------------------------------------------
 // Class to contain bad pixel lists (the ones read from files)
 //-------------------------------------------------------------------------
@@ -165,19 +141,29 @@ public:
    Calibration(Specim* sensor,std::string calFile="");
    ~Calibration();
 
-   void RemoveDarkFrames();
-   bool SmearCorrect();
-   void ApplyGains();
-   void FlagPixels();
-   bool AverageFodis();
+   //Per line functions - these only read the shared calibration arrays
+   //so may be called for different lines on different threads
+   void ReadLineOfRaw(Data* const linedata,const unsigned int subsensor,const unsigned int line);
+   void CalibratePixels(Data* const linedata,const unsigned int subsensor,const unsigned int steps);
+   void SmearCorrect(Data* const linedata,const unsigned int subsensor);
+   void AverageFodis(Data* const linedata,const unsigned int subsensor);
+
+   bool CanSmearCorrect();
+   bool CanAverageFodis();
 
    void TestCalfile();
-   void InitialiseDarkFrames(std::string darkfile="");
-   void ReadLineOfRaw(unsigned int line);
+   void InitialiseDarkFrames(std::string darkfile="",const unsigned int numthreads=1);
+   void InitialiseGains();
    int CheckFrameCounter(unsigned int start,unsigned int end);
+   void SetReadBlockLines(const unsigned int nlines);
+   void SetBandList(const std::vector<unsigned int>& rawbands);
+   std::vector<unsigned int> SelectedRawBands()const;
+   unsigned int NumOutputBands()const;
    void ClearPerlineData();
 
    const Data* pData()const{return data;}
+   Data* NewLineData(const unsigned int subsensor)const;
+   const SubSensorInfo& SubSensor(const unsigned int subsensor)const{return subsensorinfo[subsensor];}
    std::string CalibrationFile()const{return calibrationFilenamePrefix;}
 
    void InitialiseMask();
@@ -185,6 +171,7 @@ public:
    void InitialiseFodis();
    bool ReadBadPixelFile();
    void ReadQCFailureFile(std::string qcfailurefile);
+   void InitialiseMaskTemplates();
 
    void ChangeSubSensor(unsigned int sensorindex);
    unsigned int NumOfSubSensors()const{return numofsensordata;}
@@ -197,11 +184,37 @@ private:
    Data* data;
    Data** sensordata;
    Specim* sensor;
+   SubSensorInfo* subsensorinfo;
+   //Mask and bad pixel method arrays holding the flags that are the same for
+   //every line (bad pixels, qc failures) - each line starts from a copy of these
+   Data** masktemplates;
+
+   //Raw file reads are serialised as the readers hold a file position. The
+   //mutex also guards the raw blocks, which are only replaced once no thread
+   //is converting frames from them (signalled by blockfree)
+   Mutex readmutex;
+   Condition blockfree;
+
+   //Blocks of raw frames read from the file in one go. Two are kept so that
+   //lines still being read from the previous block are not re-read when
+   //a new block is started
+   class RawBlock
+   {
+   public:
+      RawBlock(){data=NULL;size=0;startline=0;numlines=0;users=0;}
+      char* data;
+      uint64_t size;
+      unsigned int startline,numlines;
+      unsigned int users; //number of threads converting frames from the block
+   };
+   RawBlock rawblocks[2];
+   unsigned int blocklines;
+   void ReadRawBlock(RawBlock* const block,SpecimBinFile* const bin,const unsigned int line);
 
    unsigned int GetBinningRatio(std::string bintype);
    void CheckCalWavelengths(float* const wl_cal, const unsigned int numwl_cal);
-   void ReadBinAndTrimGains(double* const trimmedcal);
-   void AssignMaskValue(const unsigned int ele,const Specim::MaskType type);
+   void ReadBinAndTrimGains(calfloat* const trimmedcal);
+   void FlagBadPixels(Data* const linedata,const unsigned int subsensor);
 
    //Maps to hold the mapping from raw band -> cal file bands and vice versa
    std::map<int,int>* bandmap; //raw to cal
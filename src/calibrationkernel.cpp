@@ -0,0 +1,598 @@
+//------------------------------------------------------------------------- 
+//Copyright (c) 2013 Natural Environment Research Council (NERC) UK 
+// 
+//This file is part of APL (Airborne Processing Library)
+//Licensed under the APL Open Software License version 1.0 
+// 
+//You should have received a copy of the Licence along with the APL source 
+//If not, please contact arsf-processing@pml.ac.uk 
+//-------------------------------------------------------------------------
+
+#include <cstring>
+#include "calibrationkernel.h"
+
+//Only build the vectorised version where gcc can target AVX2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   #define CALIBRATIONKERNEL_AVX2
+   #include <immintrin.h>
+#endif
+
+//-------------------------------------------------------------------------
+// Constructor
+//-------------------------------------------------------------------------
+CalibrationKernel::CalibrationKernel()
+{
+   nbands=nsamples=0;
+   rawmax=calibratedmax=0;
+   radmultiplier=0;
+   avdark=NULL;
+   gains=NULL;
+   bandsteps=NULL;
+   framecounterpixels=false;
+   flagsmearaffected=false;
+}
+
+//-------------------------------------------------------------------------
+// Returns true if the cpu supports AVX2 instructions
+//-------------------------------------------------------------------------
+bool CalibrationKernel::UseAVX2()
+{
+#ifdef CALIBRATIONKERNEL_AVX2
+   static const bool avx2=(__builtin_cpu_supports("avx2")!=0);
+   return avx2;
+#else
+   return false;
+#endif
+}
+
+//-------------------------------------------------------------------------
+// Apply the requested steps to the line of image data, flagging the mask
+//-------------------------------------------------------------------------
+void CalibrationKernel::Apply(calfloat* const image,unsigned char* const mask,const unsigned int steps)const
+{
+   if(image==NULL)
+      throw "The data -> image array has not been initialised.";
+
+   if(mask==NULL)
+      throw "Error assigning mask value prior to mask being initialised.";
+
+   if((steps & REMOVEDARK)&&(avdark==NULL))
+      throw "The data -> average dark value array has not been initialised.";
+
+   if((steps & APPLYGAINS)&&(gains==NULL))
+      throw "Cannot apply gains as they have not been initialised.";
+
+   if(UseAVX2())
+      ApplyAVX2(image,mask,steps);
+   else
+      ApplyScalar(image,mask,steps);
+}
+
+//-------------------------------------------------------------------------
+// Apply the smear correction to the line of image data. Works a band at a
+// time keeping a running sum of the previous bands for each sample
+//-------------------------------------------------------------------------
+void CalibrationKernel::SmearCorrect(calfloat* const image,unsigned char* const mask,const calfloat fsc)const
+{
+   if(image==NULL)
+      throw "The data -> image array has not been initialised.";
+
+   if(mask==NULL)
+      throw "Error assigning mask value prior to mask being initialised.";
+
+   if(UseAVX2())
+      SmearCorrectAVX2(image,mask,fsc);
+   else
+      SmearCorrectScalar(image,mask,fsc);
+}
+
+//-------------------------------------------------------------------------
+// Scalar version of the smear correction
+//-------------------------------------------------------------------------
+void CalibrationKernel::SmearCorrectScalar(calfloat* const image,unsigned char* const mask,const calfloat fsc)const
+{
+   //Sum of the (corrected) spectrally previous bands for each sample
+   std::vector<calfloat> bandsum(nsamples,0);
+
+   //First band has no correction applied
+   for(unsigned int b=1;b<nbands;b++)
+   {
+      const unsigned long row=b*(unsigned long)nsamples;
+      for(unsigned int s=0;s<nsamples;s++)
+      {
+         bandsum[s]=bandsum[s]+image[row-nsamples+s];
+         image[row+s]=image[row+s] - fsc*bandsum[s];
+         if(image[row+s]<0)
+         {
+            //Assign as underflow
+            image[row+s]=0;
+            mask[row+s]|=Specim::UnderFlow;
+         }
+      }
+   }
+}
+
+//-------------------------------------------------------------------------
+// Check the average dark value is usable - only called when it is at
+// least the raw maximum value
+//-------------------------------------------------------------------------
+void CalibrationKernel::CheckDarkValue(const unsigned long p)const
+{
+   //If the average dark value is larger than the maximum allowed this is bad
+   if(avdark[p]>rawmax)
+   {
+      throw "ERROR in RemoveDarkFrames. Average dark value is greater than raw maximum: "+ToString(avdark[p])+" > "+ToString(rawmax)+" element number "+ToString(p);
+   }
+   else if(avdark[p]==rawmax)
+   {
+      //Send a message that the average dark for this pixel is the maximum value - only need to output it once though
+      Logger::WarnOnce("Average dark value for pixel "+ToString(p)+" is the maximum raw value: "+ToString(rawmax));
+   }
+}
+
+//-------------------------------------------------------------------------
+// Apply the steps to a single pixel. overflowed holds, per sample, if a
+// previous band has overflowed (for smear affected flagging)
+//-------------------------------------------------------------------------
+inline void CalibrationKernel::ApplyToPixel(const unsigned long p,const unsigned int sample,calfloat* const image,unsigned char* const mask,
+                                            const unsigned int steps,std::vector<unsigned char>& overflowed)const
+{
+   calfloat value=image[p];
+   unsigned char flags=0;
+
+   if(steps & FLAGPIXELS)
+   {
+      //Flag the pixel if a spectrally previous pixel overflowed
+      if((flagsmearaffected)&&(overflowed[sample]))
+         flags|=Specim::SmearAffected;
+
+      if(value==rawmax)
+      {
+         //Overflowed data
+         flags|=Specim::OverFlow;
+         if(flagsmearaffected)
+            overflowed[sample]=1;
+      }
+      else if((avdark!=NULL)&&(value<=avdark[p]))
+      {
+         //Data have underflown
+         value=0;
+         flags|=Specim::UnderFlow;
+      }
+   }
+
+   if(steps & REMOVEDARK)
+   {
+      //Data is not under flown or above max calibrated value
+      if((value!=0)&&(value<calibratedmax))
+      {
+         if(avdark[p]>=rawmax)
+            CheckDarkValue(p);
+
+         //If the data after subtraction is less than (or equals) 0 then set as underflow
+         if((value-avdark[p])<=0)
+         {
+            value=0;
+            flags|=Specim::UnderFlow;
+         }
+         else
+            value=value-avdark[p];
+      }
+   }
+
+   if(steps & APPLYGAINS)
+   {
+      if((value!=0)&&(value!=calibratedmax))
+      {
+         //scale by the calibration multipliers
+         calfloat scaled=value*gains[p]*radmultiplier;
+         if(scaled>=calibratedmax)
+         {
+            value=calibratedmax; // assign as an overflow
+            flags|=Specim::OverFlow;
+         }
+         else
+            value=scaled;
+      }
+   }
+
+   image[p]=value;
+   mask[p]|=flags;
+}
+
+//-------------------------------------------------------------------------
+// Scalar version of the kernel
+//-------------------------------------------------------------------------
+void CalibrationKernel::ApplyScalar(calfloat* const image,unsigned char* const mask,const unsigned int linesteps)const
+{
+   std::vector<unsigned char> overflowed(nsamples,0);
+
+   for(unsigned int b=0;b<nbands;b++)
+   {
+      //Only apply the steps needed for this band if a band subset is used
+      const unsigned int steps=(bandsteps==NULL) ? linesteps : (linesteps & bandsteps[b]);
+      if(steps==0)
+         continue;
+
+      unsigned int s=0;
+      if(b==0)
+      {
+         //The first two pixels of band 0 are not flagged. If this is band 0 of
+         //the raw file they are the frame counting ccd pixel and the 0 pixel next to it
+         for(;(s<2)&&(s<nsamples);s++)
+         {
+            if((framecounterpixels)&&(steps & FLAGPIXELS))
+            {
+               image[s]=0;
+               mask[s]|=Specim::Badpixel;
+            }
+            ApplyToPixel(s,s,image,mask,steps & ~FLAGPIXELS,overflowed);
+         }
+      }
+
+      for(;s<nsamples;s++)
+         ApplyToPixel(b*(unsigned long)nsamples+s,s,image,mask,steps,overflowed);
+   }
+}
+
+#ifdef CALIBRATIONKERNEL_AVX2
+
+//Lookup to expand a 4 bit movemask to 1 in each of 4 bytes (little endian)
+static const unsigned int expandbits[16]={0x00000000,0x00000001,0x00000100,0x00000101,
+                                          0x00010000,0x00010001,0x00010100,0x00010101,
+                                          0x01000000,0x01000001,0x01000100,0x01000101,
+                                          0x01010000,0x01010001,0x01010100,0x01010101};
+
+#ifndef APL_FLOAT_CALIBRATION
+
+//-------------------------------------------------------------------------
+// AVX2 version of the kernel - works on 4 samples at a time and uses the
+// scalar code for the first two pixels of band 0 and any remaining samples
+//-------------------------------------------------------------------------
+__attribute__((target("avx2")))
+void CalibrationKernel::ApplyAVX2(calfloat* const image,unsigned char* const mask,const unsigned int linesteps)const
+{
+   std::vector<unsigned char> overflowed(nsamples,0);
+
+   const __m256d zero=_mm256_setzero_pd();
+   const __m256d rawmaxv=_mm256_set1_pd(rawmax);
+   const __m256d calmaxv=_mm256_set1_pd(calibratedmax);
+   const __m256d radmultv=_mm256_set1_pd(radmultiplier);
+
+   for(unsigned int b=0;b<nbands;b++)
+   {
+      //Only apply the steps needed for this band if a band subset is used
+      const unsigned int steps=(bandsteps==NULL) ? linesteps : (linesteps & bandsteps[b]);
+      if(steps==0)
+         continue;
+
+      const unsigned long row=b*(unsigned long)nsamples;
+      unsigned int s=0;
+      if(b==0)
+      {
+         //The first two pixels of band 0 are not flagged. If this is band 0 of
+         //the raw file they are the frame counting ccd pixel and the 0 pixel next to it
+         for(;(s<2)&&(s<nsamples);s++)
+         {
+            if((framecounterpixels)&&(steps & FLAGPIXELS))
+            {
+               image[s]=0;
+               mask[s]|=Specim::Badpixel;
+            }
+            ApplyToPixel(s,s,image,mask,steps & ~FLAGPIXELS,overflowed);
+         }
+      }
+
+      for(;s+4<=nsamples;s+=4)
+      {
+         const unsigned long p=row+s;
+         __m256d value=_mm256_loadu_pd(image+p);
+         int over=0,under=0,smear=0;
+
+         if(steps & FLAGPIXELS)
+         {
+            __m256d isover=_mm256_cmp_pd(value,rawmaxv,_CMP_EQ_OQ);
+            over=_mm256_movemask_pd(isover);
+            if(flagsmearaffected)
+            {
+               for(unsigned int k=0;k<4;k++)
+               {
+                  if(overflowed[s+k])
+                     smear|=(1<<k);
+                  if(over & (1<<k))
+                     overflowed[s+k]=1;
+               }
+            }
+            if(avdark!=NULL)
+            {
+               __m256d isunder=_mm256_andnot_pd(isover,_mm256_cmp_pd(value,_mm256_loadu_pd(avdark+p),_CMP_LE_OQ));
+               under|=_mm256_movemask_pd(isunder);
+               value=_mm256_blendv_pd(value,zero,isunder);
+            }
+         }
+
+         if(steps & REMOVEDARK)
+         {
+            const __m256d dark=_mm256_loadu_pd(avdark+p);
+            __m256d todo=_mm256_and_pd(_mm256_cmp_pd(value,zero,_CMP_NEQ_UQ),_mm256_cmp_pd(value,calmaxv,_CMP_LT_OQ));
+            int check=_mm256_movemask_pd(_mm256_and_pd(todo,_mm256_cmp_pd(dark,rawmaxv,_CMP_GE_OQ)));
+            if(check)
+            {
+               for(unsigned int k=0;k<4;k++)
+                  if(check & (1<<k))
+                     CheckDarkValue(p+k);
+            }
+            __m256d diff=_mm256_sub_pd(value,dark);
+            __m256d isunder=_mm256_and_pd(todo,_mm256_cmp_pd(diff,zero,_CMP_LE_OQ));
+            under|=_mm256_movemask_pd(isunder);
+            value=_mm256_blendv_pd(value,diff,todo);
+            value=_mm256_blendv_pd(value,zero,isunder);
+         }
+
+         if(steps & APPLYGAINS)
+         {
+            __m256d todo=_mm256_and_pd(_mm256_cmp_pd(value,zero,_CMP_NEQ_UQ),_mm256_cmp_pd(value,calmaxv,_CMP_NEQ_UQ));
+            __m256d scaled=_mm256_mul_pd(_mm256_mul_pd(value,_mm256_loadu_pd(gains+p)),radmultv);
+            __m256d isover=_mm256_and_pd(todo,_mm256_cmp_pd(scaled,calmaxv,_CMP_GE_OQ));
+            over|=_mm256_movemask_pd(isover);
+            value=_mm256_blendv_pd(value,scaled,todo);
+            value=_mm256_blendv_pd(value,calmaxv,isover);
+         }
+
+         _mm256_storeu_pd(image+p,value);
+
+         if(over|under|smear)
+         {
+            unsigned int flags=expandbits[over]*Specim::OverFlow | expandbits[under]*Specim::UnderFlow
+                               | expandbits[smear]*Specim::SmearAffected;
+            unsigned int current=0;
+            memcpy(&current,mask+p,4);
+            current|=flags;
+            memcpy(mask+p,&current,4);
+         }
+      }
+
+      //Remaining samples
+      for(;s<nsamples;s++)
+         ApplyToPixel(row+s,s,image,mask,steps,overflowed);
+   }
+}
+
+//-------------------------------------------------------------------------
+// AVX2 version of the smear correction - 4 samples at a time
+//-------------------------------------------------------------------------
+__attribute__((target("avx2")))
+void CalibrationKernel::SmearCorrectAVX2(calfloat* const image,unsigned char* const mask,const calfloat fsc)const
+{
+   std::vector<calfloat> bandsum(nsamples,0);
+
+   const __m256d zero=_mm256_setzero_pd();
+   const __m256d fscv=_mm256_set1_pd(fsc);
+
+   for(unsigned int b=1;b<nbands;b++)
+   {
+      const unsigned long row=b*(unsigned long)nsamples;
+      unsigned int s=0;
+      for(;s+4<=nsamples;s+=4)
+      {
+         const unsigned long p=row+s;
+         __m256d sum=_mm256_add_pd(_mm256_loadu_pd(&bandsum[s]),_mm256_loadu_pd(image+p-nsamples));
+         _mm256_storeu_pd(&bandsum[s],sum);
+         __m256d value=_mm256_sub_pd(_mm256_loadu_pd(image+p),_mm256_mul_pd(fscv,sum));
+         __m256d isunder=_mm256_cmp_pd(value,zero,_CMP_LT_OQ);
+         _mm256_storeu_pd(image+p,_mm256_blendv_pd(value,zero,isunder));
+
+         int under=_mm256_movemask_pd(isunder);
+         if(under)
+         {
+            unsigned int current=0;
+            memcpy(&current,mask+p,4);
+            current|=expandbits[under]*Specim::UnderFlow;
+            memcpy(mask+p,&current,4);
+         }
+      }
+
+      //Remaining samples
+      for(;s<nsamples;s++)
+      {
+         bandsum[s]=bandsum[s]+image[row-nsamples+s];
+         image[row+s]=image[row+s] - fsc*bandsum[s];
+         if(image[row+s]<0)
+         {
+            image[row+s]=0;
+            mask[row+s]|=Specim::UnderFlow;
+         }
+      }
+   }
+}
+
+#else
+
+//-------------------------------------------------------------------------
+// Expand an 8 bit movemask to 1 in each of 8 bytes (little endian)
+//-------------------------------------------------------------------------
+static inline uint64_t ExpandBits8(const int bits)
+{
+   return static_cast<uint64_t>(expandbits[bits & 15]) | (static_cast<uint64_t>(expandbits[(bits>>4) & 15])<<32);
+}
+
+//-------------------------------------------------------------------------
+// Single precision AVX2 version of the kernel - works on 8 samples at a 
+// time and uses the scalar code for the first two pixels of band 0 and 
+// any remaining samples
+//-------------------------------------------------------------------------
+__attribute__((target("avx2")))
+void CalibrationKernel::ApplyAVX2(calfloat* const image,unsigned char* const mask,const unsigned int linesteps)const
+{
+   std::vector<unsigned char> overflowed(nsamples,0);
+
+   const __m256 zero=_mm256_setzero_ps();
+   const __m256 rawmaxv=_mm256_set1_ps(rawmax);
+   const __m256 calmaxv=_mm256_set1_ps(calibratedmax);
+   const __m256 radmultv=_mm256_set1_ps(radmultiplier);
+
+   for(unsigned int b=0;b<nbands;b++)
+   {
+      //Only apply the steps needed for this band if a band subset is used
+      const unsigned int steps=(bandsteps==NULL) ? linesteps : (linesteps & bandsteps[b]);
+      if(steps==0)
+         continue;
+
+      const unsigned long row=b*(unsigned long)nsamples;
+      unsigned int s=0;
+      if(b==0)
+      {
+         //The first two pixels of band 0 are not flagged. If this is band 0 of
+         //the raw file they are the frame counting ccd pixel and the 0 pixel next to it
+         for(;(s<2)&&(s<nsamples);s++)
+         {
+            if((framecounterpixels)&&(steps & FLAGPIXELS))
+            {
+               image[s]=0;
+               mask[s]|=Specim::Badpixel;
+            }
+            ApplyToPixel(s,s,image,mask,steps & ~FLAGPIXELS,overflowed);
+         }
+      }
+
+      for(;s+8<=nsamples;s+=8)
+      {
+         const unsigned long p=row+s;
+         __m256 value=_mm256_loadu_ps(image+p);
+         int over=0,under=0,smear=0;
+
+         if(steps & FLAGPIXELS)
+         {
+            __m256 isover=_mm256_cmp_ps(value,rawmaxv,_CMP_EQ_OQ);
+            over=_mm256_movemask_ps(isover);
+            if(flagsmearaffected)
+            {
+               for(unsigned int k=0;k<8;k++)
+               {
+                  if(overflowed[s+k])
+                     smear|=(1<<k);
+                  if(over & (1<<k))
+                     overflowed[s+k]=1;
+               }
+            }
+            if(avdark!=NULL)
+            {
+               __m256 isunder=_mm256_andnot_ps(isover,_mm256_cmp_ps(value,_mm256_loadu_ps(avdark+p),_CMP_LE_OQ));
+               under|=_mm256_movemask_ps(isunder);
+               value=_mm256_blendv_ps(value,zero,isunder);
+            }
+         }
+
+         if(steps & REMOVEDARK)
+         {
+            const __m256 dark=_mm256_loadu_ps(avdark+p);
+            __m256 todo=_mm256_and_ps(_mm256_cmp_ps(value,zero,_CMP_NEQ_UQ),_mm256_cmp_ps(value,calmaxv,_CMP_LT_OQ));
+            int check=_mm256_movemask_ps(_mm256_and_ps(todo,_mm256_cmp_ps(dark,rawmaxv,_CMP_GE_OQ)));
+            if(check)
+            {
+               for(unsigned int k=0;k<8;k++)
+                  if(check & (1<<k))
+                     CheckDarkValue(p+k);
+            }
+            __m256 diff=_mm256_sub_ps(value,dark);
+            __m256 isunder=_mm256_and_ps(todo,_mm256_cmp_ps(diff,zero,_CMP_LE_OQ));
+            under|=_mm256_movemask_ps(isunder);
+            value=_mm256_blendv_ps(value,diff,todo);
+            value=_mm256_blendv_ps(value,zero,isunder);
+         }
+
+         if(steps & APPLYGAINS)
+         {
+            __m256 todo=_mm256_and_ps(_mm256_cmp_ps(value,zero,_CMP_NEQ_UQ),_mm256_cmp_ps(value,calmaxv,_CMP_NEQ_UQ));
+            __m256 scaled=_mm256_mul_ps(_mm256_mul_ps(value,_mm256_loadu_ps(gains+p)),radmultv);
+            __m256 isover=_mm256_and_ps(todo,_mm256_cmp_ps(scaled,calmaxv,_CMP_GE_OQ));
+            over|=_mm256_movemask_ps(isover);
+            value=_mm256_blendv_ps(value,scaled,todo);
+            value=_mm256_blendv_ps(value,calmaxv,isover);
+         }
+
+         _mm256_storeu_ps(image+p,value);
+
+         if(over|under|smear)
+         {
+            uint64_t flags=ExpandBits8(over)*Specim::OverFlow | ExpandBits8(under)*Specim::UnderFlow
+                           | ExpandBits8(smear)*Specim::SmearAffected;
+            uint64_t current=0;
+            memcpy(&current,mask+p,8);
+            current|=flags;
+            memcpy(mask+p,&current,8);
+         }
+      }
+
+      //Remaining samples
+      for(;s<nsamples;s++)
+         ApplyToPixel(row+s,s,image,mask,steps,overflowed);
+   }
+}
+
+//-------------------------------------------------------------------------
+// Single precision AVX2 version of the smear correction - 8 samples at a time
+//-------------------------------------------------------------------------
+__attribute__((target("avx2")))
+void CalibrationKernel::SmearCorrectAVX2(calfloat* const image,unsigned char* const mask,const calfloat fsc)const
+{
+   std::vector<calfloat> bandsum(nsamples,0);
+
+   const __m256 zero=_mm256_setzero_ps();
+   const __m256 fscv=_mm256_set1_ps(fsc);
+
+   for(unsigned int b=1;b<nbands;b++)
+   {
+      const unsigned long row=b*(unsigned long)nsamples;
+      unsigned int s=0;
+      for(;s+8<=nsamples;s+=8)
+      {
+         const unsigned long p=row+s;
+         __m256 sum=_mm256_add_ps(_mm256_loadu_ps(&bandsum[s]),_mm256_loadu_ps(image+p-nsamples));
+         _mm256_storeu_ps(&bandsum[s],sum);
+         __m256 value=_mm256_sub_ps(_mm256_loadu_ps(image+p),_mm256_mul_ps(fscv,sum));
+         __m256 isunder=_mm256_cmp_ps(value,zero,_CMP_LT_OQ);
+         _mm256_storeu_ps(image+p,_mm256_blendv_ps(value,zero,isunder));
+
+         int under=_mm256_movemask_ps(isunder);
+         if(under)
+         {
+            uint64_t current=0;
+            memcpy(&current,mask+p,8);
+            current|=ExpandBits8(under)*Specim::UnderFlow;
+            memcpy(mask+p,&current,8);
+         }
+      }
+
+      //Remaining samples
+      for(;s<nsamples;s++)
+      {
+         bandsum[s]=bandsum[s]+image[row-nsamples+s];
+         image[row+s]=image[row+s] - fsc*bandsum[s];
+         if(image[row+s]<0)
+         {
+            image[row+s]=0;
+            mask[row+s]|=Specim::UnderFlow;
+         }
+      }
+   }
+}
+
+#endif
+
+#else
+
+//-------------------------------------------------------------------------
+// No AVX2 support from the compiler - just use the scalar version
+//-------------------------------------------------------------------------
+void CalibrationKernel::ApplyAVX2(calfloat* const image,unsigned char* const mask,const unsigned int steps)const
+{
+   ApplyScalar(image,mask,steps);
+}
+
+void CalibrationKernel::SmearCorrectAVX2(calfloat* const image,unsigned char* const mask,const calfloat fsc)const
+{
+   SmearCorrectScalar(image,mask,fsc);
+}
+
+#endif
@@ -0,0 +1,71 @@
+//------------------------------------------------------------------------- 
+//Copyright (c) 2013 Natural Environment Research Council (NERC) UK 
+// 
+//This file is part of APL (Airborne Processing Library)
+//Licensed under the APL Open Software License version 1.0 
+// 
+//You should have received a copy of the Licence along with the APL source 
+//If not, please contact arsf-processing@pml.ac.uk 
+//-------------------------------------------------------------------------
+
+#ifndef CALIBRATIONKERNEL_H
+#define CALIBRATIONKERNEL_H
+
+#include <vector>
+#include "logger.h"
+#include "commonfunctions.h"
+#include "specimsensors.h"
+
+//-------------------------------------------------------------------------
+// Floating point type of the per pixel calibration arrays (image, average
+// dark, gains and fodis). Build with -D APL_FLOAT_CALIBRATION to calibrate
+// in single precision - this halves the memory used per line and doubles
+// the number of pixels per AVX2 instruction. See README.txt for a
+// comparison of the outputs.
+//-------------------------------------------------------------------------
+#ifdef APL_FLOAT_CALIBRATION
+   typedef float calfloat;
+#else
+   typedef double calfloat;
+#endif
+
+//-------------------------------------------------------------------------
+// Class to apply the per pixel calibration steps (over/underflow flagging,
+// dark frame subtraction and gains) to a line of data in a single pass.
+// Uses AVX2 where the cpu supports it, else a scalar loop - both give
+// identical results.
+//-------------------------------------------------------------------------
+class CalibrationKernel
+{
+public:
+   CalibrationKernel();
+
+   //Steps that can be applied - combine with bitwise or
+   enum Step {FLAGPIXELS=1,REMOVEDARK=2,APPLYGAINS=4};
+
+   void Apply(calfloat* const image,unsigned char* const mask,const unsigned int steps)const;
+   //Remove the frame smear (fsc * sum of spectrally previous bands) from each band
+   void SmearCorrect(calfloat* const image,unsigned char* const mask,const calfloat fsc)const;
+   static bool UseAVX2();
+
+   //Values for the subsensor the line is from - set by caller
+   unsigned int nbands,nsamples;
+   calfloat rawmax,calibratedmax;
+   calfloat radmultiplier; //radiance scalar / integration time
+   const calfloat* avdark; //NULL if dark frames not initialised
+   const calfloat* gains; //NULL if gains not initialised
+   const unsigned char* bandsteps; //steps to apply to each band - NULL to apply to all bands
+   bool framecounterpixels; //true if band 0 samples 0,1 are the frame counter and should be zeroed
+   bool flagsmearaffected; //true to flag the pixels below an overflow as smear affected (eagle)
+
+private:
+   void ApplyScalar(calfloat* const image,unsigned char* const mask,const unsigned int linesteps)const;
+   void ApplyAVX2(calfloat* const image,unsigned char* const mask,const unsigned int linesteps)const;
+   void ApplyToPixel(const unsigned long p,const unsigned int sample,calfloat* const image,unsigned char* const mask,
+                     const unsigned int steps,std::vector<unsigned char>& overflowed)const;
+   void CheckDarkValue(const unsigned long p)const;
+   void SmearCorrectScalar(calfloat* const image,unsigned char* const mask,const calfloat fsc)const;
+   void SmearCorrectAVX2(calfloat* const image,unsigned char* const mask,const calfloat fsc)const;
+};
+
+#endif
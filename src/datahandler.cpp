@@ -8,6 +8,8 @@
 //If not, please contact arsf-processing@pml.ac.uk 
 //-------------------------------------------------------------------------
 
+#include <algorithm>
+#include <vector>
 #include "datahandler.h"
 
 #ifdef DEBUGDATAHANDLER
@@ -37,9 +39,16 @@ NavDataLine::NavDataLine()
 //-------------------------------------------------------------------------
 NavDataCollection::NavDataCollection(unsigned long length)
 {
-   navarray=NULL;
    size_of_array=length;
-   navarray=new NavDataLine[size_of_array];
+   //Zero initialise the channels as the NavDataLine constructor did
+   time=new double[size_of_array]();
+   lat=new double[size_of_array]();
+   lon=new double[size_of_array]();
+   hei=new double[size_of_array]();
+   roll=new double[size_of_array]();
+   pitch=new double[size_of_array]();
+   heading=new double[size_of_array]();
+   quality=new char[size_of_array]();
 }
 
 //-------------------------------------------------------------------------
@@ -47,8 +56,60 @@ NavDataCollection::NavDataCollection(unsigned long length)
 //-------------------------------------------------------------------------
 NavDataCollection::~NavDataCollection()
 {
-   if(navarray!=NULL)
-      delete[] navarray;
+   delete[] time;
+   delete[] lat;
+   delete[] lon;
+   delete[] hei;
+   delete[] roll;
+   delete[] pitch;
+   delete[] heading;
+   delete[] quality;
+}
+
+//-------------------------------------------------------------------------
+// Return a copy of the epoch l as a NavDataLine
+//-------------------------------------------------------------------------
+NavDataLine NavDataCollection::GetLine(const unsigned long l)
+{
+   if(l>=size_of_array)
+      throw "Request for navigation epoch outside of the NavDataCollection in GetLine(): "+ToString(l);
+
+   NavDataLine line;
+   line.time=time[l];
+   line.lat=lat[l];
+   line.lon=lon[l];
+   line.hei=hei[l];
+   line.roll=roll[l];
+   line.pitch=pitch[l];
+   line.heading=heading[l];
+   line.quality=quality[l];
+   return line;
+}
+
+//-------------------------------------------------------------------------
+// Return the array holding the values of channel key for all epochs
+//-------------------------------------------------------------------------
+double* NavDataCollection::GetChannel(const NavDataItem key)
+{
+   switch(key)
+   {
+   case LAT:
+      return lat;
+   case LON:
+      return lon;
+   case TIME:
+      return time;
+   case ROLL:
+      return roll;
+   case PITCH:
+      return pitch;
+   case HEADING:
+      return heading;
+   case HEI:
+      return hei;
+   default:
+      throw "Unknown NavDataItem in GetChannel()";
+   }
 }
 
 //-------------------------------------------------------------------------
@@ -57,16 +118,16 @@ NavDataCollection::~NavDataCollection()
 void NavDataCollection::SetValues(const unsigned long item,const NavDataLine* line)
 {
    //Check that the item can be set
-   if((item<size_of_array)&&(navarray!=NULL))
+   if(item<size_of_array)
    {
-      navarray[item].lat=line->lat;
-      navarray[item].lon=line->lon;
-      navarray[item].time=line->time;
-      navarray[item].roll=line->roll;
-      navarray[item].pitch=line->pitch;
-      navarray[item].heading=line->heading;
-      navarray[item].hei=line->hei;
-      navarray[item].quality=line->quality;
+      lat[item]=line->lat;
+      lon[item]=line->lon;
+      time[item]=line->time;
+      roll[item]=line->roll;
+      pitch[item]=line->pitch;
+      heading[item]=line->heading;
+      hei[item]=line->hei;
+      quality[item]=line->quality;
    }
 }
 
@@ -76,37 +137,12 @@ void NavDataCollection::SetValues(const unsigned long item,const NavDataLine* li
 void NavDataCollection::SetValues(const unsigned long item,const NavDataItem key,const double value)
 {
    //Check that the item can be set
-   if((item<size_of_array)&&(navarray!=NULL))
+   if(item<size_of_array)
    {
-      switch(key)
-      {
-      case LAT:
-         navarray[item].lat=value;
-         break;
-      case LON:
-         navarray[item].lon=value;
-         break;
-      case TIME:
-         navarray[item].time=value;
-         break;
-      case ROLL:
-         navarray[item].roll=value;
-         break;
-      case PITCH:
-         navarray[item].pitch=value;
-         break;
-      case HEADING:
-         navarray[item].heading=value;
-         break;
-      case HEI:
-         navarray[item].hei=value;
-         break;
-      case QUALITY:
-         navarray[item].quality=static_cast<char>(value);
-         break;
-      default:
-         throw "Unknown NavDataItem in SetValues()";
-      }
+      if(key==QUALITY)
+         quality[item]=static_cast<char>(value);
+      else
+         GetChannel(key)[item]=value;
    }
 }
 
@@ -116,27 +152,11 @@ void NavDataCollection::SetValues(const unsigned long item,const NavDataItem key
 const double NavDataCollection::GetValue(const unsigned long item,const NavDataItem key)
 {
    //Check that the item can be got
-   if((item<size_of_array)&&(navarray!=NULL))
+   if(item<size_of_array)
    {
-      switch(key)
-      {
-      case LAT:
-         return navarray[item].lat;
-      case LON:
-         return navarray[item].lon;
-      case TIME:
-         return navarray[item].time;
-      case ROLL:
-         return navarray[item].roll;
-      case PITCH:
-         return navarray[item].pitch;
-      case HEADING:
-         return navarray[item].heading;
-      case HEI:
-         return navarray[item].hei;
-      default:
+      if(key==QUALITY)
          throw "Unknown NavDataItem in GetValue()";
-      }
+      return GetChannel(key)[item];
    }
    return 0;
 }
@@ -147,27 +167,11 @@ const double NavDataCollection::GetValue(const unsigned long item,const NavDataI
 double* NavDataCollection::GetReferenceValue(const unsigned long item,const NavDataItem key)
 {
    //Check that the item can be got
-   if((item<size_of_array)&&(navarray!=NULL))
+   if(item<size_of_array)
    {
-      switch(key)
-      {
-      case LAT:
-         return &navarray[item].lat;
-      case LON:
-         return &navarray[item].lon;
-      case TIME:
-         return &navarray[item].time;
-      case ROLL:
-         return &navarray[item].roll;
-      case PITCH:
-         return &navarray[item].pitch;
-      case HEADING:
-         return &navarray[item].heading;
-      case HEI:
-         return &navarray[item].hei;
-      default:
+      if(key==QUALITY)
          throw "Unknown NavDataItem in GetValue()";
-      }
+      return GetChannel(key)+item;
    }
    return NULL;
 }
@@ -185,43 +189,43 @@ void NavDataCollection::CheckPlausibility()
    bool badt=false,badr=false,badp=false,badhead=false,badlo=false,badla=false,badhei=false;
 
    //Assume first flag is good since we have no previous point to test against
-   navarray[0].quality=0;
+   quality[0]=0;
    for(unsigned int epoch=1;epoch<size_of_array;epoch++)
    {
       //Set flag to zero before running
-      navarray[epoch].quality=0;
-      if ((navarray[epoch].time - navarray[epoch-1].time) > plausibleTimeDifference)
+      quality[epoch]=0;
+      if ((time[epoch] - time[epoch-1]) > plausibleTimeDifference)
       {
          if(badt==false)
          {
             badt=true;
             Logger::Log("Time difference between consecutive epochs larger than acceptable threshold. Further warnings of this type supressed.");
             DEBUGPRINT("Time difference between consecutive epochs larger than acceptable threshold. Expected < "
-                     <<plausibleTimeDifference<<", got  "<<(navarray[epoch].time - navarray[epoch-1].time)
+                     <<plausibleTimeDifference<<", got  "<<(time[epoch] - time[epoch-1])
                      <<" for epoch "<<epoch)
          }
-         navarray[epoch].quality+=NavDataLine::BADTIME;
+         quality[epoch]+=NavDataLine::BADTIME;
       }
 
       //Throw an exception if time goes backwards - this is not allowed
-      if((navarray[epoch].time - navarray[epoch-1].time) < 0)
+      if((time[epoch] - time[epoch-1]) < 0)
       {
          if(GLOBAL_FORCE == false)
          {
             throw "Time goes backwards in navigation file at epoch "+ToString(epoch)+"\nPrevious time: "
-                  +ToString(navarray[epoch-1].time)+" Current time: "+ToString(navarray[epoch].time) +
+                  +ToString(time[epoch-1])+" Current time: "+ToString(time[epoch]) +
                   "\nIf this occurs in a .nav file then it is probably OK to continue if you are not outputting the real-time navigation."
                   "\nTo try and force APL to continue use the -force command line option.";
          }
          else
          {
             Logger::Warning("Time goes backwards in navigation file at epoch "+ToString(epoch)+"\nPrevious time: "
-                  +ToString(navarray[epoch-1].time)+" Current time: "+ToString(navarray[epoch].time) +
+                  +ToString(time[epoch-1])+" Current time: "+ToString(time[epoch]) +
                   "\nThis is being ignored as user has specified the -force command line option ...");            
          }
       }
       
-      if(fabs(navarray[epoch].hei - navarray[epoch-1].hei) > plausibleHeightDifference)
+      if(fabs(hei[epoch] - hei[epoch-1]) > plausibleHeightDifference)
       {
 
          if(badhei==false)
@@ -229,83 +233,83 @@ void NavDataCollection::CheckPlausibility()
             badhei=true;
             Logger::Log("Height difference between consecutive epochs larger than acceptable threshold. Further warnings of this type supressed.");
             DEBUGPRINT("Height difference between consecutive epochs larger than acceptable threshold. Expected < "
-                     <<(plausibleHeightDifference)<<", got  "<<(navarray[epoch].hei - navarray[epoch-1].hei)
+                     <<(plausibleHeightDifference)<<", got  "<<(hei[epoch] - hei[epoch-1])
                      <<" for epoch "<<epoch);
-            DEBUGPRINT("Epoch: "<<epoch-1<<" Time: "<<navarray[epoch-1].time<<" Height: "<<navarray[epoch-1].hei
-            <<" Lat: "<<navarray[epoch-1].lat<<" Lon: "<<navarray[epoch-1].lon<<" Roll: "<<navarray[epoch-1].roll
-            <<" Pitch: "<<navarray[epoch-1].pitch<<" Heading: "<<navarray[epoch-1].heading);
-            DEBUGPRINT("Epoch: "<<epoch<<" Time: "<<navarray[epoch].time<<" Height: "<<navarray[epoch].hei
-            <<" Lat: "<<navarray[epoch].lat<<" Lon: "<<navarray[epoch].lon<<" Roll: "<<navarray[epoch].roll
-            <<" Pitch: "<<navarray[epoch].pitch<<" Heading: "<<navarray[epoch].heading);
+            DEBUGPRINT("Epoch: "<<epoch-1<<" Time: "<<time[epoch-1]<<" Height: "<<hei[epoch-1]
+            <<" Lat: "<<lat[epoch-1]<<" Lon: "<<lon[epoch-1]<<" Roll: "<<roll[epoch-1]
+            <<" Pitch: "<<pitch[epoch-1]<<" Heading: "<<heading[epoch-1]);
+            DEBUGPRINT("Epoch: "<<epoch<<" Time: "<<time[epoch]<<" Height: "<<hei[epoch]
+            <<" Lat: "<<lat[epoch]<<" Lon: "<<lon[epoch]<<" Roll: "<<roll[epoch]
+            <<" Pitch: "<<pitch[epoch]<<" Heading: "<<heading[epoch]);
          }
-         navarray[epoch].quality+=NavDataLine::BADHEI;
+         quality[epoch]+=NavDataLine::BADHEI;
       }
       
-      if(fabs(navarray[epoch].lat - navarray[epoch-1].lat)> plausibleLatDifference)
+      if(fabs(lat[epoch] - lat[epoch-1])> plausibleLatDifference)
       {
          if(badla==false)
          {
             badla=true;
             Logger::Log("Latitude difference between consecutive epochs larger than acceptable threshold. Further warnings of this type supressed.");
             DEBUGPRINT("Latitude difference between consecutive epochs larger than acceptable threshold. Expected < "
-                     <<(plausibleLatDifference)<<", got  "<<(navarray[epoch].lat - navarray[epoch-1].lat)
+                     <<(plausibleLatDifference)<<", got  "<<(lat[epoch] - lat[epoch-1])
                      <<" for epoch "<<epoch);
          }
-         navarray[epoch].quality+=NavDataLine::BADLAT;
+         quality[epoch]+=NavDataLine::BADLAT;
       }
 
-      if(fabs(navarray[epoch].lon - navarray[epoch-1].lon) > plausibleLonDifference)
+      if(fabs(lon[epoch] - lon[epoch-1]) > plausibleLonDifference)
       {
          if(badlo==false)
          {
             badlo=true;
             Logger::Log("Longitude difference between consecutive epochs larger than acceptable threshold. Further warnings of this type supressed.");
             DEBUGPRINT("Longitude difference between consecutive epochs larger than acceptable threshold. Expected < "
-                     <<(plausibleLonDifference)<<", got  "<<(navarray[epoch].lon - navarray[epoch-1].lon)
+                     <<(plausibleLonDifference)<<", got  "<<(lon[epoch] - lon[epoch-1])
                      <<" for epoch "<<epoch);
          }
-         navarray[epoch].quality+=NavDataLine::BADLON;
+         quality[epoch]+=NavDataLine::BADLON;
       }
 
-      if(fabs(navarray[epoch].roll - navarray[epoch-1].roll) > plausibleRollDifference)
+      if(fabs(roll[epoch] - roll[epoch-1]) > plausibleRollDifference)
       {
          if(badr==false)
          {
             badr=true;
             Logger::Log("Roll difference between consecutive epochs larger than acceptable threshold. Further warnings of this type supressed.");
             DEBUGPRINT("Roll difference between consecutive epochs larger than acceptable threshold. Expected < "
-                     <<(plausibleRollDifference)<<", got  "<<(navarray[epoch].roll - navarray[epoch-1].roll)
+                     <<(plausibleRollDifference)<<", got  "<<(roll[epoch] - roll[epoch-1])
                      <<" for epoch "<<epoch);
          }
-         navarray[epoch].quality+=NavDataLine::BADROLL;
+         quality[epoch]+=NavDataLine::BADROLL;
       }
 
-      if(fabs(navarray[epoch].pitch - navarray[epoch-1].pitch) > plausiblePitchDifference)
+      if(fabs(pitch[epoch] - pitch[epoch-1]) > plausiblePitchDifference)
       {
          if(badp==false)
          {
             badp=true;
             Logger::Log("Pitch difference between consecutive epochs larger than acceptable threshold. Further warnings of this type supressed.");
             DEBUGPRINT("Pitch difference between consecutive epochs larger than acceptable threshold. Expected < "
-                     <<(plausiblePitchDifference)<<", got  "<<(navarray[epoch].pitch - navarray[epoch-1].pitch)
+                     <<(plausiblePitchDifference)<<", got  "<<(pitch[epoch] - pitch[epoch-1])
                      <<" for epoch "<<epoch);
          }
-         navarray[epoch].quality+=NavDataLine::BADPITCH;
+         quality[epoch]+=NavDataLine::BADPITCH;
       }
 
       //Two tests for heading since it wraps around 0->360 degrees
-      if((fabs(navarray[epoch].heading - navarray[epoch-1].heading) > plausibleHeadingDifference)
-      &&( (fabs(navarray[epoch].heading - navarray[epoch-1].heading))-360 > plausibleHeadingDifference ))
+      if((fabs(heading[epoch] - heading[epoch-1]) > plausibleHeadingDifference)
+      &&( (fabs(heading[epoch] - heading[epoch-1]))-360 > plausibleHeadingDifference ))
       {
          if(badhead==false)
          {
             badhead=true;
             Logger::Log("Heading difference between consecutive epochs larger than acceptable threshold. Further warnings of this type suppressed.");
             DEBUGPRINT("Heading difference between consecutive epochs larger than acceptable threshold. Expected < "
-                     <<(plausibleHeadingDifference)<<", got  "<<(navarray[epoch].heading - navarray[epoch-1].heading)
+                     <<(plausibleHeadingDifference)<<", got  "<<(heading[epoch] - heading[epoch-1])
                      <<" for epoch "<<epoch);
          }
-         navarray[epoch].quality+=NavDataLine::BADHEADING;
+         quality[epoch]+=NavDataLine::BADHEADING;
       }
    }
 }
@@ -317,6 +321,9 @@ void NavDataCollection::CheckPlausibility()
 DataHandler::DataHandler()
 {
    navcollection=NULL;
+   usetimewindow=false;
+   windowstart=windowend=0;
+   windowpadrecords=0;
 }
 
 //-------------------------------------------------------------------------
@@ -325,6 +332,9 @@ DataHandler::DataHandler()
 DataHandler::DataHandler(unsigned long n)
 {
    navcollection=new NavDataCollection(n);
+   usetimewindow=false;
+   windowstart=windowend=0;
+   windowpadrecords=0;
 }
 
 DataHandler::~DataHandler()
@@ -335,55 +345,129 @@ DataHandler::~DataHandler()
 
 
 //-------------------------------------------------------------------------
-// Function to smooth input data to remove high frequency jitters
+// Function to set the time window of records to load from the file
 //-------------------------------------------------------------------------
-void DataHandler::Smooth(void (*f)(const unsigned long ,DataHandler* ,NavDataLine* ,const int),const unsigned int smoothkernelsize)
+void DataHandler::SetTimeWindow(const double start,const double end,const unsigned long padrecords)
 {
-   //DEBUGPRINT("Entering DataHandler::Smooth(x)...")
-   NavDataLine* smoothednav=new NavDataLine[GetNumEntries()];
-   unsigned int morethanhalf=(smoothkernelsize+1)/2.0;
-   //FIXME fix the morethanhalf below so that everything is smoothed - this is tricky
-   //The morethanhalf come from the length of the kernel used in the smoothing function
-   for(unsigned long i=morethanhalf;i<GetNumEntries()-morethanhalf;i++)
+   if(end < start)
+      throw "End of navigation time window is before the start: "+ToString(start)+" "+ToString(end);
+   usetimewindow=true;
+   windowstart=start;
+   windowend=end;
+   windowpadrecords=padrecords;
+}
+
+//-------------------------------------------------------------------------
+// Function to binary search the (time ordered) records of the file for the
+// first and last records to load to cover the time window. The record
+// before the start and after the end are included plus the padding records.
+// If the file does not appear to be time ordered then all are loaded.
+//-------------------------------------------------------------------------
+void DataHandler::FindWindowRecords(const unsigned long nrecords,unsigned long& first,unsigned long& last)
+{
+   first=0;
+   last=nrecords-1;
+   if(nrecords<2)
+      return;
+
+   if(RecordTime(last) < RecordTime(first))
    {
-      Smooth(f,i,&smoothednav[i],smoothkernelsize);
+      Logger::Warning("Navigation file times are not increasing - will load the whole file rather than the time window.");
+      return;
    }
 
-   //For the elements that couldn't be smoothed we shall just insert the original data since zero-ing causes extra problems
-   //Insert from the front and back on the same loop
-   for(unsigned long i=0,j=GetNumEntries()-1;i<morethanhalf;i++,j--)
+   //First record with time >= windowstart
+   unsigned long low=0,high=nrecords;
+   while(low<high)
    {
-      smoothednav[i].time=navcollection->GetValue(i,NavDataCollection::TIME);
-      smoothednav[i].lat=navcollection->GetValue(i,NavDataCollection::LAT);
-      smoothednav[i].lon=navcollection->GetValue(i,NavDataCollection::LON);
-      smoothednav[i].hei=navcollection->GetValue(i,NavDataCollection::HEI);
-      smoothednav[i].roll=navcollection->GetValue(i,NavDataCollection::ROLL);
-      smoothednav[i].pitch=navcollection->GetValue(i,NavDataCollection::PITCH);
-      smoothednav[i].heading=navcollection->GetValue(i,NavDataCollection::HEADING);
-
-      smoothednav[j].time=navcollection->GetValue(j,NavDataCollection::TIME);
-      smoothednav[j].lat=navcollection->GetValue(j,NavDataCollection::LAT);
-      smoothednav[j].lon=navcollection->GetValue(j,NavDataCollection::LON);
-      smoothednav[j].hei=navcollection->GetValue(j,NavDataCollection::HEI);
-      smoothednav[j].roll=navcollection->GetValue(j,NavDataCollection::ROLL);
-      smoothednav[j].pitch=navcollection->GetValue(j,NavDataCollection::PITCH);
-      smoothednav[j].heading=navcollection->GetValue(j,NavDataCollection::HEADING);
+      const unsigned long mid=low+(high-low)/2;
+      if(RecordTime(mid) < windowstart)
+         low=mid+1;
+      else
+         high=mid;
    }
-   
-   //Now copy the smoothed navigation in place of the original (do a hard copy)
-   for(unsigned int i=0;i<GetNumEntries();i++)
+   //Include the record before it and the padding
+   first=(low > windowpadrecords+1) ? low-windowpadrecords-1 : 0;
+
+   //First record with time > windowend
+   high=nrecords;
+   while(low<high)
    {
-      navcollection->SetValues(i,&smoothednav[i]);
+      const unsigned long mid=low+(high-low)/2;
+      if(RecordTime(mid) <= windowend)
+         low=mid+1;
+      else
+         high=mid;
    }
-   delete[] smoothednav;
+   //This is the record after the end - add the padding
+   last=std::min(low+windowpadrecords,nrecords-1);
+
+   Logger::Log("Will load navigation records "+ToString(first)+" to "+ToString(last)+" of "+ToString(nrecords)
+               +" to cover times "+ToString(windowstart)+" to "+ToString(windowend));
 }
 
 //-------------------------------------------------------------------------
-// Function to apply smoothing function to data element 
+// Function to smooth input data to remove high frequency jitters. f is 
+// applied to each channel (except time) in turn
 //-------------------------------------------------------------------------
-void DataHandler::Smooth(void (*f)(const unsigned long ,DataHandler* ,NavDataLine* ,const int),const int element, NavDataLine* store,const unsigned int smoothkernelsize)
+void DataHandler::Smooth(void (*f)(const double* const,double* const,const unsigned long,const int),const unsigned int smoothkernelsize)
 {
-   //FIXME change the kernel size to me a parameter
-   f(element,this,store,smoothkernelsize);
+   const unsigned long nentries=GetNumEntries();
+   unsigned int morethanhalf=(smoothkernelsize+1)/2.0;
+   //FIXME fix the morethanhalf below so that everything is smoothed - this is tricky
+   //The morethanhalf come from the length of the kernel used in the smoothing function
+   if(nentries <= 2*morethanhalf)
+   {
+      Logger::Warning("Not enough navigation records to apply smoothing of kernel size "+ToString(smoothkernelsize));
+      return;
+   }
+
+   const NavDataCollection::NavDataItem channels[]={NavDataCollection::LAT,NavDataCollection::LON,NavDataCollection::HEI,
+                                                   NavDataCollection::ROLL,NavDataCollection::PITCH,NavDataCollection::HEADING};
+   const unsigned int nchannels=sizeof(channels)/sizeof(channels[0]);
+   std::vector<double> smoothed(nentries);
+   std::vector<double> unwrapped;
+
+   for(unsigned int c=0;c<nchannels;c++)
+   {
+      double* data=navcollection->GetChannel(channels[c]);
+      const double* tosmooth=data;
+      if(channels[c]==NavDataCollection::HEADING)
+      {
+         //Heading needs to be made continuous across 0/360 before smoothing - consecutive 
+         //records can not really turn by more than 180 degrees so take this to be a wrap
+         unwrapped.resize(nentries);
+         double offset=0;
+         unwrapped[0]=data[0];
+         for(unsigned long i=1;i<nentries;i++)
+         {
+            if(data[i]-data[i-1] > 180)
+               offset-=360;
+            else if(data[i]-data[i-1] < -180)
+               offset+=360;
+            unwrapped[i]=data[i]+offset;
+         }
+         tosmooth=&unwrapped[0];
+      }
+
+      f(tosmooth,&smoothed[0],nentries,smoothkernelsize);
+
+      //Copy the smoothed data in place of the original. For the elements that couldn't be smoothed
+      //we shall just keep the original data since zero-ing causes extra problems
+      for(unsigned long i=morethanhalf;i<nentries-morethanhalf;i++)
+      {
+         data[i]=smoothed[i];
+      }
+
+      if(channels[c]==NavDataCollection::HEADING)
+      {
+         //Put the heading back into the range 0 - 360
+         for(unsigned long i=morethanhalf;i<nentries-morethanhalf;i++)
+         {
+            if((data[i] < 0)||(data[i] >= 360))
+               data[i]-=360*floor(data[i]/360);
+         }
+      }
+   }
 }
 
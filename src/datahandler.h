@@ -15,6 +15,7 @@
 #include <string>
 #include <sstream>
 #include <iostream>
+#include <fstream>
 #include <cmath>
 #include <typeinfo>
 #include "logger.h"
@@ -46,7 +47,10 @@ public:
 
 
 //-------------------------------------------------------------------------
-// NavDataCollection class - an array of NavDataLines
+// NavDataCollection class - a collection of epochs of navigation data.
+// The data are stored as an array per channel (time, lat, lon etc) rather
+// than an array of NavDataLines so that processing a single channel streams
+// through contiguous memory. GetLine returns a copy of an epoch.
 //-------------------------------------------------------------------------
 class NavDataCollection
 {
@@ -54,26 +58,29 @@ public:
    NavDataCollection(const unsigned long len);
    ~NavDataCollection();
    const unsigned long SizeOfArray(){return size_of_array;}
-   NavDataLine* GetLine(const unsigned long l)
-   {
-      if((l>=0)&&(l<size_of_array))
-         return &navarray[l];
-      else
-         return NULL;
-   };
+   NavDataLine GetLine(const unsigned long l);
    enum NavDataItem {LAT,LON,TIME,ROLL,PITCH,HEADING,HEI,QUALITY};
    void SetValues(const unsigned long item,const NavDataLine* line);
    void SetValues(const unsigned long item,const NavDataItem key,const double value);
    const double GetValue(const unsigned long item,const NavDataItem key);
-   const char GetFlag(const unsigned long item){return navarray[item].quality;}
+   const char GetFlag(const unsigned long item){return quality[item];}
    double* GetReferenceValue(const unsigned long item,const NavDataItem key);
-   char* GetFlagReference(const unsigned long item){return &navarray[item].quality;}
+   char* GetFlagReference(const unsigned long item){return &quality[item];}
+   //Return the array of values of the channel for all epochs
+   double* GetChannel(const NavDataItem key);
    //Function to check the nav data looks plausible
    void CheckPlausibility();
 
 private:   
    unsigned long size_of_array;
-   NavDataLine* navarray;
+   double* time;
+   double* lat;
+   double* lon;
+   double* hei;
+   double* roll;
+   double* pitch;
+   double* heading;
+   char* quality;
 
 };
 
@@ -90,8 +97,10 @@ public:
    //Function that reads in the navigation file 
    virtual void Reader()=0;
 
-   //Function that returns a ptr to NavDataLine object relating to data from line l.
-   NavDataLine* GetLine(const unsigned long l){return navcollection->GetLine(l);}
+   //Function that returns a copy of the NavDataLine relating to data from line l.
+   NavDataLine GetLine(const unsigned long l){return navcollection->GetLine(l);}
+   //Function that returns the array of values of one channel for all lines
+   const double* GetChannel(const NavDataCollection::NavDataItem key){return navcollection->GetChannel(key);}
 
    //Return the numentries value
    unsigned long GetNumEntries(){return navcollection->SizeOfArray();}
@@ -102,9 +111,12 @@ public:
    //Get the frame the delay relates to
    virtual int GetFrame(const unsigned long i){return 0;}
    //Function to smooth the data (once it has been read in)
-   void Smooth(void (*f)(const unsigned long ,DataHandler* ,NavDataLine* ,const int),const unsigned int smoothkernelsize);
-   void Smooth(void (*f)(const unsigned long ,DataHandler* ,NavDataLine* ,const int),const int element, NavDataLine* store,const unsigned int smoothkernelsize);
+   //f smooths a single channel of the data
+   void Smooth(void (*f)(const double* const,double* const,const unsigned long,const int),const unsigned int smoothkernelsize);
    void CheckPlausibility(){navcollection->CheckPlausibility();}
+   //Only load the records covering the times start to end, plus padrecords either side.
+   //Used by readers of time ordered files (SBET/SOL), others load the whole file
+   void SetTimeWindow(const double start,const double end,const unsigned long padrecords);
 
    virtual std::string GetInformation()
    {
@@ -118,6 +130,14 @@ protected:
    std::string filename;
    NavDataCollection* navcollection;
 
+   bool usetimewindow;
+   double windowstart,windowend;
+   unsigned long windowpadrecords;
+   //Find the first and last records of the file to load for the time window
+   void FindWindowRecords(const unsigned long nrecords,unsigned long& first,unsigned long& last);
+   //Return the time of the given record of the file - needed for FindWindowRecords
+   virtual double RecordTime(const unsigned long record){throw "RecordTime() is not implemented for this navigation file type.";}
+
 };
 
 
@@ -23,6 +23,7 @@
 #include "leverbore.h"
 #include "transformations.h"
 #include "geodesics.h"
+#include "os_dependant.h"
 
 #include <string>
 #include <cerrno>
@@ -40,6 +41,11 @@ enum vvmethods {NONE,SPLIT, COMBINED};
 //-------------------------------------------------------------------------
 const int BADDATAVALUE=-9999;
 
+//-------------------------------------------------------------------------
+// Number of bands in the extra atmospheric correction parameters file
+//-------------------------------------------------------------------------
+const int NBANDSATMOSFILE=5;
+
 //-------------------------------------------------------------------------
 // Maximum allowed viewvector angle (degrees) - all others above this will be given 
 // the bad data value and not geocorrected
@@ -54,7 +60,7 @@ const std::string DESCRIPTION="Geocorrection Software";
 //----------------------------------------------------------------
 //Number of options that can be on command line
 //----------------------------------------------------------------
-const int number_of_possible_options = 13;
+const int number_of_possible_options = 15;
 
 //----------------------------------------------------------------
 //Option names that can be on command line
@@ -72,6 +78,8 @@ const std::string availableopts[number_of_possible_options]={
 "-lev1file",
 "-atmosfile",
 "-maxvvangle",
+"-threads",
+"-stats",
 "-help"
 }; 
 
@@ -91,6 +99,8 @@ const std::string optsdescription[number_of_possible_options]={
 "Level 1 data filename - uses this to bin and trim view vector file to fit level 1 data set",
 "Filename to output extra parameters to which are useful for atmospheric correction. These are: view azimuth and zenith, dem slope and dem aspect at intersect dem cell.",
 "Maximum allowed view vector look angle in degrees. Sometimes if mapping on a tight bank of the aircraft view vectors can reach above the horizon. To prevent this cap the viewvectors to this maximum value. Default is "+ToString(defaultmaxallowedvvangle),
+"Number of threads to geolocate the scan lines on (default 1).",
+"Output per band statistics (valid/ignored counts, minimum, maximum, mean and standard deviation) of the IGM positions to the hdr file. Follow with 'sidecar' to write them to a separate <igmfile>.stats text file instead. Default is no statistics.",
 "Display this help"
 }; 
 
@@ -98,9 +108,8 @@ const std::string optsdescription[number_of_possible_options]={
 // Function definitions
 //----------------------------------------------------------------
 
-//Delete Arrays or Objects if they have been created, to free up memory
-void TidyArrays(double* Plat,double* Plon,double* Pheight,double* Px,double* Py,double* Pz,double* hdist);
-void TidyObjects(CommandLine* cl, Boresight* b,ViewVectors* v,NavBaseClass* n,ViewVectors* v2,Ellipsoid* e, DEM* d,BILWriter* bl);
+//Delete Objects if they have been created, to free up memory
+void TidyObjects(CommandLine* cl, Boresight* b,ViewVectors* v,NavBaseClass* n,Ellipsoid* e, DEM* d,BILWriter* bl);
 
 //For a scan line gives the distance along view vectors to ellipsoid intersection
 void GetDistanceToEllipsoid(const double X, const double Y, const double Z, const double height, CartesianVector* ECEF_vector,Ellipsoid* const ellipsoid,
@@ -128,10 +137,126 @@ void ShuffleSeed(double* const seedlat,double* const seedlon, DEM* dem);
 //Function to set the dem aoi for reading
 bool SetDEMAreaToReadIn(NavBaseClass* nav, ViewVectors* vv, DEM* dem,Ellipsoid* ellipsoid,bool quiet);
 
+
+//-------------------------------------------------------------------------
+// Settings and data that are the same for every scan being geolocated.
+// These are only read from whilst the scans are geolocated.
+//-------------------------------------------------------------------------
+struct GeolocationSettings
+{
+   NavBaseClass* navigation;
+   ViewVectors* viewvectors; //with the boresight applied
+   Ellipsoid* ellipsoid;
+   DEM* dem; //NULL to map to the ellipsoid
+   vvmethods vvmethod;
+   float maxallowedvvangle; //in radians
+   double height_offset;
+   bool atmosparameters; //true to calculate the extra parameters for atmospheric correction
+};
+
+//-------------------------------------------------------------------------
+// The geolocated pixel positions of one scan (lon/lat in degrees) and the
+// extra atmospheric correction parameters if requested
+//-------------------------------------------------------------------------
+class ScanPositions
+{
+public:
+   ScanPositions(const unsigned int npixels,const bool atmosparameters);
+
+   unsigned int scan;
+   std::vector<double> Plon,Plat,Pheight;
+   std::vector<double> atmosout; //empty if not requested
+};
+
+//-------------------------------------------------------------------------
+// Scratch arrays used whilst geolocating a scan - one set per thread
+//-------------------------------------------------------------------------
+class GeolocationScratch
+{
+public:
+   GeolocationScratch(ViewVectors* const viewvectors);
+   ~GeolocationScratch();
+
+   //Copy of the view vectors to apply the attitude to for the combined method
+   ViewVectors* viewvectorsscanline;
+   //Surface intersect points in ECEF
+   std::vector<double> Px,Py,Pz;
+   //Distance from aircraft to ellipsoid surface for each scan line pixel
+   std::vector<double> hdist;
+   uint64_t numofbadpixels;
+};
+
+//-------------------------------------------------------------------------
+// Class to write out the geolocated scans, in scan order, and keep track
+// of the min/max of the positions
+//-------------------------------------------------------------------------
+class ScanWriter
+{
+public:
+   ScanWriter(BILWriter* const bilout,const std::string atmosfilename,const unsigned int totalscans);
+   void Write(ScanPositions& positions);
+
+   double minlat,minlon,maxlat,maxlon;
+
+private:
+   BILWriter* bilout;
+   std::string atmosfilename;
+   unsigned int totalscans;
+};
+
+//-------------------------------------------------------------------------
+// Class to geolocate the scans on multiple threads. Blocks of scans are 
+// queued in a ring of slots, geolocated by the worker threads and then 
+// written out in scan order by the thread that queued them. With 1 thread
+// the scans are geolocated on the calling thread.
+//-------------------------------------------------------------------------
+class ScanGeolocator : public ThreadedTask
+{
+public:
+   ScanGeolocator(const GeolocationSettings& settings,const unsigned int numthreads);
+   ~ScanGeolocator();
+
+   //Geolocate scans lowerscan to upperscan-1 and pass them to the writer
+   void Geolocate(const unsigned int lowerscan,const unsigned int upperscan,ScanWriter& writer);
+   uint64_t NumberOfBadPixels()const;
+
+protected:
+   void Run(const unsigned int threadindex);
+
+private:
+   //Number of scans in a block - the unit of work given to a thread
+   static const unsigned int BLOCKSCANS=32;
+
+   class BlockSlot
+   {
+   public:
+      BlockSlot(const unsigned int npixels,const bool atmosparameters);
+
+      unsigned int firstscan,nscans;
+      std::vector<ScanPositions> positions;
+      bool done;
+      std::string error;
+   };
+
+   void GeolocateBlock(BlockSlot* const slot,GeolocationScratch* const scratch);
+   void GeolocateScan(const unsigned int scan,GeolocationScratch* const scratch,ScanPositions& positions);
+   void WriteGeolocatedBlocks(bool waitfornext,ScanWriter& writer);
+   void StopThreads();
+
+   GeolocationSettings settings;
+   unsigned int numthreads;
+   std::vector<GeolocationScratch*> scratch; //one per thread
+   std::vector<BlockSlot*> slots;
+   unsigned long nextqueue,nextgeolocate,nextwrite;
+   bool stopthreads;
+   Mutex queuemutex;
+   Condition blockqueued,blockgeolocated;
+};
+
 //----------------------------------------------------------------------------
 // Delete objects if they exist
 //----------------------------------------------------------------------------
-void TidyObjects(CommandLine* cl, Boresight* b,ViewVectors* v,NavBaseClass* n,ViewVectors* v2,Ellipsoid* e, DEM* d,BILWriter* bl)
+void TidyObjects(CommandLine* cl, Boresight* b,ViewVectors* v,NavBaseClass* n,Ellipsoid* e, DEM* d,BILWriter* bl)
 {
    if(cl!=NULL)
       delete cl;
@@ -141,8 +266,6 @@ void TidyObjects(CommandLine* cl, Boresight* b,ViewVectors* v,NavBaseClass* n,Vi
       delete v;
    if(n!=NULL)
       delete n;
-   if(v2!=NULL)
-      delete v2;
    if(e!=NULL)
       delete e;
    if(d!=NULL)
@@ -151,28 +274,6 @@ void TidyObjects(CommandLine* cl, Boresight* b,ViewVectors* v,NavBaseClass* n,Vi
       delete bl;
 }
 
-//----------------------------------------------------------------------------
-// Delete arrays if they exist
-//----------------------------------------------------------------------------
-void TidyArrays(double* Plat,double* Plon,double* Pheight,double* Px,double* Py,double* Pz,double* hdist)
-{
-   if(Plat!=NULL)
-      delete[] Plat;
-   if(Plon!=NULL)
-      delete[] Plon;
-   if(Pheight!=NULL)
-      delete[] Pheight;
-   if(Px!=NULL)
-      delete[] Px;
-   if(Py!=NULL)
-      delete[] Py;
-   if(Pz!=NULL)
-      delete[] Pz;
-   if(hdist!=NULL)
-      delete[] hdist;
-}
-
-
 int main(int argc,char* argv[])
 {
    //----------------------------------------------------------------------------
@@ -192,8 +293,6 @@ int main(int argc,char* argv[])
    //Leverarm* leverarm=NULL;
    //Pointer to a view vector table object
    ViewVectors* viewvectors=NULL;
-   //Pointer to a second view vector object
-   ViewVectors* viewvectorsscanline=NULL;
    //Pointer to a navigation object
    NavBaseClass* navigation=NULL;
    //Pointer to an ellipsoid model
@@ -212,6 +311,13 @@ int main(int argc,char* argv[])
    // Maximum allowed viewvector angle (degrees) - all others above this will be given the bad data value and not geocorrected
    float maxallowedvvangle=defaultmaxallowedvvangle;
    uint64_t numofbadpixels=0;
+   //Number of threads to geolocate the scans on
+   unsigned int numthreads=1;
+   //Do we want per band statistics of the IGM data, and in a sidecar file rather than the hdr
+   bool DO_STATISTICS=false;
+   bool STATISTICS_TO_SIDECAR=false;
+   //Object to geolocate the scans
+   ScanGeolocator* geolocator=NULL;
 
    std::stringstream strout;  //string to hold text messages in
    int retval=0; //return values stored here
@@ -224,9 +330,6 @@ int main(int argc,char* argv[])
    std::string strppoutFileName; //per-pixel position (lat/lon) filename to output to
    std::string strDEMFileName; //DEM filename
 
-   double minlat=180,minlon=500,maxlon=-500,maxlat=-500;
-   double tminlat=0,tminlon=0,tmaxlat=0,tmaxlon=0;
-
    //Get exe name without the path
    std::string niceexename=std::string(argv[0]);
    niceexename=niceexename.substr(niceexename.find_last_of("/\\")+1);
@@ -555,6 +658,42 @@ int main(int argc,char* argv[])
          else
             throw CommandLine::CommandLineException("Argument -maxvvangle must immediately precede the maximum angle in degrees value.\n");
       }
+
+      //----------------------------------------------------------------------
+      // Get the number of threads to geolocate the scans on
+      //----------------------------------------------------------------------
+      if(cl->OnCommandLine("-threads"))
+      {
+         if(cl->NumArgsOfOpt("-threads")!=1)
+         {
+            throw CommandLine::CommandLineException("-threads should immediately preceed the number of threads to use. Got: "+cl->GetArg("-threads"));      
+         }
+         numthreads=StringToUINT(TrimWhitespace(cl->GetArg("-threads")));
+         if(numthreads==0)
+         {
+            throw CommandLine::CommandLineException("-threads should be at least 1. Got: "+cl->GetArg("-threads"));      
+         }
+         Logger::Log("Will geolocate the scans using "+ToString(numthreads)+" threads.");
+      }
+
+      //----------------------------------------------------------------------
+      // Get whether to keep per band statistics of the IGM data
+      //----------------------------------------------------------------------
+      if(cl->OnCommandLine("-stats"))
+      {
+         if(cl->NumArgsOfOpt("-stats")==0)
+            DO_STATISTICS=true;
+         else if((cl->NumArgsOfOpt("-stats")==1)&&(TrimWhitespace(cl->GetArg("-stats")).compare("sidecar")==0))
+         {
+            DO_STATISTICS=true;
+            STATISTICS_TO_SIDECAR=true;
+         }
+         else
+         {
+            throw CommandLine::CommandLineException("-stats should be given on its own or followed by 'sidecar'. Got: "+cl->GetArg("-stats"));      
+         }
+      }
+
       //*****************************************************************
       // ENTER NEW COMMAND LINE OPTION CODE HERE
       //*****************************************************************
@@ -563,37 +702,37 @@ int main(int argc,char* argv[])
    catch(CommandLine::CommandLineException e)
    {
       Logger::Error(std::string(e.what())+"\n"+e.info);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    }
    catch(char const* e)
    {
       Logger::Error(e);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);      
    }
    catch(std::string e)
    {
       Logger::Error(e);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);      
    }
    catch(BinaryReader::BRexception e)
    {
       Logger::Error(std::string(e.what())+"\n"+e.info);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1); //exit the program
    }
    catch(std::exception& e)
    {
       PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString(),&e);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    }
    catch(...)
    {
       PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    } 
 
@@ -617,19 +756,19 @@ int main(int argc,char* argv[])
    catch(BinaryReader::BRexception e)
    {
       Logger::Error(std::string(e.what())+"\n"+e.info);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1); //exit the program
    }
    catch(char const* e)
    {
       Logger::Error(e);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);      
    }
    catch(...)
    {
       PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    } 
    
@@ -643,67 +782,26 @@ int main(int argc,char* argv[])
    catch(BinaryReader::BRexception e)
    {
       Logger::Error(std::string(e.what())+"\n"+e.info);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1); //exit the program
    }
    catch(char const* e)
    {
       Logger::Error(e);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    }
    catch(...)
    {
       PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    } 
 
-   //----------------------------------------------------------------------------
-   // Create a copy of the view vectors to use for per scan line offsets
-   //----------------------------------------------------------------------------
-   viewvectorsscanline=new ViewVectors(*viewvectors);
-
    //----------------------------------------------------------------------------
    // Set up some variables for the main loop
    //----------------------------------------------------------------------------
-
-   double X=0,Y=0,Z=0; //Aircraft ECEF XYZ position
    double lat=0,lon=0,hei=0;//Aircraft LLH position
-
-   //ECEF view vectors
-   CartesianVector* ECEF_vectors=NULL;
-
-   //Position on surface in X,Y,Z
-   double* Px=NULL;
-   double* Py=NULL;
-   double* Pz=NULL;
-
-   //Geodetic lat/lon/hei of the new pixel position
-   double* Plat=NULL;
-   double* Plon=NULL;
-   double* Pheight=NULL;
-   //distance from sensor to surface
-   double* hdist=NULL; 
-
-   //Surface intersect points in ECEF
-   Px=new double[viewvectorsscanline->NumberItems()];
-   Py=new double[viewvectorsscanline->NumberItems()];
-   Pz=new double[viewvectorsscanline->NumberItems()];
-   //Surface intersect points in LLH
-   Plat=new double[viewvectorsscanline->NumberItems()];
-   Plon=new double[viewvectorsscanline->NumberItems()];
-   Pheight=new double[viewvectorsscanline->NumberItems()];
-   //Distance from aircraft to ellipsoid surface for each scan line pixel
-   hdist=new double[viewvectorsscanline->NumberItems()];
-
-   //Variables for DEM processing loops
-   double seedlat=0; //seed position latitude
-   double seedlon=0; //seed position longitude
-   //Nadir vector
-   blitz::TinyMatrix<double,3,1> myNadir;
-   //index for vv closest to nadir
-   unsigned int nadirindex=0; 
    try
    {
       //----------------------------------------------------------------------------
@@ -736,19 +834,19 @@ int main(int argc,char* argv[])
    catch(BinaryReader::BRexception e)
    {
       Logger::Error(std::string(e.what())+"\n"+e.info);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1); //exit the program
    }
    catch(char const* e)
    {
       Logger::Error(e);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    }
    catch(...)
    {
       PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    } 
 
@@ -762,15 +860,14 @@ int main(int argc,char* argv[])
       try
       {
          //Get DEM bounds for area to read in
-         bool DEMAREAOK=SetDEMAreaToReadIn(navigation,viewvectorsscanline,dem,ellipsoid,false);
+         bool DEMAREAOK=SetDEMAreaToReadIn(navigation,viewvectors,dem,ellipsoid,false);
 
          //If the DEM is not big enough for some reason
          if(!DEMAREAOK)
          {
             Logger::Log("WARNING: It appears that the DEM does not cover the area of the navigation file.");
             Logger::Log("Exiting...");
-            TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-            TidyArrays(Plat,Plon,Pheight,Px,Py,Pz,hdist);
+            TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
             exit(1);      
          }
          else
@@ -797,7 +894,7 @@ int main(int argc,char* argv[])
                //Calculate min/max limits for this section of navigation
                navigation->FindLimits(lowerscan,upperscan);
                //Now try DEM AOI with these limits
-               DEMAREAOK=SetDEMAreaToReadIn(navigation,viewvectorsscanline,dem,ellipsoid,true);     
+               DEMAREAOK=SetDEMAreaToReadIn(navigation,viewvectors,dem,ellipsoid,true);     
                if(!DEMAREAOK)
                   Logger::Error("DEM AOI is not OK - This should never happen and is a bug - please notify ARSF.");
 
@@ -831,31 +928,31 @@ int main(int argc,char* argv[])
       catch(const char* e)
       {
          Logger::Error(e);
-         TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
          exit(1);
       }
       catch(std::string e)
       {
          Logger::Error(e);
-         TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
          exit(1);
       }
       catch(std::bad_alloc& e)
       {
          Logger::Error("Exception: trying to allocate more RAM than is available. Current work around - use a lower resolution (in lat/lon) DEM.");
-         TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
          exit(1);
       }
       catch(std::exception& e)
       {
          PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString(),&e);
-         TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
          exit(1);
       }
       catch(...)
       {
          PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-         TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
          exit(1);
       }      
    }
@@ -872,7 +969,7 @@ int main(int argc,char* argv[])
    //----------------------------------------------------------------------
    try
    {
-      bilout=new BILWriter(strppoutFileName,FileWriter::float64,navigation->TotalScans(),viewvectorsscanline->NumberItems(),3,'a');
+      bilout=new BILWriter(strppoutFileName,FileWriter::float64,navigation->TotalScans(),viewvectors->NumberItems(),3,'a');
       bilout->AddToHdr("projection = Geographic Lat/Lon");
       bilout->AddToHdr("datum ellipsoid = "+ellipsoid->Name());
       //Add band names
@@ -887,337 +984,614 @@ int main(int argc,char* argv[])
       bilout->AddToHdr("x start = "+xstart);
       bilout->AddToHdr("y start = "+ystart);
       bilout->AddToHdr("data ignore value = "+ToString(BADDATAVALUE));
+      //Keep per band statistics of the IGM positions for QA if requested
+      if(DO_STATISTICS)
+      {
+         bilout->SetStatisticsIgnoreValue(BADDATAVALUE);
+         bilout->EnableStatistics(STATISTICS_TO_SIDECAR);
+      }
 
    }
    catch(BILWriter::BILexception e)
    {
       Logger::Error(std::string(e.what())+"\n"+e.info);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    }
    catch(std::exception& e)
    {
       PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString(),&e);
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    }
    catch(...)
    {
       PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-      TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+      TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
       exit(1);
    } 
 
    //----------------------------------------------------------------------------
-   //Loop through the navigation file reading per scan
-   //Note this now takes into account possibility of multiple DEM readings
+   //Set up the geolocation of the scans, and the writer to output them in order
    //----------------------------------------------------------------------------
+   GeolocationSettings settings;
+   settings.navigation=navigation;
+   settings.viewvectors=viewvectors;
+   settings.ellipsoid=ellipsoid;
+   settings.dem=(strDEMFileName!="") ? dem : NULL;
+   settings.vvmethod=vvmethod;
+   settings.maxallowedvvangle=maxallowedvvangle;
+   settings.height_offset=height_offset;
+   settings.atmosparameters=(strAtmosOutFilename.compare("")!=0);
+
+   geolocator=new ScanGeolocator(settings,numthreads);
+   ScanWriter writer(bilout,strAtmosOutFilename,navigation->TotalScans());
 
+   //----------------------------------------------------------------------------
+   //Loop through the navigation file geolocating each scan
+   //Note this now takes into account possibility of multiple DEM readings
+   //----------------------------------------------------------------------------
    for(std::vector<unsigned int>::iterator it=sectionscanlimits.begin();it!=sectionscanlimits.end();it=it+2)
    {
       //Get the lower/upper scan limits for this subsection of DEM
       lowerscan=*it;
       upperscan=*(it+1);
       Logger::Log("Processing section with scan bounds: "+ToString(lowerscan)+" : "+ToString(upperscan));
-      //If we are using a DEM then we need to set the AOI to match this region defined by the lower/upper scans
-      if(strDEMFileName!="")
+      try
       {
-         try
+         //If we are using a DEM then we need to set the AOI to match this region defined by the lower/upper scans
+         if(strDEMFileName!="")
          {
             //Set DEM AOI to this subsection
             navigation->FindLimits(lowerscan,upperscan);
-            SetDEMAreaToReadIn(navigation,viewvectorsscanline,dem,ellipsoid,true);
+            SetDEMAreaToReadIn(navigation,viewvectors,dem,ellipsoid,true);
             //Read in DEM data
             dem->FillArray();
          }
-         catch(char const* e)
-         {
-            Logger::Error(e);
-            TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-            TidyArrays(Plat,Plon,Pheight,Px,Py,Pz,hdist);
-            exit(1);
-         }
-         catch(std::string e)
-         {
-            Logger::Error(e);
-            TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-            TidyArrays(Plat,Plon,Pheight,Px,Py,Pz,hdist);
-            exit(1);
-         }
+
+         geolocator->Geolocate(lowerscan,upperscan,writer);
       }
-      for(unsigned int scan=lowerscan;scan<upperscan;scan++)
+      catch(char const* e)
       {
-         Logger::Verbose("Starting scan: "+ToString(scan));
-         //Read in the current scan
-         navigation->ReadScan(scan);
-         //update the view vectors accordingly
-         if(vvmethod==COMBINED)
-            viewvectorsscanline->ApplyAngleRotations(navigation->Roll(),navigation->Pitch(),navigation->Heading());
+         Logger::Error(e);
+         delete geolocator;
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
+         exit(1);
+      }
+      catch(std::string e)
+      {
+         Logger::Error(e);
+         delete geolocator;
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
+         exit(1);
+      }
+      catch(std::exception& e)
+      {
+         PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString(),&e);
+         delete geolocator;
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
+         exit(1);
+      }
+      catch(...)
+      {
+         PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
+         delete geolocator;
+         TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
+         exit(1);
+      } 
+   }
 
-         //get the lat/lon/hei of aircraft 
-         lat=navigation->Lat();
-         lon=navigation->Lon();
-         hei=navigation->Hei();
-         Logger::Verbose("Aircraft position: latitude: "+ToString(lat)+" longitude: "+ToString(lon)+" height: "+ToString(hei));
+   numofbadpixels=geolocator->NumberOfBadPixels();
+   delete geolocator;
 
-         //Now convert the aircraft pos to ECEF XYZ
-         ConvertLLH2XYZ(&lat, &lon, &hei, &X, &Y, &Z, 1, GEODETIC,ellipsoid);
+   //Output the min/max to the bil header
+   bilout->AddToHdr(";Min X = "+ToString(writer.minlon));
+   bilout->AddToHdr(";Max X = "+ToString(writer.maxlon));
+   bilout->AddToHdr(";Min Y = "+ToString(writer.minlat));
+   bilout->AddToHdr(";Max Y = "+ToString(writer.maxlat));
 
-         //Create a cartesian vector object to store the ecef vectors in, with an origin at the aircraft
-         ECEF_vectors=new CartesianVector(viewvectorsscanline->NumberItems(),X,Y,Z);
+   bilout->Close();
 
-         //Convert the view vectors into earth centred earth fixed cartesians
-         if(vvmethod==COMBINED)
-         {
-            GetScanLineViewVectorsInECEFXYZ(ECEF_vectors,viewvectorsscanline,lat,lon,vvmethod,maxallowedvvangle,numofbadpixels);
-         }
-         else if(vvmethod==SPLIT)
-         {
-            GetScanLineViewVectorsInECEFXYZ(ECEF_vectors,viewvectorsscanline,lat,lon,vvmethod,maxallowedvvangle,numofbadpixels,navigation->Roll(),navigation->Pitch(),navigation->Heading());
-         }
+   //Output the number of bad pixels
+   if(numofbadpixels>0)
+   {
+      Logger::Warning("There were some pixels which were not mapped because their view vector angle was greater"
+                      " than the maximum allowed (set by -maxvvangle. Total number: "+ToString(numofbadpixels));
+   }
 
-         //If Ellipsoid mapping has been requested on command line then map to the ellipsoid
-         //Currently this depends on whether a DEM was given on the command line
-         if(strDEMFileName=="") //no dem given on command line
-         {
-            GetDistanceToEllipsoid(X,Y,Z,hei,ECEF_vectors,ellipsoid,height_offset,hdist,viewvectorsscanline->NumberItems());
-            //For each of the pixels per scan line, project onto the ellipsoid surface
-            for(unsigned int p=0;p<viewvectorsscanline->NumberItems();p++)
-            {
-               if(hdist[p]==BADDATAVALUE)
-               {
-                  Px[p]=Py[p]=Pz[p]=BADDATAVALUE;
-               }
-               else
-               {
-                  Px[p]=X+ECEF_vectors->X[p]*hdist[p];
-                  Py[p]=Y+ECEF_vectors->Y[p]*hdist[p];
-                  Pz[p]=Z+ECEF_vectors->Z[p]*hdist[p];
-               }
-            }
-         }
-         else
-         //Else if DEM has been supplied and requested for use in mapping
-         {
-            try
-            {
-               //For this scan line - get the nadir vector and find the vv closest to nadir            
-               myNadir=GetNadirVector(lat,lon);
-               nadirindex=ECEF_vectors->GetNadirIndex(myNadir);
-               //Logger::Debug("Nadir Vector: X:"+ToString(myNadir(0,0))+" Y:"+ToString(myNadir(1,0))+" Z:"+ToString(myNadir(2,0)));
-               //Logger::Debug("ViewVector index closest to nadir: "+ToString(nadirindex));
-               //Logger::Debug("Vector ("+ToString(nadirindex)+"): "+ToString(ECEF_vectors->X[nadirindex])+" "+ToString(ECEF_vectors->Y[nadirindex])
-               //            +" "+ToString(ECEF_vectors->Z[nadirindex]));
-
-               //Set up seed position for DEM intersection search - use aircraft lat/lon   
-               seedlat=lat;
-               seedlon=lon;
-               //"Shuffle" these to add on an offset if required - only if this falls on a boundary line of the dem,
-               //we want to shift it so that it is definitely on one side of the boundary (either of the sides is ok)
-               ShuffleSeed(&seedlat,&seedlon,dem);
-
-               //For each pixel from nadir index to end of ccd
-               for(unsigned int pixel=nadirindex;pixel<viewvectorsscanline->NumberItems();pixel++)
-               {
-                  //FindIntersect(dem,&Px[pixel],&Py[pixel],&Pz[pixel],&seedlat,&seedlon,ellipsoid,ECEF_vectors,pixel);           
-                  FindIntersect(&Px[pixel],&Py[pixel],&Pz[pixel],&seedlat,&seedlon,ellipsoid,dem,ECEF_vectors,pixel);
-               }
-               //Reset seed lat/lon to aircraft/nadir position
-               seedlat=lat;
-               seedlon=lon;
-               //"Shuffle" these to add on an offset if required - only if this falls on a boundary line of the dem,
-               //we want to shift it so that it is definitely on one side of the boundary (either of the sides is ok)
-               ShuffleSeed(&seedlat,&seedlon,dem);
-
-               //Now go through the other viewvectors i.e. nadir index to start of ccd
-               for(int pixel=nadirindex-1;pixel>=0;pixel--)
-               {
-                  //FindIntersect(dem,&Px[pixel],&Py[pixel],&Pz[pixel],&seedlat,&seedlon,ellipsoid,ECEF_vectors,pixel);             
-                  FindIntersect(&Px[pixel],&Py[pixel],&Pz[pixel],&seedlat,&seedlon,ellipsoid,dem,ECEF_vectors,pixel);
-               }
-            }
-            catch(char const* e)
-            {
-               Logger::Error(e);
-               TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-               TidyArrays(Plat,Plon,Pheight,Px,Py,Pz,hdist);
-               exit(1);
-            }
-            catch(std::string e)
-            {
-               Logger::Error(e);
-               TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-               TidyArrays(Plat,Plon,Pheight,Px,Py,Pz,hdist);
-               exit(1);
-            }
-            catch(std::exception& e)
-            {
-               PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString(),&e);
-               TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-               exit(1);
-            }
-            catch(...)
-            {
-               PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-               TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-               exit(1);
-            } 
-         }
+   Logger::Log("Geocorrection processing completed. \n\n");
+   TidyObjects(cl,boresight,viewvectors,navigation,ellipsoid,dem,bilout);
+}
 
-         //Now convert the new pixel position to LLH for each pixel of scanline - THESE ARE RETURNED AS RADIANS
-         ConvertXYZ2LLH(Px, Py, Pz,Plat, Plon, Pheight,viewvectorsscanline->NumberItems(),GEODETIC,ellipsoid,BADDATAVALUE);
+//-------------------------------------------------------------------------
+// ScanPositions constructor - creates the arrays for a scan of npixels
+//-------------------------------------------------------------------------
+ScanPositions::ScanPositions(const unsigned int npixels,const bool atmosparameters)
+   :scan(0),Plon(npixels),Plat(npixels),Pheight(npixels)
+{
+   if(atmosparameters)
+      atmosout.resize(npixels*NBANDSATMOSFILE);
+}
 
-         //if atmospheric correction software parameters are to be output - do this here
-         if(strAtmosOutFilename.compare("")!=0)
-         {
-            const int nbandsatmosfile=5;
-            //Create arrays to hold the dem slope and aspect for this scan line worth of data
-            double* atmosout=new double[viewvectorsscanline->NumberItems()*nbandsatmosfile];
-            //constant pointers for simplicty pointing into atmosout parameter
-            double* const azimuth=&atmosout[0];
-            double* const zenith=&atmosout[viewvectorsscanline->NumberItems()];
-            double* const distance=&atmosout[viewvectorsscanline->NumberItems()*2];
-            double* const demslope=&atmosout[viewvectorsscanline->NumberItems()*3];
-            double* const demaspect=&atmosout[viewvectorsscanline->NumberItems()*4];
-
-            //Get the view vectors in azimuth,zenith 
-            //For each of the pixels in the arrays, calculate the geodesic distance, azimuith and zenith
-            for(unsigned int i=0;i<viewvectorsscanline->NumberItems();i++)
-            {
-               GetGeodesicDistance_Bowring(Plon[i],Plat[i],Pheight[i],lon*PI/180,lat*PI/180,hei,distance[i],azimuth[i],zenith[i],ellipsoid);
-            }
+//-------------------------------------------------------------------------
+// GeolocationScratch constructor - creates the arrays for one thread
+//-------------------------------------------------------------------------
+GeolocationScratch::GeolocationScratch(ViewVectors* const viewvectors)
+   :Px(viewvectors->NumberItems()),Py(viewvectors->NumberItems()),Pz(viewvectors->NumberItems()),hdist(viewvectors->NumberItems())
+{
+   viewvectorsscanline=new ViewVectors(*viewvectors);
+   numofbadpixels=0;
+}
 
-            //Get the DEM slope and aspect values for cells in which the intersect is contained
-            if(strDEMFileName.compare("")!=0)
-            {
-               dem->CalculateSlopeAndAzimuth(Plat,Plon,demslope,demaspect,viewvectorsscanline->NumberItems());
-            }
-            else
-            {
-               //No dem is being used - set to zero for outputs
-               for(unsigned int iv=0;iv<viewvectorsscanline->NumberItems();iv++)
-               {
-                  demslope[iv]=0;
-                  demaspect[iv]=0;
-               }
-            }
+//-------------------------------------------------------------------------
+// GeolocationScratch destructor
+//-------------------------------------------------------------------------
+GeolocationScratch::~GeolocationScratch()
+{
+   delete viewvectorsscanline;
+}
 
-            //Open up a bil file to write to
-            try
-            {
-               BILWriter* dataout=new BILWriter(strAtmosOutFilename,FileWriter::float64,navigation->TotalScans(),viewvectorsscanline->NumberItems(),nbandsatmosfile,'a');
-               //Add band names
-               dataout->AddToHdr("band names = {View azimuth, View zenith, Distance, DEM slope, DEM aspect}");
-               dataout->AddToHdr(";View azimuth and DEM aspect (azimuth) are measured clockwise from North in degrees.");
-               dataout->AddToHdr(";View zenith is measured in degrees from the vertical to the nadir.");
-               dataout->AddToHdr(";DEM slope is measured in degrees from the horizontal.");
-               dataout->AddToHdr(";Distance is the distance from sensor to ground intersect and measured in metres.");
-               //Write out the data
-               dataout->WriteLine((char*)atmosout);
-               //Tidy up 
-               dataout->Close();
-               delete dataout;
-            }
-            catch(BILWriter::BILexception e)
-            {
-               //At the moment just say what went wrong
-               Logger::Error(std::string(e.what())+"\n"+e.info);
-            }
-            catch(std::exception& e)
-            {
-               PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString(),&e);
-               TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-               exit(1);
-            }
-            catch(...)
-            {
-               PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-               TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-               exit(1);
-            } 
+//-------------------------------------------------------------------------
+// ScanWriter constructor
+//-------------------------------------------------------------------------
+ScanWriter::ScanWriter(BILWriter* const bilout,const std::string atmosfilename,const unsigned int totalscans)
+{
+   this->bilout=bilout;
+   this->atmosfilename=atmosfilename;
+   this->totalscans=totalscans;
+   minlat=180;
+   minlon=500;
+   maxlon=-500;
+   maxlat=-500;
+}
 
-            delete[] atmosout;
-         }
+//-------------------------------------------------------------------------
+// Write out the positions of a scan (and the atmospheric parameters if 
+// requested) and update the min/max lat and lon. Scans must be given to
+// this in scan order.
+//-------------------------------------------------------------------------
+void ScanWriter::Write(ScanPositions& positions)
+{
+   const unsigned int npixels=positions.Plon.size();
 
-         //Output the pixel lat/lon/hei arrays
-         try
-         {
-            //Need to convert from radians to degrees
-            for(unsigned int j=0;j<viewvectorsscanline->NumberItems();j++)
-            {
-               if((Plon[j]!=BADDATAVALUE)||(Plat[j]!=BADDATAVALUE))
-               {
-                  Plon[j]=Plon[j]*180/PI;
-                  Plat[j]=Plat[j]*180/PI;
-               }
-            }
+   //if atmospheric correction software parameters are to be output - do this here
+   if(atmosfilename.compare("")!=0)
+   {
+      //Open up a bil file to write to
+      try
+      {
+         BILWriter* dataout=new BILWriter(atmosfilename,FileWriter::float64,totalscans,npixels,NBANDSATMOSFILE,'a');
+         //Add band names
+         dataout->AddToHdr("band names = {View azimuth, View zenith, Distance, DEM slope, DEM aspect}");
+         dataout->AddToHdr(";View azimuth and DEM aspect (azimuth) are measured clockwise from North in degrees.");
+         dataout->AddToHdr(";View zenith is measured in degrees from the vertical to the nadir.");
+         dataout->AddToHdr(";DEM slope is measured in degrees from the horizontal.");
+         dataout->AddToHdr(";Distance is the distance from sensor to ground intersect and measured in metres.");
+         //Write out the data
+         dataout->WriteLine((char*)&positions.atmosout[0]);
+         //Tidy up 
+         dataout->Close();
+         delete dataout;
+      }
+      catch(BILWriter::BILexception e)
+      {
+         //At the moment just say what went wrong
+         Logger::Error(std::string(e.what())+"\n"+e.info);
+      }
+   }
 
-            //Keep track of min/max lat and longs here
-            tmaxlat=*std::max_element(Plat,Plat+viewvectorsscanline->NumberItems());
-            tminlat=*std::min_element(Plat,Plat+viewvectorsscanline->NumberItems());
-            tmaxlon=*std::max_element(Plon,Plon+viewvectorsscanline->NumberItems());
-            tminlon=*std::min_element(Plon,Plon+viewvectorsscanline->NumberItems());
-            //Update variables if a new min or max is found
-            if(tmaxlat > maxlat)
-               maxlat=tmaxlat;
-            if(tminlat < minlat)
-               minlat=tminlat;
-            if(tmaxlon > maxlon)
-               maxlon=tmaxlon;
-            if(tminlon < minlon)
-               minlon=tminlon;
-
-            bilout->WriteBandLine((char*)Plon);
-            bilout->WriteBandLine((char*)Plat);
-            bilout->WriteBandLine((char*)Pheight);
-         }
-         catch(BILWriter::BILexception e)
+   //Output the pixel lat/lon/hei arrays
+   try
+   {
+      //Keep track of min/max lat and longs here
+      double tmaxlat=*std::max_element(positions.Plat.begin(),positions.Plat.end());
+      double tminlat=*std::min_element(positions.Plat.begin(),positions.Plat.end());
+      double tmaxlon=*std::max_element(positions.Plon.begin(),positions.Plon.end());
+      double tminlon=*std::min_element(positions.Plon.begin(),positions.Plon.end());
+      //Update variables if a new min or max is found
+      if(tmaxlat > maxlat)
+         maxlat=tmaxlat;
+      if(tminlat < minlat)
+         minlat=tminlat;
+      if(tmaxlon > maxlon)
+         maxlon=tmaxlon;
+      if(tminlon < minlon)
+         minlon=tminlon;
+
+      bilout->WriteBandLine((char*)&positions.Plon[0]);
+      bilout->WriteBandLine((char*)&positions.Plat[0]);
+      bilout->WriteBandLine((char*)&positions.Pheight[0]);
+   }
+   catch(BILWriter::BILexception e)
+   {
+      //At the moment just say what went wrong
+      Logger::Error(std::string(e.what())+"\n"+e.info);
+   }
+
+   //Percent done counter
+   PercentProgress(positions.scan,totalscans);
+}
+
+//-------------------------------------------------------------------------
+// Constructor for the block slot - creates the positions for each scan
+//-------------------------------------------------------------------------
+ScanGeolocator::BlockSlot::BlockSlot(const unsigned int npixels,const bool atmosparameters)
+   :positions(BLOCKSCANS,ScanPositions(npixels,atmosparameters))
+{
+   firstscan=0;
+   nscans=0;
+   done=false;
+   error="";
+}
+
+//-------------------------------------------------------------------------
+// ScanGeolocator constructor - creates the scratch arrays for each thread
+// and the slots to queue the blocks of scans in
+//-------------------------------------------------------------------------
+ScanGeolocator::ScanGeolocator(const GeolocationSettings& settings,const unsigned int numthreads)
+   :settings(settings)
+{
+   this->numthreads=numthreads;
+   for(unsigned int i=0;i<numthreads;i++)
+      scratch.push_back(new GeolocationScratch(settings.viewvectors));
+
+   //Use 2 slots per thread so that threads can keep working whilst
+   //the geolocated scans are being written out
+   const unsigned int nslots=(numthreads > 1) ? 2*numthreads : 1;
+   for(unsigned int i=0;i<nslots;i++)
+      slots.push_back(new BlockSlot(settings.viewvectors->NumberItems(),settings.atmosparameters));
+
+   nextqueue=nextgeolocate=nextwrite=0;
+   stopthreads=false;
+}
+
+//-------------------------------------------------------------------------
+// ScanGeolocator destructor
+//-------------------------------------------------------------------------
+ScanGeolocator::~ScanGeolocator()
+{
+   StopThreads();
+   for(std::vector<GeolocationScratch*>::iterator it=scratch.begin();it!=scratch.end();it++)
+      delete (*it);
+   for(std::vector<BlockSlot*>::iterator it=slots.begin();it!=slots.end();it++)
+      delete (*it);
+}
+
+//-------------------------------------------------------------------------
+// Return the number of pixels with a view vector above the maximum angle
+//-------------------------------------------------------------------------
+uint64_t ScanGeolocator::NumberOfBadPixels()const
+{
+   uint64_t numofbadpixels=0;
+   for(std::vector<GeolocationScratch*>::const_iterator it=scratch.begin();it!=scratch.end();it++)
+      numofbadpixels+=(*it)->numofbadpixels;
+   return numofbadpixels;
+}
+
+//-------------------------------------------------------------------------
+// Geolocate scans lowerscan to upperscan-1 a block at a time, passing each
+// scan to the writer in scan order. The DEM (if used) must already hold
+// the area for these scans and is not changed until this returns.
+//-------------------------------------------------------------------------
+void ScanGeolocator::Geolocate(const unsigned int lowerscan,const unsigned int upperscan,ScanWriter& writer)
+{
+   if(numthreads==1)
+   {
+      //Geolocate on this thread
+      BlockSlot* slot=slots[0];
+      for(unsigned int first=lowerscan;first<upperscan;first+=BLOCKSCANS)
+      {
+         slot->firstscan=first;
+         slot->nscans=(upperscan-first < BLOCKSCANS) ? upperscan-first : BLOCKSCANS;
+         GeolocateBlock(slot,scratch[0]);
+         for(unsigned int s=0;s<slot->nscans;s++)
+            writer.Write(slot->positions[s]);
+      }
+      return;
+   }
+
+   nextqueue=nextgeolocate=nextwrite=0;
+   stopthreads=false;
+   Start(numthreads);
+
+   for(unsigned int first=lowerscan;first<upperscan;first+=BLOCKSCANS)
+   {
+      //Write out geolocated blocks until there is a free slot
+      while(nextqueue-nextwrite >= slots.size())
+         WriteGeolocatedBlocks(true,writer);
+
+      queuemutex.Lock();
+      BlockSlot* slot=slots[nextqueue % slots.size()];
+      slot->firstscan=first;
+      slot->nscans=(upperscan-first < BLOCKSCANS) ? upperscan-first : BLOCKSCANS;
+      slot->error="";
+      slot->done=false;
+      nextqueue++;
+      blockqueued.Signal();
+      queuemutex.Unlock();
+
+      //Write out anything that is ready without waiting
+      WriteGeolocatedBlocks(false,writer);
+   }
+
+   while(nextwrite < nextqueue)
+      WriteGeolocatedBlocks(true,writer);
+
+   StopThreads();
+}
+
+//-------------------------------------------------------------------------
+// Stop the geolocation threads - any blocks queued but not yet written
+// out are discarded
+//-------------------------------------------------------------------------
+void ScanGeolocator::StopThreads()
+{
+   if(!Running())
+      return;
+
+   queuemutex.Lock();
+   stopthreads=true;
+   blockqueued.Broadcast();
+   queuemutex.Unlock();
+
+   Join();
+}
+
+//-------------------------------------------------------------------------
+// Write out geolocated blocks in the order they were queued. If waitfornext
+// is true this waits for the next block to be geolocated, otherwise it only
+// writes blocks that have already been geolocated.
+//-------------------------------------------------------------------------
+void ScanGeolocator::WriteGeolocatedBlocks(bool waitfornext,ScanWriter& writer)
+{
+   while(nextwrite < nextqueue)
+   {
+      BlockSlot* slot=slots[nextwrite % slots.size()];
+
+      queuemutex.Lock();
+      if((slot->done==false)&&(waitfornext==false))
+      {
+         queuemutex.Unlock();
+         return;
+      }
+      while(slot->done==false)
+         blockgeolocated.Wait(queuemutex);
+      queuemutex.Unlock();
+      waitfornext=false;
+
+      if(slot->error.compare("")!=0)
+      {
+         std::string error=slot->error;
+         StopThreads();
+         throw error;
+      }
+
+      for(unsigned int s=0;s<slot->nscans;s++)
+         writer.Write(slot->positions[s]);
+      nextwrite++;
+   }
+}
+
+//-------------------------------------------------------------------------
+// Function run on each geolocation thread - takes the next queued block
+// and geolocates it until told to stop
+//-------------------------------------------------------------------------
+void ScanGeolocator::Run(const unsigned int threadindex)
+{
+   while(true)
+   {
+      BlockSlot* slot=NULL;
+
+      queuemutex.Lock();
+      while((nextgeolocate==nextqueue)&&(stopthreads==false))
+         blockqueued.Wait(queuemutex);
+      if(nextgeolocate==nextqueue)
+      {
+         //Told to stop and there is nothing left to do
+         queuemutex.Unlock();
+         return;
+      }
+      slot=slots[nextgeolocate % slots.size()];
+      nextgeolocate++;
+      queuemutex.Unlock();
+
+      std::string error="";
+      try
+      {
+         GeolocateBlock(slot,scratch[threadindex]);
+      }
+      catch(std::string e)
+      {
+         error=e;
+      }
+      catch(const char* e)
+      {
+         error=std::string(e);
+      }
+      catch(std::exception& e)
+      {
+         error=std::string(e.what());
+      }
+      catch(...)
+      {
+         error="Unknown error.";
+      }
+
+      queuemutex.Lock();
+      slot->error=error;
+      slot->done=true;
+      blockgeolocated.Broadcast();
+      queuemutex.Unlock();
+   }
+}
+
+//-------------------------------------------------------------------------
+// Geolocate each of the scans in the block
+//-------------------------------------------------------------------------
+void ScanGeolocator::GeolocateBlock(BlockSlot* const slot,GeolocationScratch* const scratch)
+{
+   for(unsigned int s=0;s<slot->nscans;s++)
+      GeolocateScan(slot->firstscan+s,scratch,slot->positions[s]);
+}
+
+//-------------------------------------------------------------------------
+// Geolocate the pixels of a scan, returning the lon/lat (in degrees) and
+// heights in positions. Only reads from the shared settings so can be
+// called on several threads at once with different scratch arrays.
+//-------------------------------------------------------------------------
+void ScanGeolocator::GeolocateScan(const unsigned int scan,GeolocationScratch* const scratch,ScanPositions& positions)
+{
+   NavBaseClass* const navigation=settings.navigation;
+   Ellipsoid* const ellipsoid=settings.ellipsoid;
+   DEM* const dem=settings.dem;
+   const unsigned int npixels=settings.viewvectors->NumberItems();
+
+   double* const Px=&scratch->Px[0];
+   double* const Py=&scratch->Py[0];
+   double* const Pz=&scratch->Pz[0];
+   double* const hdist=&scratch->hdist[0];
+   double* const Plon=&positions.Plon[0];
+   double* const Plat=&positions.Plat[0];
+   double* const Pheight=&positions.Pheight[0];
+   positions.scan=scan;
+
+   Logger::Verbose("Starting scan: "+ToString(scan));
+   //Get the navigation for the current scan
+   const double roll=navigation->GetChannel(NavBaseClass::ROLL)[scan];
+   const double pitch=navigation->GetChannel(NavBaseClass::PITCH)[scan];
+   const double heading=navigation->GetChannel(NavBaseClass::HEADING)[scan];
+
+   //update the view vectors accordingly - start from a fresh copy of 
+   //the view vectors for each scan
+   ViewVectors* viewvectorsscanline=settings.viewvectors;
+   if(settings.vvmethod==COMBINED)
+   {
+      viewvectorsscanline=scratch->viewvectorsscanline;
+      std::copy(settings.viewvectors->rotX,settings.viewvectors->rotX+npixels,viewvectorsscanline->rotX);
+      std::copy(settings.viewvectors->rotY,settings.viewvectors->rotY+npixels,viewvectorsscanline->rotY);
+      std::copy(settings.viewvectors->rotZ,settings.viewvectors->rotZ+npixels,viewvectorsscanline->rotZ);
+      viewvectorsscanline->ApplyAngleRotations(roll,pitch,heading);
+   }
+
+   //get the lat/lon/hei of aircraft 
+   double lat=navigation->GetChannel(NavBaseClass::LAT)[scan];
+   double lon=navigation->GetChannel(NavBaseClass::LON)[scan];
+   double hei=navigation->GetChannel(NavBaseClass::HEI)[scan];
+   Logger::Verbose("Aircraft position: latitude: "+ToString(lat)+" longitude: "+ToString(lon)+" height: "+ToString(hei));
+
+   //Now convert the aircraft pos to ECEF XYZ
+   double X=0,Y=0,Z=0; //Aircraft ECEF XYZ position
+   ConvertLLH2XYZ(&lat, &lon, &hei, &X, &Y, &Z, 1, GEODETIC,ellipsoid);
+
+   //Create a cartesian vector object to store the ecef vectors in, with an origin at the aircraft
+   CartesianVector ECEF_vectors(npixels,X,Y,Z);
+
+   //Convert the view vectors into earth centred earth fixed cartesians
+   if(settings.vvmethod==COMBINED)
+   {
+      GetScanLineViewVectorsInECEFXYZ(&ECEF_vectors,viewvectorsscanline,lat,lon,settings.vvmethod,settings.maxallowedvvangle,scratch->numofbadpixels);
+   }
+   else if(settings.vvmethod==SPLIT)
+   {
+      GetScanLineViewVectorsInECEFXYZ(&ECEF_vectors,viewvectorsscanline,lat,lon,settings.vvmethod,settings.maxallowedvvangle,scratch->numofbadpixels,roll,pitch,heading);
+   }
+
+   //If Ellipsoid mapping has been requested on command line then map to the ellipsoid
+   //Currently this depends on whether a DEM was given on the command line
+   if(dem==NULL) //no dem given on command line
+   {
+      GetDistanceToEllipsoid(X,Y,Z,hei,&ECEF_vectors,ellipsoid,settings.height_offset,hdist,npixels);
+      //For each of the pixels per scan line, project onto the ellipsoid surface
+      for(unsigned int p=0;p<npixels;p++)
+      {
+         if(hdist[p]==BADDATAVALUE)
          {
-            //At the moment just say what went wrong
-            Logger::Error(std::string(e.what())+"\n"+e.info);
+            Px[p]=Py[p]=Pz[p]=BADDATAVALUE;
          }
-         catch(std::exception& e)
+         else
          {
-            PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString(),&e);
-            TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-            exit(1);
+            Px[p]=X+ECEF_vectors.X[p]*hdist[p];
+            Py[p]=Y+ECEF_vectors.Y[p]*hdist[p];
+            Pz[p]=Z+ECEF_vectors.Z[p]*hdist[p];
          }
-         catch(...)
-         {
-            PrintAbnormalExitMessage(__FILE__,__LINE__,niceexename,VERSION,CONTACTEMAIL,cl->ReturnCLAsString());
-            TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
-            exit(1);
-         } 
-
-         //Delete the current copy of viewvectorsscanline and replace with a copy of viewvectors 
-         delete viewvectorsscanline;
-         viewvectorsscanline=new ViewVectors(*viewvectors);
-         delete ECEF_vectors;
-
-         //Percent done counter
-         PercentProgress(scan,navigation->TotalScans());
+      }
+   }
+   else
+   //Else if DEM has been supplied and requested for use in mapping
+   {
+      //For this scan line - get the nadir vector and find the vv closest to nadir            
+      blitz::TinyMatrix<double,3,1> myNadir=GetNadirVector(lat,lon);
+      unsigned int nadirindex=ECEF_vectors.GetNadirIndex(myNadir);
+
+      //Set up seed position for DEM intersection search - use aircraft lat/lon   
+      double seedlat=lat;
+      double seedlon=lon;
+      //"Shuffle" these to add on an offset if required - only if this falls on a boundary line of the dem,
+      //we want to shift it so that it is definitely on one side of the boundary (either of the sides is ok)
+      ShuffleSeed(&seedlat,&seedlon,dem);
+
+      //For each pixel from nadir index to end of ccd
+      for(unsigned int pixel=nadirindex;pixel<npixels;pixel++)
+      {
+         FindIntersect(&Px[pixel],&Py[pixel],&Pz[pixel],&seedlat,&seedlon,ellipsoid,dem,&ECEF_vectors,pixel);
+      }
+      //Reset seed lat/lon to aircraft/nadir position
+      seedlat=lat;
+      seedlon=lon;
+      ShuffleSeed(&seedlat,&seedlon,dem);
 
+      //Now go through the other viewvectors i.e. nadir index to start of ccd
+      for(int pixel=nadirindex-1;pixel>=0;pixel--)
+      {
+         FindIntersect(&Px[pixel],&Py[pixel],&Pz[pixel],&seedlat,&seedlon,ellipsoid,dem,&ECEF_vectors,pixel);
       }
    }
 
-   //Output the min/max to the bil header
-   bilout->AddToHdr(";Min X = "+ToString(minlon));
-   bilout->AddToHdr(";Max X = "+ToString(maxlon));
-   bilout->AddToHdr(";Min Y = "+ToString(minlat));
-   bilout->AddToHdr(";Max Y = "+ToString(maxlat));
+   //Now convert the new pixel position to LLH for each pixel of scanline - THESE ARE RETURNED AS RADIANS
+   ConvertXYZ2LLH(Px, Py, Pz,Plat, Plon, Pheight,npixels,GEODETIC,ellipsoid,BADDATAVALUE);
 
-   bilout->Close();
-
-   //Output the number of bad pixels
-   if(numofbadpixels>0)
+   //if atmospheric correction software parameters are to be output - calculate them here
+   if(settings.atmosparameters)
    {
-      Logger::Warning("There were some pixels which were not mapped because their view vector angle was greater"
-                      " than the maximum allowed (set by -maxvvangle. Total number: "+ToString(numofbadpixels));
+      //constant pointers for simplicty pointing into atmosout parameter
+      double* const azimuth=&positions.atmosout[0];
+      double* const zenith=&positions.atmosout[npixels];
+      double* const distance=&positions.atmosout[npixels*2];
+      double* const demslope=&positions.atmosout[npixels*3];
+      double* const demaspect=&positions.atmosout[npixels*4];
+
+      //Get the view vectors in azimuth,zenith 
+      //For each of the pixels in the arrays, calculate the geodesic distance, azimuith and zenith
+      for(unsigned int i=0;i<npixels;i++)
+      {
+         GetGeodesicDistance_Bowring(Plon[i],Plat[i],Pheight[i],lon*PI/180,lat*PI/180,hei,distance[i],azimuth[i],zenith[i],ellipsoid);
+      }
+
+      //Get the DEM slope and aspect values for cells in which the intersect is contained
+      if(dem!=NULL)
+      {
+         dem->CalculateSlopeAndAzimuth(Plat,Plon,demslope,demaspect,npixels);
+      }
+      else
+      {
+         //No dem is being used - set to zero for outputs
+         for(unsigned int iv=0;iv<npixels;iv++)
+         {
+            demslope[iv]=0;
+            demaspect[iv]=0;
+         }
+      }
    }
 
-   Logger::Log("Geocorrection processing completed. \n\n");
-   TidyArrays(Plat,Plon,Pheight,Px,Py,Pz,hdist);
-   TidyObjects(cl,boresight,viewvectors,navigation,viewvectorsscanline,ellipsoid,dem,bilout);
+   //Need to convert from radians to degrees
+   for(unsigned int j=0;j<npixels;j++)
+   {
+      if((Plon[j]!=BADDATAVALUE)||(Plat[j]!=BADDATAVALUE))
+      {
+         Plon[j]=Plon[j]*180/PI;
+         Plat[j]=Plat[j]*180/PI;
+      }
+   }
 }
 
 
@@ -19,12 +19,13 @@
 //#define DEBUGINTERPFUNC
 
 //Straight forward linear interpolation using one data point either side of desired
-void Linear(const double* const times,const int len, DataHandler* const dhandle,NavDataCollection* store,std::string start,std::string stop);
+void Linear(const double* const times,const int len, DataHandler* const dhandle,NavDataCollection* store,std::string start,std::string stop,const unsigned int);
 
-//Smoothes the navigation (raw) data to try and remove any jumps in the data
-void Triangle(const unsigned long element,DataHandler* const dhandle,NavDataLine* store,const int kernelsize);
+//Smoothes a channel of the navigation (raw) data to try and remove any jumps in the data
+void Triangle(const double* const data,double* const smoothed,const unsigned long length,const int kernelsize);
 
-void CubicSpline(const double* const times,const int len,DataHandler* const dhandle,NavDataCollection* store,std::string start,std::string stop);
+//Cubic spline interpolation - using up to maxthreads threads (0 for one per processor)
+void CubicSpline(const double* const times,const int len,DataHandler* const dhandle,NavDataCollection* store,std::string start,std::string stop,const unsigned int maxthreads);
 
 
 #endif
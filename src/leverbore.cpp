@@ -8,6 +8,7 @@
 //If not, please contact arsf-processing@pml.ac.uk 
 //-------------------------------------------------------------------------
 
+#include <algorithm>
 #include "leverbore.h"
 
 #ifndef LEVERDEBUG
@@ -29,13 +30,26 @@ Boresight::Boresight(const double r, const double p, const double h)
 //-------------------------------------------------------------------------
 // Apply the boresight values in-place onto the given roll, pitch, heading
 //-------------------------------------------------------------------------
-void Boresight::ApplyBoresight(double* const roll,double* const pitch,double* const heading)
+void Boresight::ApplyBoresight(double* const roll,double* const pitch,double* const heading)const
 {
    *roll+=this->roll;
    *pitch+=this->pitch;
    *heading+=this->heading;
 }
 
+//-------------------------------------------------------------------------
+// Apply the boresight values in-place onto arrays of roll, pitch, heading
+//-------------------------------------------------------------------------
+void Boresight::ApplyBoresight(double* const roll,double* const pitch,double* const heading,const unsigned long npoints)const
+{
+   for(unsigned long i=0;i<npoints;i++)
+      roll[i]+=this->roll;
+   for(unsigned long i=0;i<npoints;i++)
+      pitch[i]+=this->pitch;
+   for(unsigned long i=0;i<npoints;i++)
+      heading[i]+=this->heading;
+}
+
 
 //-------------------------------------------------------------------------
 //Leverarm constructor
@@ -45,77 +59,108 @@ Leverarm::Leverarm(const double lx, const double ly, const double lz)
    this->x=lx;
    this->y=ly;
    this->z=lz;
-
-   //Create a blitz vector of the lever arm values (for use in conversions)
-   arm=x,y,z;
 }
 
 //-------------------------------------------------------------------------
-// Function to rotate the aircraft leverarm (x,y,z) to ECEF (tempX,tempY.tempZ)
+// Function to rotate the aircraft leverarm (x,y,z) to ECEF for a block of
+// points. This is the same 2-part transformation as GetVVinECEFXYZ but with
+// the rotation matrices multiplied out so that each step is a simple loop
+// over the arrays:
+//1 ... Rotate by aircraft attitude (RZXY) to get into a local level reference frame
+//2 ... Rotate by lat/lon (RXZY with rx=0) to get into ECEF reference frame
 //-------------------------------------------------------------------------
-void Leverarm::LeverToECEF(const double roll, const double pitch, const double heading,double* const GPSlat, double* const GPSlon)
+void Leverarm::LeverToECEF(const double* const roll, const double* const pitch, const double* const heading,
+                           const double* const GPSlat, const double* const GPSlon,
+                           double* const ECEFX, double* const ECEFY, double* const ECEFZ,const unsigned int npoints)const
 {
-   //Apply a 2-part transformation to the lever arms
-   //1 ... Rotate by aircraft attitude to get into a local level reference frame
-   //2 ... Rotate by lat/lon to get into ECEF reference frame
-
-   //Variabe to hold the result of the transformation
-   double ECEFXYZ[3]={0,0,0};
-
-   //Call the transformation function - this does both parts of the 2-part transformation
-   GetVVinECEFXYZ(&arm,ECEFXYZ,*GPSlat,*GPSlon,roll,pitch,heading);
-
-   //Store the ECEFXYZ in the temp variables
-   tempX=ECEFXYZ[0];
-   tempY=ECEFXYZ[1];
-   tempZ=ECEFXYZ[2];
-
-   DEBUGPRINT("ECEF lever arm values:"<<tempX<<" "<<tempY<<" "<<tempZ<<" Magnitude: "<<sqrt(tempX*tempX+tempY*tempY+tempZ*tempZ))
+   const double degradscale=PI/180.0;
+
+   //Rotate by the attitude - rotation matrix is (RzRx)Ry
+   for(unsigned int i=0;i<npoints;i++)
+   {
+      const double cx=cos(roll[i]*degradscale);
+      const double sx=sin(roll[i]*degradscale);
+      const double cy=cos(pitch[i]*degradscale);
+      const double sy=sin(pitch[i]*degradscale);
+      const double cz=cos(heading[i]*degradscale);
+      const double sz=sin(heading[i]*degradscale);
+
+      //RzRx
+      const double a01=-sz*cx, a02=sz*sx;
+      const double a11=cz*cx, a12=-cz*sx;
+
+      //Look vector of the lever arm in the local level frame
+      ECEFX[i]=(cz*cy + a02*(-sy))*x + a01*y + (cz*sy + a02*cy)*z;
+      ECEFY[i]=(sz*cy + a12*(-sy))*x + a11*y + (sz*sy + a12*cy)*z;
+      ECEFZ[i]=(cx*(-sy))*x + sx*y + (cx*cy)*z;
+   }
+
+   //Rotate by the position - rotation matrix is Rz(lon)Ry(-(90+lat))
+   for(unsigned int i=0;i<npoints;i++)
+   {
+      const double cy=cos(-(90+GPSlat[i])*degradscale);
+      const double sy=sin(-(90+GPSlat[i])*degradscale);
+      const double cz=cos(GPSlon[i]*degradscale);
+      const double sz=sin(GPSlon[i]*degradscale);
+
+      const double lx=ECEFX[i], ly=ECEFY[i], lz=ECEFZ[i];
+      ECEFX[i]=(cz*cy)*lx + (-sz)*ly + (cz*sy)*lz;
+      ECEFY[i]=(sz*cy)*lx + cz*ly + (sz*sy)*lz;
+      ECEFZ[i]=(-sy)*lx + cy*lz;
+   }
+
+   DEBUGPRINT("ECEF lever arm values of first point:"<<ECEFX[0]<<" "<<ECEFY[0]<<" "<<ECEFZ[0])
 }
 
 //-------------------------------------------------------------------------
-// Function to add the ECEF lever arms onto the GPS
+// Function to transform the lever arm and add it onto the GPS position
 //-------------------------------------------------------------------------
-void Leverarm::AddToGPS(double* const GPSlat, double* const GPSlon, double* const GPShei,Ellipsoid* ellipsoid)
+void Leverarm::ApplyLeverArm(const double roll, const double pitch, const double heading,
+                   double* const GPSlat, double* const GPSlon, double* const GPShei)const
 {
-   //Will need to convert the GPS from lat/lon to ECEF,
-   //add on the ECEF leverarm values and then convert back
-   double ECEFGPS[3]={0,0,0};
-   double newgps[3]={0,0,0};
-   
-   //Convert GPS to ECEF cartesians
-   ConvertLLH2XYZ(GPSlat,GPSlon,GPShei,&ECEFGPS[0],&ECEFGPS[1],&ECEFGPS[2],1,GEODETIC,ellipsoid);
-
-   //Add on the ECEF lever arm
-   ECEFGPS[0]+=this->tempX;
-   ECEFGPS[1]+=this->tempY;
-   ECEFGPS[2]+=this->tempZ;
-
-   //Convert ECEF coordinates back to lat/lon/hei
-   ConvertXYZ2LLH(&ECEFGPS[0],&ECEFGPS[1],&ECEFGPS[2],&newgps[0],&newgps[1],&newgps[2],1,GEODETIC,ellipsoid);
-
-   //Set the new point to overwrite the old one
-   *GPSlat=newgps[0]*180/PI;
-   *GPSlon=newgps[1]*180/PI;
-   *GPShei=newgps[2];
-
+   ApplyLeverArm(&roll,&pitch,&heading,GPSlat,GPSlon,GPShei,1);
 }
 
 //-------------------------------------------------------------------------
-// Function to transform the lever arm and add it onto the GPS position
+// Function to transform the lever arm and add it onto arrays of GPS 
+// positions. This OVERWRITES the GPSlat/lon/hei values. The points are
+// done in blocks so that the temporary ECEF arrays stay in cache.
 //-------------------------------------------------------------------------
-void Leverarm::ApplyLeverArm(const double roll, const double pitch, const double heading,
-                   double* const GPSlat, double* const GPSlon, double* const GPShei)
+void Leverarm::ApplyLeverArm(const double* const roll, const double* const pitch, const double* const heading,
+                   double* const GPSlat, double* const GPSlon, double* const GPShei,const unsigned long npoints)const
 {
-   //Need to convert the lever arm from aircraft coords and add it onto
-   //the GPS position, returning the values in place
-   
-   //Convert the lever arm to ECEF
-   LeverToECEF(roll,pitch,heading,GPSlat,GPSlon);
+   const unsigned int BLOCKSIZE=256;
+   double armX[BLOCKSIZE],armY[BLOCKSIZE],armZ[BLOCKSIZE];
+   double gpsX[BLOCKSIZE],gpsY[BLOCKSIZE],gpsZ[BLOCKSIZE];
 
    //Create an ellipsoid model to use in the coordinate transformations
    Ellipsoid ellipsoid(WGS84);
 
-   //Add on to the GPS - this currently OVERWRITES the GPSlat/lon/hei values
-   AddToGPS(GPSlat,GPSlon,GPShei,&ellipsoid);
+   for(unsigned long start=0;start<npoints;start+=BLOCKSIZE)
+   {
+      const unsigned int n=static_cast<unsigned int>(std::min<unsigned long>(BLOCKSIZE,npoints-start));
+      double* const lat=GPSlat+start;
+      double* const lon=GPSlon+start;
+      double* const hei=GPShei+start;
+
+      //Convert the lever arm to ECEF
+      LeverToECEF(roll+start,pitch+start,heading+start,lat,lon,armX,armY,armZ,n);
+
+      //Convert GPS to ECEF cartesians and add on the ECEF lever arm
+      ConvertLLH2XYZ(lat,lon,hei,gpsX,gpsY,gpsZ,n,GEODETIC,&ellipsoid);
+      for(unsigned int i=0;i<n;i++)
+      {
+         gpsX[i]+=armX[i];
+         gpsY[i]+=armY[i];
+         gpsZ[i]+=armZ[i];
+      }
+
+      //Convert ECEF coordinates back to lat/lon/hei - straight into the GPS arrays
+      ConvertXYZ2LLH(gpsX,gpsY,gpsZ,lat,lon,hei,n,GEODETIC,&ellipsoid);
+      for(unsigned int i=0;i<n;i++)
+      {
+         lat[i]=lat[i]*180/PI;
+         lon[i]=lon[i]*180/PI;
+      }
+   }
 }
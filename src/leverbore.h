@@ -31,7 +31,9 @@ class Boresight
       double Heading() const {return heading;}
 
       //Function to apply the boresight values to the given attitude values
-      void ApplyBoresight(double* const roll,double* const pitch,double* const heading);
+      void ApplyBoresight(double* const roll,double* const pitch,double* const heading)const;
+      //Function to apply the boresight values to arrays of npoints attitude values
+      void ApplyBoresight(double* const roll,double* const pitch,double* const heading,const unsigned long npoints)const;
 
    private:
       double roll,pitch,heading;
@@ -50,7 +52,10 @@ class Leverarm
 
       //Function to transform the lever arm and add it onto the GPS position
       void ApplyLeverArm(const double roll, const double pitch, const double heading,
-                         double* const GPSlat, double* const GPSlon, double* const GPShei);
+                         double* const GPSlat, double* const GPSlon, double* const GPShei)const;
+      //Function to transform the lever arm and add it onto arrays of npoints GPS positions
+      void ApplyLeverArm(const double* const roll, const double* const pitch, const double* const heading,
+                         double* const GPSlat, double* const GPSlon, double* const GPShei,const unsigned long npoints)const;
 
       //Functions to return private member data
       double X() const {return x;}
@@ -58,21 +63,13 @@ class Leverarm
       double Z() const {return z;}
 
    private:
-      //Function to add the ECEF XYZ lever arm coords onto the GPS
-      void AddToGPS(double* const GPSlat, double* const GPSlon, double* const GPShei,Ellipsoid* ellipsoid);
+      //Function to rotate the aircraft leverarm (x,y,z) to ECEF for a block of points
+      void LeverToECEF(const double* const roll, const double* const pitch, const double* const heading,
+                       const double* const GPSlat, const double* const GPSlon,
+                       double* const ECEFX, double* const ECEFY, double* const ECEFZ,const unsigned int npoints)const;
 
-      //Function to rotate the aircraft leverarm (x,y,z) to ECEF (tempX,tempY.tempZ)
-      void LeverToECEF(const double roll, const double pitch, const double heading,double* const GPSlat, double* const GPSlon);
-      
       //These hold the original lever arm values - they should not be changed
       double x,y,z; 
-
-      //These hold ECEF converted lever arm values - considered temporary and private
-      double tempX,tempY,tempZ; 
-
-      //This is a blitz vector of the lever arm (for transformation functions)
-      blitz::TinyMatrix<double,3,1> arm;
-   
 };
 
 
@@ -14,6 +14,8 @@
 *
 *     Converted to static class - 6th February 2009
 *     Added the Verbose and Debug options August 2011
+*     Calls are serialised with a mutex so that the Logger can be used
+*     from worker threads
 ***************************************************************************/
 
 #include <sstream>
@@ -23,6 +25,10 @@
 #include <cstring>
 
 #include "logger.h"
+#include "os_dependant.h"
+
+//Recursive as Log/Warning etc call Flush whilst holding the lock
+static Mutex logmutex(true);
 
 //Define static variables here
 bool Logger::tofile=false;
@@ -78,6 +84,7 @@ Logger::~Logger()
 
 void Logger::Close()
 {
+   ScopedLock lock(logmutex);
    //if the file is open lets close it.
    if(logfile.is_open())
    {
@@ -90,18 +97,21 @@ void Logger::Close()
 //function to add text string to the stringstream object without outputting
 void Logger::Add(const std::string text)
 {
+   ScopedLock lock(logmutex);
    logtext<<text<<std::endl;
 }
 
 //function to add text char to the stringstream object without outputting
 void Logger::Add(const char* text)
 {
+   ScopedLock lock(logmutex);
    logtext<<text<<std::endl;
 }
 
 //function to add text string to the stringstream object with outputting
 void Logger::Log(const std::string text)
 {
+   ScopedLock lock(logmutex);
    logtext<<text<<std::endl;
    Flush();
 }
@@ -109,6 +119,7 @@ void Logger::Log(const std::string text)
 //function to add text char to the stringstream object with outputting
 void Logger::Log(const char* text)
 {
+   ScopedLock lock(logmutex);
    logtext<<text<<std::endl;
    Flush();
 }
@@ -116,6 +127,7 @@ void Logger::Log(const char* text)
 //Function that outputs information if either verbose or debug levels set
 void Logger::Verbose(const std::string text)
 {
+   ScopedLock lock(logmutex);
    if(VERBOSE>0)
    {
       logtext<<text<<std::endl;  
@@ -126,6 +138,7 @@ void Logger::Verbose(const std::string text)
 //Function that outputs information if either verbose or debug levels set
 void Logger::Verbose(const char* text)
 {
+   ScopedLock lock(logmutex);
    if(VERBOSE>0)
    {
       logtext<<text<<std::endl;  
@@ -136,6 +149,7 @@ void Logger::Verbose(const char* text)
 //Function that outputs information if only debug level set
 void Logger::Debug(const std::string text)
 {
+   ScopedLock lock(logmutex);
    if(VERBOSE>=2)
    {
       logtext<<text<<std::endl;  
@@ -146,6 +160,7 @@ void Logger::Debug(const std::string text)
 //Function that outputs information if only debug level set
 void Logger::Debug(const char* text)
 {
+   ScopedLock lock(logmutex);
    if(VERBOSE>=2)
    {
       logtext<<text<<std::endl;  
@@ -156,6 +171,7 @@ void Logger::Debug(const char* text)
 //function to output string as error text
 void Logger::Error(const std::string text)
 {
+   ScopedLock lock(logmutex);
    //Only output if text is not empty
    if(text.compare("")!=0)
    {
@@ -168,6 +184,7 @@ void Logger::Error(const std::string text)
 
 void Logger::Error(const char* text)
 {
+   ScopedLock lock(logmutex);
    //Only output if text is not empty
    if(strcmp(text,"")!=0)
    {
@@ -181,6 +198,7 @@ void Logger::Error(const char* text)
 //function to output string as warning text
 void Logger::Warning(const std::string text)
 {
+   ScopedLock lock(logmutex);
    //Only output if text is not empty
    if(text.compare("")!=0)
    {
@@ -193,6 +211,7 @@ void Logger::Warning(const std::string text)
 
 void Logger::Warning(const char* text)
 {
+   ScopedLock lock(logmutex);
    //Only output if text is not empty
    if(strcmp(text,"")!=0)
    {
@@ -206,6 +225,7 @@ void Logger::Warning(const char* text)
 //function to output a warning once only, no matter how many times called
 void Logger::WarnOnce(const char* text)
 {
+   ScopedLock lock(logmutex);
    //Only output if text is not empty
    if(strcmp(text,"")!=0)
    {
@@ -228,6 +248,7 @@ void Logger::WarnOnce(const char* text)
 //function to output a warning once only, no matter how many times called
 void Logger::WarnOnce(const std::string text)
 {
+   ScopedLock lock(logmutex);
    //Only output if text is not empty
    if(text.compare("")!=0)
    {
@@ -269,6 +290,7 @@ void Logger::WriteToLogfile()
  //function to output the string stream object (if tofile true outputs to screen + file else just to screen)
 void Logger::Flush()
 {
+   ScopedLock lock(logmutex);
    //If logging to file do this first
    if(tofile==true)
    {
@@ -24,6 +24,12 @@ MainWorker::MainWorker(std::string rawfile,std::string outfile,std::string cl,bo
    hawk=NULL;
    fenix=NULL;
    sensor=NULL;
+   numthreads=1;
+   dostatistics=false;
+   statstosidecar=false;
+   calibrator=NULL;
+   nextqueue=nextcalibrate=nextwrite=0;
+   stopthreads=false;
 
    sensor=new Specim(rawfile);
 
@@ -70,6 +76,7 @@ MainWorker::MainWorker(std::string rawfile,std::string outfile,std::string cl,bo
    tasks[insert_missing_scans]=false;
    tasks[smear_correct]=false;
    tasks[output_mask]=false;
+   tasks[output_mask_method]=false;
    tasks[flip_bands]=false;
    tasks[flip_samples]=false;
    tasks[apply_qcfailures]=false;
@@ -90,6 +97,12 @@ MainWorker::MainWorker(std::string rawfile,std::string outfile,char csensor,std:
    hawk=NULL;
    fenix=NULL;
    sensor=NULL;
+   numthreads=1;
+   dostatistics=false;
+   statstosidecar=false;
+   calibrator=NULL;
+   nextqueue=nextcalibrate=nextwrite=0;
+   stopthreads=false;
 
    if(csensor=='e')
    {
@@ -136,6 +149,9 @@ MainWorker::MainWorker(std::string rawfile,std::string outfile,char csensor,std:
 //-------------------------------------------------------------------------
 MainWorker::~MainWorker()
 {
+   //Make sure no threads are still using the calibration/sensor objects
+   StopThreads();
+
    if(eagle!=NULL)
       delete eagle;
    if(hawk!=NULL)
@@ -168,7 +184,7 @@ void MainWorker::InitialiseCalibration(std::string calfile,std::string externald
    //calculate the dark frame averages, if requested, from the optional
    //externaldarkframes filename (uses the raw file if no external file given)
    if(tasks[remove_dark_frames])
-      cal->InitialiseDarkFrames(externaldarkframes);
+      cal->InitialiseDarkFrames(externaldarkframes,numthreads);
 
    //Now set up the fodis if required
    if(tasks[calibrate_fodis])
@@ -212,6 +228,20 @@ void MainWorker::InitialiseCalibration(std::string calfile,std::string externald
       cal->ReadQCFailureFile(qcfailurefile);
    }
 
+   //Flag the bad pixels and qc failures once rather than on every line
+   cal->InitialiseMaskTemplates();
+
+   //Read in the gains here rather than on the first line so that the
+   //calibration arrays are not changed whilst lines are being calibrated
+   if(tasks[apply_gains])
+      cal->InitialiseGains();
+
+   //Check once whether the smear correction and fodis averaging can be
+   //done for this sensor rather than on every line
+   if(tasks[smear_correct])
+      tasks[smear_correct]=cal->CanSmearCorrect();
+   if(tasks[calibrate_fodis])
+      tasks[calibrate_fodis]=cal->CanAverageFodis();
 }
 
 //-------------------------------------------------------------------------
@@ -253,42 +283,283 @@ unsigned int MainWorker::GetNumCalibratedImageSamples()
 //-------------------------------------------------------------------------
 void MainWorker::DoCalibrationForLine(unsigned int line)
 {
+   if(numthreads > 1)
+   {
+      //Queue the line to be calibrated on a worker thread - it is written
+      //out in order with the other queued lines
+      QueueLine(Normal,line,cal->WhichSubSensor());
+      return;
+   }
+
+   //Calibrate using the data arrays of the current subsensor
+   Data* linedata=const_cast<Data*>(cal->pData());
+   CalibrateLine(linedata,cal->WhichSubSensor(),line);
+
+   //Write out the required datasets and clear the data in memory
+   WriteOutData(Normal,linedata,cal->WhichSubSensor());
+   cal->ClearPerlineData();
+}
+
+//-------------------------------------------------------------------------
+// Apply the calibration routines to the given line of raw data for the
+// given subsensor, storing the results in linedata. This does not change
+// the state of the mainworker or calibration objects and so can be called
+// from multiple threads with different linedata objects.
+//-------------------------------------------------------------------------
+void MainWorker::CalibrateLine(Data* const linedata,const unsigned int subsensor,const unsigned int line)
+{
+   //No bands of this subsensor are to be output
+   if(cal->SubSensor(subsensor).NumOutputBands()==0)
+      return;
+
    //Read in the line of data from the raw file
-   cal->ReadLineOfRaw(line);
+   cal->ReadLineOfRaw(linedata,subsensor,line);
 
-   //Flag the pixels for under/over flows etc
+   //Flag the pixels for under/over flows etc, remove the dark frames and
+   //apply the gains in a single pass over the data. The smear correction
+   //has to be done between removing the dark frames and applying gains.
    //Note that average dark frames have to be initialised before flagging pixels
-   cal->FlagPixels();
+   unsigned int steps=CalibrationKernel::FLAGPIXELS;
+   if(GetTask(remove_dark_frames))
+      steps|=CalibrationKernel::REMOVEDARK;
 
-   //If required then remove the average dark frame values from the image data
-   if(tasks[remove_dark_frames])
-      cal->RemoveDarkFrames();
+   //If required then smear correct the image data - only set if eagle data
+   if(GetTask(smear_correct))
+   {
+      cal->CalibratePixels(linedata,subsensor,steps);
+      cal->SmearCorrect(linedata,subsensor);
+      steps=0;
+   }
 
-   //If required then smear correct the image data - returns false if not
-   //eagle data and updates the tasks so that it is not run next time
-   if(tasks[smear_correct])
-      tasks[smear_correct]=cal->SmearCorrect();
+   //If required apply the gains to the image data
+   if(GetTask(apply_gains))
+      steps|=CalibrationKernel::APPLYGAINS;
 
-   //If required apply the gain values to the image data
-   if(tasks[apply_gains])
-      cal->ApplyGains();
+   if(steps!=0)
+      cal->CalibratePixels(linedata,subsensor,steps);
 
-   //If required average the fodis data up - returns false if not
-   //eagle data and updates the tasks so that it is not run next time
-   if(tasks[calibrate_fodis])
-      tasks[calibrate_fodis]=cal->AverageFodis();
+   //If required average the fodis data up - only set if eagle data
+   if(GetTask(calibrate_fodis))
+      cal->AverageFodis(linedata,subsensor);
+
+   //Note that flipping the data spectrally (red to blue) and/or spatially 
+   //(left to right) is done as the data are written out
+}
 
-   //If required flip the data spectraly from red to blue
-   if(tasks[flip_bands])
-      const_cast<Data*>(cal->pData())->TransformArrays(sensor->NumBands(),sensor->NumSamples(),Data::BAND);
+//-------------------------------------------------------------------------
+// Finish off any lines that are still queued for calibration on threads
+// This should be called after the last line has been passed to 
+// DoCalibrationForLine
+//-------------------------------------------------------------------------
+void MainWorker::FinishCalibration()
+{
+   if(calibrator==NULL)
+      return;
 
-   //If required flip the data spatially from left to right
-   if(tasks[flip_samples])
-      const_cast<Data*>(cal->pData())->TransformArrays(sensor->NumBands(),sensor->NumSamples(),Data::SAMPLE);
+   while(nextwrite < nextqueue)
+      WriteCalibratedLines(true);
 
-   //Write out the required datasets and clear the data in memory
-   WriteOutData(Normal);
-   cal->ClearPerlineData();
+   StopThreads();
+}
+
+//-------------------------------------------------------------------------
+// Constructor for the line slot - creates data arrays for each subsensor
+//-------------------------------------------------------------------------
+MainWorker::LineSlot::LineSlot(const Calibration* const cal)
+{
+   flag=Normal;
+   line=0;
+   subsensor=0;
+   done=false;
+   error="";
+   numsubsensors=cal->NumOfSubSensors();
+   linedata=new Data*[numsubsensors];
+   for(unsigned int i=0;i<numsubsensors;i++)
+      linedata[i]=cal->NewLineData(i);
+}
+
+//-------------------------------------------------------------------------
+// Destructor for the line slot
+//-------------------------------------------------------------------------
+MainWorker::LineSlot::~LineSlot()
+{
+   for(unsigned int i=0;i<numsubsensors;i++)
+      delete linedata[i];
+   delete[] linedata;
+}
+
+//-------------------------------------------------------------------------
+// Set up the slots and start the threads to calibrate the lines on
+//-------------------------------------------------------------------------
+void MainWorker::StartThreads()
+{
+   if(calibrator!=NULL)
+      return;
+
+   //The writers need to be set up before any line is calibrated as 
+   //this changes the subsensor of the sensor object
+   InitialiseWriters();
+
+   //Use 2 slots per thread so that threads can keep working whilst
+   //the completed lines are being written out
+   for(unsigned int i=0;i<2*numthreads;i++)
+      slots.push_back(new LineSlot(cal));
+
+   nextqueue=nextcalibrate=nextwrite=0;
+   stopthreads=false;
+
+   Logger::Log("Calibrating lines using "+ToString(numthreads)+" threads.");
+   calibrator=new LineCalibrator(this);
+   calibrator->Start(numthreads);
+}
+
+//-------------------------------------------------------------------------
+// Stop the calibration threads - any lines queued but not yet written
+// out are discarded
+//-------------------------------------------------------------------------
+void MainWorker::StopThreads()
+{
+   if(calibrator==NULL)
+      return;
+
+   queuemutex.Lock();
+   stopthreads=true;
+   linequeued.Broadcast();
+   queuemutex.Unlock();
+
+   calibrator->Join();
+   delete calibrator;
+   calibrator=NULL;
+
+   for(std::vector<LineSlot*>::iterator it=slots.begin();it!=slots.end();it++)
+      delete (*it);
+   slots.clear();
+}
+
+//-------------------------------------------------------------------------
+// Add a line to the queue for calibration/writing out. Waits for a slot
+// to become free if they are all in use.
+//-------------------------------------------------------------------------
+void MainWorker::QueueLine(OutputDataFlag flag,const unsigned int line,const unsigned int subsensor)
+{
+   StartThreads();
+
+   //Write out completed lines until there is a free slot
+   while(nextqueue-nextwrite >= slots.size())
+      WriteCalibratedLines(true);
+
+   queuemutex.Lock();
+   LineSlot* slot=slots[nextqueue % slots.size()];
+   slot->flag=flag;
+   slot->line=line;
+   slot->subsensor=subsensor;
+   slot->error="";
+   //Missing scans and corrupt lines are just written out with a constant value
+   slot->done=(flag!=Normal);
+   nextqueue++;
+   linequeued.Signal();
+   queuemutex.Unlock();
+
+   //Write out anything that is ready without waiting
+   WriteCalibratedLines(false);
+}
+
+//-------------------------------------------------------------------------
+// Write out calibrated lines in the order they were queued. If waitfornext
+// is true this waits for the next line to be calibrated, otherwise it only
+// writes lines that have already been calibrated.
+//-------------------------------------------------------------------------
+void MainWorker::WriteCalibratedLines(bool waitfornext)
+{
+   while(nextwrite < nextqueue)
+   {
+      LineSlot* slot=slots[nextwrite % slots.size()];
+
+      queuemutex.Lock();
+      if((slot->done==false)&&(waitfornext==false))
+      {
+         queuemutex.Unlock();
+         return;
+      }
+      while(slot->done==false)
+         linecalibrated.Wait(queuemutex);
+      queuemutex.Unlock();
+      waitfornext=false;
+
+      if(slot->error.compare("")!=0)
+      {
+         std::string error=slot->error;
+         StopThreads();
+         throw error;
+      }
+
+      WriteOutData(slot->flag,slot->linedata[slot->subsensor],slot->subsensor);
+      nextwrite++;
+   }
+}
+
+//-------------------------------------------------------------------------
+// Function run on each calibration thread - takes the next queued line and
+// calibrates it until told to stop
+//-------------------------------------------------------------------------
+void MainWorker::CalibrateQueuedLines()
+{
+   while(true)
+   {
+      LineSlot* slot=NULL;
+
+      queuemutex.Lock();
+      while((nextcalibrate==nextqueue)&&(stopthreads==false))
+         linequeued.Wait(queuemutex);
+      if(nextcalibrate==nextqueue)
+      {
+         //Told to stop and there is nothing left to do
+         queuemutex.Unlock();
+         return;
+      }
+      slot=slots[nextcalibrate % slots.size()];
+      nextcalibrate++;
+      queuemutex.Unlock();
+
+      //Nothing to calibrate for missing or corrupt lines
+      if(slot->flag!=Normal)
+         continue;
+
+      std::string error="";
+      try
+      {
+         Data* linedata=slot->linedata[slot->subsensor];
+         linedata->ClearPerlineArrays();
+         CalibrateLine(linedata,slot->subsensor,slot->line);
+      }
+      catch(std::string e)
+      {
+         error=e;
+      }
+      catch(const char* e)
+      {
+         error=std::string(e);
+      }
+      catch(std::exception& e)
+      {
+         error=std::string(e.what());
+      }
+      catch(BinaryReader::BRexception e)
+      {
+         error=std::string(e.what())+"\n"+e.info;
+      }
+      catch(...)
+      {
+         error="Unknown error.";
+      }
+
+      queuemutex.Lock();
+      if(error.compare("")!=0)
+         slot->error="Error calibrating raw line "+ToString(slot->line)+": "+error;
+      slot->done=true;
+      linecalibrated.Signal();
+      queuemutex.Unlock();
+   }
 }
 
 //-------------------------------------------------------------------------
@@ -320,7 +591,7 @@ void MainWorker::InitialiseWriters()
    //Create a bil writer for the main image data
    //----------------------------------------------------------------------
    Logger::Log("Will write calibrated image data to: "+strOutputFilename);
-   bwimage=new BILWriter(strOutputFilename,bwimage->uint16,GetNumCalibratedImageLines(),GetNumCalibratedImageSamples(),sensor->TotalNumBands(),'w');
+   bwimage=new BILWriter(strOutputFilename,bwimage->uint16,GetNumCalibratedImageLines(),GetNumCalibratedImageSamples(),cal->NumOutputBands(),'w');
    //Copy over some information from the raw hdr file to the calibrated hdr file
    TransferHeaderInfo(bwimage);
    //Add x and y start values to the level1 bil file - both zero based
@@ -335,10 +606,26 @@ void MainWorker::InitialiseWriters()
    bwimage->AddToHdr(";Raw data file: "+sensor->RawFilename());
    //Also add the name of the calibration file that is to be used
    bwimage->AddToHdr(";The data has been calibrated using the file: "+cal->CalibrationFile());
+   //Add the raw bands that have been output if only a subset of bands were calibrated
+   if(!cal->SelectedRawBands().empty())
+   {
+      std::string rawbands;
+      std::vector<unsigned int> selected=cal->SelectedRawBands();
+      for(std::vector<unsigned int>::const_iterator it=selected.begin();it!=selected.end();it++)
+         rawbands+=" "+ToString(*it);
+      bwimage->AddToHdr(";Only a subset of the raw bands have been calibrated. Raw bands (0 based):"+rawbands);
+   }
    //Add the wavelength units - this will need to be hard coded and assumed to be nm
    bwimage->AddToHdr("Wavelength units = nm");
    //Add the calibrated data units
    bwimage->AddToHdr("Radiance data units = "+sensor->CalibratedUnits());
+   //Keep per band statistics of the calibrated data for QA if requested - 0 is
+   //used for underflows and dropped scans so is counted separately
+   if(dostatistics)
+   {
+      bwimage->SetStatisticsIgnoreValue(0);
+      bwimage->EnableStatistics(statstosidecar);
+   }
    //----------------------------------------------------------------------
    //Create a bil writer for the fodis data if it has been requested
    //----------------------------------------------------------------------
@@ -346,7 +633,7 @@ void MainWorker::InitialiseWriters()
    {
       strOutputFilename=outputfileprefix+"_FODIS.bil";
       Logger::Log("Will write calibrated FODIS data to: "+strOutputFilename);
-      bwfodis=new BILWriter(strOutputFilename,bwfodis->uint16,GetNumCalibratedImageLines(),1,sensor->TotalNumBands(),'w');
+      bwfodis=new BILWriter(strOutputFilename,bwfodis->uint16,GetNumCalibratedImageLines(),1,cal->NumOutputBands(),'w');
       //Add some hdr information about what the data is
       bwfodis->AddToHdr(";File containing averaged per-scan radiometrically calibrated data from the fibre optic downwelling irradiance sensor.");
       //Units the data is in (fodis presumed to be non-NULL here)
@@ -360,7 +647,7 @@ void MainWorker::InitialiseWriters()
    {
       strOutputFilename=outputfileprefix+"_mask.bil";
       Logger::Log("Will write calibrated image mask data to: "+strOutputFilename);
-      bwmask=new BILWriter(strOutputFilename,bwmask->uchar8,GetNumCalibratedImageLines(),GetNumCalibratedImageSamples(),sensor->TotalNumBands(),'w');
+      bwmask=new BILWriter(strOutputFilename,bwmask->uchar8,GetNumCalibratedImageLines(),GetNumCalibratedImageSamples(),cal->NumOutputBands(),'w');
 
       //Add some information to the header file
       //Add x and y start values to the level1 bil file - both zero based
@@ -369,7 +656,7 @@ void MainWorker::InitialiseWriters()
          bwmask->AddToHdr(ammendedstartlinecomment);
       bwmask->AddToHdr("y start = "+ToString(ammendedstartline));
       bwmask->AddToHdr("dropped scans before y start = "+ToString(nummissingscanspriortostartline));
-      std::string waves=sensor->bin->FromHeader("Wavelength");
+      std::string waves=SubsetBandList(sensor->bin->FromHeader("Wavelength"));
       if(tasks[flip_bands])
       {
          waves=ReverseWavelengthOrder(waves);
@@ -396,7 +683,7 @@ void MainWorker::InitialiseWriters()
    {
       strOutputFilename=outputfileprefix+"_mask-badpixelmethod.bil";
       Logger::Log("Will write bad pixel method data to: "+strOutputFilename);
-      bwmaskmethod=new BILWriter(strOutputFilename,bwmaskmethod->uchar8,GetNumCalibratedImageLines(),GetNumCalibratedImageSamples(),sensor->TotalNumBands(),'w');
+      bwmaskmethod=new BILWriter(strOutputFilename,bwmaskmethod->uchar8,GetNumCalibratedImageLines(),GetNumCalibratedImageSamples(),cal->NumOutputBands(),'w');
 
       //Add some information to the header file
       //Add x and y start values to the level1 bil file - both zero based
@@ -405,7 +692,7 @@ void MainWorker::InitialiseWriters()
          bwmaskmethod->AddToHdr(ammendedstartlinecomment);
       bwmaskmethod->AddToHdr("y start = "+ToString(ammendedstartline));
       bwmaskmethod->AddToHdr("dropped scans before y start = "+ToString(nummissingscanspriortostartline));
-      std::string waves=sensor->bin->FromHeader("Wavelength");
+      std::string waves=SubsetBandList(sensor->bin->FromHeader("Wavelength"));
       if(tasks[flip_bands])
       {
          waves=ReverseWavelengthOrder(waves);
@@ -431,63 +718,73 @@ void MainWorker::InitialiseWriters()
 }
 
 //-------------------------------------------------------------------------
-// Function to write out data using the given file prefix
+// Function to write out data of the current subsensor using the given 
+// file prefix
 //-------------------------------------------------------------------------
 void MainWorker::WriteOutData(OutputDataFlag flag)
+{
+   if(numthreads > 1)
+   {
+      //Queue this so that it is written out in order with the calibrated lines
+      QueueLine(flag,0,cal->WhichSubSensor());
+      return;
+   }
+   WriteOutData(flag,cal->pData(),cal->WhichSubSensor());
+}
+
+//-------------------------------------------------------------------------
+// Function to write out the given line data of the given subsensor
+//-------------------------------------------------------------------------
+void MainWorker::WriteOutData(OutputDataFlag flag,const Data* const linedata,const unsigned int subsensor)
 {
    //This only needs to be called once - probably better to move it somewhere else
    InitialiseWriters();
 
+   //Only the selected bands are written if a band subset is being calibrated
+   const unsigned int nbands=cal->SubSensor(subsensor).NumOutputBands();
+   const unsigned int* const bandindex=cal->SubSensor(subsensor).OutputBands();
+   const unsigned int nsamples=cal->SubSensor(subsensor).nsamples;
+   if((flag!=Normal)&&(flag!=MissingScan)&&(flag!=CorruptData))
+      throw "Unrecognised flag in WriteOutData.";
+
+   //Nothing to write for this subsensor
+   if(nbands==0)
+      return;
+
    //For each initialised element of the data object - write it out
-   if(cal->pData()->Image()!=NULL)
+   //Each is converted and written for all bands in one go, flipping the
+   //bands and/or samples if required
+   const bool flipbands=tasks[flip_bands];
+   const bool flipsamples=tasks[flip_samples];
+   if(linedata->Image()!=NULL)
    {
-      for(unsigned int b=0;b<sensor->NumBands();b++)
-      {
-         if(flag==Normal)
-            bwimage->WriteDataToBandLineSection(&(cal->pData()->Image())[b*sensor->NumSamples()],sensor->NumSamples(),lowersample,uppersample);
-         else if((flag==MissingScan)||(flag==CorruptData))
-            bwimage->WriteBandLineWithValue(0);
-         else
-            throw "Unrecognised flag in WriteOutData - writing Image().";
-      }
+      if(flag==Normal)
+         bwimage->WriteDataToBandLinesSection(linedata->Image(),nbands,nsamples,lowersample,uppersample,flipbands,flipsamples,bandindex);
+      else
+         bwimage->WriteBandLinesWithValue(0,nbands);
    }
-   if((cal->pData()->Mask()!=NULL)&&(tasks[output_mask]))
+   if((linedata->Mask()!=NULL)&&(tasks[output_mask]))
    {
-      for(unsigned int b=0;b<sensor->NumBands();b++)
-      {
-         if(flag==Normal)
-            bwmask->WriteDataToBandLineSection(&(cal->pData()->Mask())[b*sensor->NumSamples()],sensor->NumSamples(),lowersample,uppersample);
-         else if(flag==MissingScan)
-            bwmask->WriteBandLineWithValue(sensor->DroppedScan);
-         else if(flag==CorruptData)
-            bwmask->WriteBandLineWithValue(sensor->CorruptData);
-         else
-            throw "Unrecognised flag in WriteOutData - writing Mask().";
-      }
+      if(flag==Normal)
+         bwmask->WriteDataToBandLinesSection(linedata->Mask(),nbands,nsamples,lowersample,uppersample,flipbands,flipsamples,bandindex);
+      else if(flag==MissingScan)
+         bwmask->WriteBandLinesWithValue(sensor->DroppedScan,nbands);
+      else
+         bwmask->WriteBandLinesWithValue(sensor->CorruptData,nbands);
    }
-   if((cal->pData()->BadPixMethod()!=NULL)&&(tasks[output_mask_method]))
+   if((linedata->BadPixMethod()!=NULL)&&(tasks[output_mask_method]))
    {
-      for(unsigned int b=0;b<sensor->NumBands();b++)
-         {
-         if(flag==Normal)
-            bwmaskmethod->WriteDataToBandLineSection(&(cal->pData()->BadPixMethod())[b*sensor->NumSamples()],sensor->NumSamples(),lowersample,uppersample);
-         else if((flag==MissingScan)||(flag==CorruptData))
-            bwmaskmethod->WriteBandLineWithValue(0);
-         else
-            throw "Unrecognised flag in WriteOutData - writing BadPixelMethod().";
-      }
+      if(flag==Normal)
+         bwmaskmethod->WriteDataToBandLinesSection(linedata->BadPixMethod(),nbands,nsamples,lowersample,uppersample,flipbands,flipsamples,bandindex);
+      else
+         bwmaskmethod->WriteBandLinesWithValue(0,nbands);
    }
-   if((cal->pData()->Fodis()!=NULL)&&(tasks[calibrate_fodis]))
+   if((linedata->Fodis()!=NULL)&&(tasks[calibrate_fodis]))
    {
-      for(unsigned int b=0;b<sensor->NumBands();b++)
-      {
-         if(flag==Normal)
-            bwfodis->WriteDataToBandLineSection(&(cal->pData()->Fodis())[b*sensor->NumSamples()],sensor->NumSamples(),0,0);
-         else if((flag==MissingScan)||(flag==CorruptData))
-            bwfodis->WriteBandLineWithValue(0);
-         else
-            throw "Unrecognised flag in WriteOutData - writing Fodis().";
-      }
+      if(flag==Normal)
+         bwfodis->WriteDataToBandLinesSection(linedata->Fodis(),nbands,nsamples,0,0,flipbands,flipsamples,bandindex);
+      else
+         bwfodis->WriteBandLinesWithValue(0,nbands);
    }
 }
 
@@ -526,6 +823,46 @@ std::string MainWorker::ReverseWavelengthOrder(std::string wavelengths)
    return revwavelengths; //return the reversed wavelengths
 }
 
+//-------------------------------------------------------------------------
+// Function to return only the selected raw bands of a per band hdr list
+// (e.g. wavelengths). Returns the list unchanged if all bands are used.
+//-------------------------------------------------------------------------
+std::string MainWorker::SubsetBandList(std::string list)
+{
+   const std::vector<unsigned int> selected=cal->SelectedRawBands();
+   if((selected.empty())||(list.empty()))
+      return list;
+
+   //Split the list into its items - delimitted by ; and/or ,
+   std::vector<std::string> items;
+   std::string item;
+   for(size_t i=0;i<=list.length();i++)
+   {
+      if((i==list.length())||(list[i]==';')||(list[i]==','))
+      {
+         item=TrimWhitespace(item);
+         if(!item.empty())
+            items.push_back(item);
+         item.clear();
+      }
+      else if((list[i]!='{')&&(list[i]!='}'))
+         item.push_back(list[i]);
+   }
+
+   if(items.size()!=sensor->TotalNumBands())
+   {
+      Logger::Warning("Number of items in hdr list does not match the number of raw bands - cannot subset it: "+list);
+      return list;
+   }
+
+   //Rebuild the list in the ; delimitted form
+   std::string subset="{";
+   for(std::vector<unsigned int>::const_iterator it=selected.begin();it!=selected.end();it++)
+      subset+=";"+items[*it];
+   subset+=";}";
+   return subset;
+}
+
 //-------------------------------------------------------------------------
 // Function to transfer the important parts of the raw hdr file to the 
 // calibrated hdr file.
@@ -626,7 +963,7 @@ void MainWorker::TransferHeaderInfo(BILWriter* const bw)
       bw->AddToHdr(strtransfer); //add the string to the header
    }
 
-   strtransfer=sensor->bin->FromHeader("Wavelength"); //get the wavelength array
+   strtransfer=SubsetBandList(sensor->bin->FromHeader("Wavelength")); //get the wavelength array
    if(!strtransfer.empty()) //if the string is not empty
    {
       if(tasks[flip_bands])
@@ -638,7 +975,7 @@ void MainWorker::TransferHeaderInfo(BILWriter* const bw)
       strtransfer=sensor->bin->TidyForHeader(strtransfer);
       bw->AddToHdr(strtransfer); //add the string to the header
    }
-   strtransfer=sensor->bin->FromHeader("fwhm"); //get the fwhm array
+   strtransfer=SubsetBandList(sensor->bin->FromHeader("fwhm")); //get the fwhm array
    if(!strtransfer.empty()) //if the string is not empty
    {
       if(tasks[flip_bands])
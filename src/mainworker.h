@@ -33,13 +33,16 @@ public:
    unsigned int GetNumCalibratedImageLines();
    unsigned int GetNumCalibratedImageSamples();
    void DoCalibrationForLine(unsigned int line);
+   void FinishCalibration();
 
-   bool GetTask(Task o){return tasks[o];}
+   bool GetTask(Task o)const{std::map<int,bool>::const_iterator it=tasks.find(o);return ((it!=tasks.end())&&(it->second));}
 
    void SetTask(Task t, bool b){tasks[t]=b;}
    void SetSampleLimits(unsigned int l, unsigned int u){lowersample=l;uppersample=u;}
    void SetLineLimits(unsigned int l, unsigned int u){startline=l;endline=u;}
    void SetDroppedScansPriorToStartLine(unsigned int d){nummissingscanspriortostartline=d;}
+   void SetNumThreads(unsigned int n){numthreads=(n==0) ? 1 : n;}
+   void SetStatistics(bool on,bool tosidecar){dostatistics=on;statstosidecar=tosidecar;}
    std::string TasksAsString();
 
 private:
@@ -53,9 +56,57 @@ private:
    Fenix* fenix;
 
    std::string outputfileprefix;
+   bool dostatistics,statstosidecar; //per band statistics of the calibrated image
    void InitialiseWriters();
    std::string ReverseWavelengthOrder(std::string wavelengths);
+   std::string SubsetBandList(std::string list);
    void TransferHeaderInfo(BILWriter* const bw);
+   void CalibrateLine(Data* const linedata,const unsigned int subsensor,const unsigned int line);
+   void WriteOutData(OutputDataFlag flag,const Data* const linedata,const unsigned int subsensor);
+
+   //-------------------------------------------------------------------------
+   // Calibrating lines on multiple threads. Lines are queued in a ring of
+   // slots, calibrated by the worker threads and then written out in line
+   // order by the thread that queued them. Missing/corrupt lines are queued
+   // in sequence too but are not calibrated.
+   //-------------------------------------------------------------------------
+   class LineSlot
+   {
+   public:
+      LineSlot(const Calibration* const cal);
+      ~LineSlot();
+
+      OutputDataFlag flag;
+      unsigned int line,subsensor;
+      Data** linedata; //one per subsensor as they differ in size
+      unsigned int numsubsensors;
+      bool done;
+      std::string error;
+   };
+
+   class LineCalibrator: public ThreadedTask
+   {
+   public:
+      LineCalibrator(MainWorker* const w):worker(w){}
+   protected:
+      virtual void Run(const unsigned int){worker->CalibrateQueuedLines();}
+   private:
+      MainWorker* worker;
+   };
+
+   void StartThreads();
+   void StopThreads();
+   void QueueLine(OutputDataFlag flag,const unsigned int line,const unsigned int subsensor);
+   void WriteCalibratedLines(bool waitfornext);
+   void CalibrateQueuedLines();
+
+   unsigned int numthreads;
+   LineCalibrator* calibrator;
+   std::vector<LineSlot*> slots;
+   unsigned long nextqueue,nextcalibrate,nextwrite;
+   bool stopthreads;
+   Mutex queuemutex;
+   Condition linequeued,linecalibrated;
 
    std::string commandlinetext;
 
@@ -12,6 +12,7 @@
 //Member function definitions for the navbaseclass
 //-------------------------------------------------------------------------
 
+#include <algorithm>
 #include "navbaseclass.h"
 
 
@@ -20,17 +21,20 @@
 //-------------------------------------------------------------------------
 NavBaseClass::NavBaseClass(std::string fname)
 {
-   //Create the BILreader object
-   this->binf=new BinFile(fname);
+   //Create the BILreader object - only needed whilst reading the file in
+   BinFile binf(fname);
       
    //Test BIL file has expected dimensions
    //That is: 1 samples per scan line
-   if(StringToUINT(this->binf->FromHeader("samples"))!=1)
+   if(StringToUINT(binf.FromHeader("samples"))!=1)
       throw "This BIL file does not have expected dimensions. Processed Navigation should have 1 samples per scan.";
    //And number of bands should be 7 (la,lo,hei,p,r,hea)
-   if(StringToUINT(this->binf->FromHeader("bands"))!=7)
+   if(StringToUINT(binf.FromHeader("bands"))!=NUMITEMS)
       throw "This BIL file does not have expected dimensions. Processed Navigation should have 7 bands.";
 
+   //Read the whole file in to memory
+   ReadFile(binf);
+
    //Read in the first scan line
    ReadScan(0);
 
@@ -44,12 +48,48 @@ NavBaseClass::NavBaseClass(std::string fname)
 //-------------------------------------------------------------------------
 NavBaseClass::~NavBaseClass()
 {
-   if(this->binf!=NULL)
-      delete this->binf;
 }
 
 //-------------------------------------------------------------------------
-//Function to read in a scan's data from the per-scan navigation BIL file
+//Function to read all the scans of the navigation BIL file into the 
+//per item arrays. Reads blocks of scans at a time rather than one scan
+//per read. 
+//-------------------------------------------------------------------------
+void NavBaseClass::ReadFile(BinFile& binf)
+{
+   this->nscans=StringToUINT(binf.FromHeader("lines"));
+   for(int item=0;item<NUMITEMS;item++)
+      channels[item].resize(nscans);
+
+   //Readlines returns the block band interleaved by line for BIL (and
+   //BIP - they are the same when there is 1 sample) but band sequential for BSQ
+   const bool bsq=(ToLowerCase(TrimWhitespace(binf.FromHeader("interleave")))=="bsq");
+
+   const unsigned int BLOCKSIZE=4096;
+   std::vector<double> block(BLOCKSIZE*NUMITEMS);
+   for(unsigned int first=0;first<nscans;first+=BLOCKSIZE)
+   {
+      const unsigned int n=std::min(BLOCKSIZE,nscans-first);
+      binf.Readlines((char*)&block[0],first,n);
+      for(int item=0;item<NUMITEMS;item++)
+      {
+         double* const channel=&channels[item][first];
+         if(bsq)
+         {
+            for(unsigned int s=0;s<n;s++)
+               channel[s]=block[item*n+s];
+         }
+         else
+         {
+            for(unsigned int s=0;s<n;s++)
+               channel[s]=block[s*NUMITEMS+item];
+         }
+      }
+   }
+}
+
+//-------------------------------------------------------------------------
+//Function to get a scan's data from the per-scan navigation
 //-------------------------------------------------------------------------
 int NavBaseClass::ReadScan(const unsigned int scannumber)
 {
@@ -60,21 +100,14 @@ int NavBaseClass::ReadScan(const unsigned int scannumber)
       throw "Cannot read scan from file, scan number is larger than total number of scans in file.";
    }
 
-   //navfile should be 1 sample, 7 bands, N scans
-   if( (StringToUINT(this->binf->FromHeader("bands"))!=7 )||(StringToUINT(this->binf->FromHeader("samples"))!=1))
-      throw "Processed Navigation BIL file should have 7 bands and 1 sample. Failed to read scan.";
-
-   //Read in the 7 bands of data for the given scan number
-   double tmp[7]={0};
-   this->binf->Readline((char*)tmp,scannumber);
    //Store the data in the 'proper' variables
-   this->time=tmp[0];
-   this->lat=tmp[1];
-   this->lon=tmp[2];
-   this->hei=tmp[3];
-   this->roll=tmp[4];
-   this->pitch=tmp[5];
-   this->heading=tmp[6];
+   this->time=channels[TIME][scannumber];
+   this->lat=channels[LAT][scannumber];
+   this->lon=channels[LON][scannumber];
+   this->hei=channels[HEI][scannumber];
+   this->roll=channels[ROLL][scannumber];
+   this->pitch=channels[PITCH][scannumber];
+   this->heading=channels[HEADING][scannumber];
    //set the id of the scan that has been read in
    this->scanid=scannumber;
    //return the error status
@@ -103,30 +136,32 @@ const void NavBaseClass::FindLimits(unsigned int lowerscan,unsigned int uppersca
    this->minlat=this->minlon=this->minhei=this->minroll=9999;
    this->maxlat=this->maxlon=this->maxhei=this->maxroll=-9999;
 
-   //Scan through the nav file and update min/max accordingly
+   //Scan through the nav data and update min/max accordingly
+   const double* lats=GetChannel(LAT);
+   const double* lons=GetChannel(LON);
+   const double* heis=GetChannel(HEI);
+   const double* rolls=GetChannel(ROLL);
    for(unsigned int i=lowerscan;i<upperscan;i++)
    {
-      //Read in the scan line
-      this->ReadScan(i);
       //Check values for latitude
-      if(this->lat > this->maxlat)
-         this->maxlat=this->lat;
-      if(this->lat < this->minlat)
-         this->minlat=this->lat;
+      if(lats[i] > this->maxlat)
+         this->maxlat=lats[i];
+      if(lats[i] < this->minlat)
+         this->minlat=lats[i];
       //Check values for longitude
-      if(this->lon > this->maxlon)
-         this->maxlon=this->lon;
-      if(this->lon < this->minlon)
-         this->minlon=this->lon;
+      if(lons[i] > this->maxlon)
+         this->maxlon=lons[i];
+      if(lons[i] < this->minlon)
+         this->minlon=lons[i];
       //Check values for height
-      if(this->hei > this->maxhei)
-         this->maxhei=this->hei;
-      if(this->hei < this->minhei)
-         this->minhei=this->hei;
+      if(heis[i] > this->maxhei)
+         this->maxhei=heis[i];
+      if(heis[i] < this->minhei)
+         this->minhei=heis[i];
       //Check values for roll
-      if(this->roll > this->maxroll)
-         this->maxroll=this->roll;
-      if(this->roll < this->minroll)
-         this->minroll=this->roll;
+      if(rolls[i] > this->maxroll)
+         this->maxroll=rolls[i];
+      if(rolls[i] < this->minroll)
+         this->minroll=rolls[i];
    }
 }
@@ -19,6 +19,7 @@
 #define NAVBASECLASS_H
 
 #include <string>
+#include <vector>
 #include "binfile.h"
 #include "commonfunctions.h"
 
@@ -30,6 +31,11 @@ class NavBaseClass
 
       int ReadScan(const unsigned int scannumber);//function to read info for given scan
 
+      //The items stored for each scan - in the order of the bands of the nav file
+      enum NavItem {TIME,LAT,LON,HEI,ROLL,PITCH,HEADING,NUMITEMS};
+      //Bulk access to one item for all the scans in the file
+      const double* GetChannel(const NavItem item)const{return &channels[item][0];}
+
       //Following are functions to access private/protected member data
       double Time()const{return time;}
       double Lat()const{return lat;}
@@ -53,9 +59,8 @@ class NavBaseClass
       const void FindLimits();
       const void FindLimits(unsigned int lowerscan,unsigned int upperscan);
 
-      //Functions to access member data from BIL - if too many then just make bil public
       //This function returns the total number of scans in the file
-      unsigned int TotalScans() const {return StringToUINT(binf->FromHeader("lines"));}
+      unsigned int TotalScans() const {return nscans;}
 
    protected:
       //Data variables
@@ -65,7 +70,12 @@ class NavBaseClass
       //Min/Max values of the nav file
       double maxlat,maxlon,maxhei,maxroll,minlat,minlon,minhei,minroll;
 
-      BinFile* binf; //To read in the per-scan line navigation from Binary (BIL) file
+      //The per-scan line navigation read in from the Binary (BIL) file, one array per item
+      std::vector<double> channels[NUMITEMS];
+      unsigned int nscans;
+
+   private:
+      void ReadFile(BinFile& binf);
 
 };
 
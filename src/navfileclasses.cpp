@@ -9,6 +9,10 @@
 //-------------------------------------------------------------------------
 
 #include "navfileclasses.h"
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <cstdio>
 
 
 //-------------------------------------------------------------------------
@@ -16,10 +20,10 @@
 //-------------------------------------------------------------------------
 SBETData::SBETData(const std::string filename)
 {
-   //Get the number of entries from the file somehow,
-   //and set up the navdata array
+   //Get the number of records in the file - the navdata array is set up
+   //by the Reader once it is known which records are to be loaded
    //Use file size and fact record = 17*8 =136 bytes
-   unsigned long numentries=0;
+   numrecords=0;
 
    std::ifstream fin;
    fin.open(filename.c_str(),std::ios::binary);
@@ -39,11 +43,9 @@ SBETData::SBETData(const std::string filename)
       }
       else
       {
-         numentries=length / sizeofrecord;
+         numrecords=length / sizeofrecord;
       }
    }
-   //Create array of nav data lines
-   navcollection=new NavDataCollection(numentries);
 
    //Copy the filename over
    this->filename=filename;
@@ -62,49 +64,68 @@ void SBETData::Reader()
 
    //We will only keep the Time, Lat, Lon, Alt, roll, pitch, heading for now
 
-   //Test that numentries is not 0
-   if(this->GetNumEntries() == 0)
+   //Test that numrecords is not 0
+   if(numrecords == 0)
       throw "Trying to read data into 0 sized arrays in SBETData::Reader()";
 
-   std::ifstream fin;
-   fin.open(filename.c_str(),std::ios::binary);
-   if(!fin.is_open())
+   filein.open(filename.c_str(),std::ios::binary);
+   if(!filein.is_open())
    {
       throw "Cannot open SBET "+filename+" in SBETData::Reader()";
    }
    else
    {
-      //Create a buffer to read data into
-      char buffer[sizeofrecord];
-      //pointer to derefernce buffer as doubles
-      double* dbuffer=(double*)buffer;
-      for(unsigned long record=0;record<GetNumEntries();record++)
+      //Only load the records needed for the time window if one has been set
+      unsigned long firstrecord=0,lastrecord=numrecords-1;
+      if(usetimewindow)
+         FindWindowRecords(numrecords,firstrecord,lastrecord);
+      filein.clear();
+      filein.seekg((uint64_t)firstrecord*sizeofrecord,std::ios::beg);
+
+      //Create array of nav data lines
+      navcollection=new NavDataCollection(lastrecord-firstrecord+1);
+
+      //Read the file a block of records at a time and decode each block 
+      //straight into the navdata array rather than a read per record
+      std::vector<double> buffer((uint64_t)recordsperblock*numberofitems);
+      double* const time=navcollection->GetChannel(NavDataCollection::TIME);
+      double* const lat=navcollection->GetChannel(NavDataCollection::LAT);
+      double* const lon=navcollection->GetChannel(NavDataCollection::LON);
+      double* const hei=navcollection->GetChannel(NavDataCollection::HEI);
+      double* const roll=navcollection->GetChannel(NavDataCollection::ROLL);
+      double* const pitch=navcollection->GetChannel(NavDataCollection::PITCH);
+      double* const heading=navcollection->GetChannel(NavDataCollection::HEADING);
+      for(unsigned long first=0;first<GetNumEntries();first+=recordsperblock)
       {
-         //read in a record into the buffer
-         fin.read((char*)buffer,this->sizeofrecord);
-         //Fill in the navdata array
-         navcollection->SetValues(record,NavDataCollection::TIME,dbuffer[0]);
-         navcollection->SetValues(record,NavDataCollection::LAT,dbuffer[1]*180/PI);
-         navcollection->SetValues(record,NavDataCollection::LON,dbuffer[2]*180/PI);
-         navcollection->SetValues(record,NavDataCollection::HEI,dbuffer[3]);
-         navcollection->SetValues(record,NavDataCollection::ROLL,dbuffer[7]*180/PI);
-         navcollection->SetValues(record,NavDataCollection::PITCH,dbuffer[8]*180/PI);
-         if(dbuffer[9]<0)
-            navcollection->SetValues(record,NavDataCollection::HEADING,(dbuffer[9]*180/PI+360-dbuffer[10]*180/PI)); //Heading plus 360 minus wander angle
-         else
-            navcollection->SetValues(record,NavDataCollection::HEADING,(dbuffer[9]*180/PI-dbuffer[10]*180/PI));//Heading minus wander angle
-
+         const unsigned long nrecords=std::min<unsigned long>(recordsperblock,GetNumEntries()-first);
+         filein.read(reinterpret_cast<char*>(&buffer[0]),nrecords*this->sizeofrecord);
+         if(filein.gcount()!=static_cast<std::streamsize>(nrecords*this->sizeofrecord))
+            throw "SBET Reader failed to read records "+ToString(firstrecord+first)+" to "+ToString(firstrecord+first+nrecords-1)+" from "+filename;
 
+         for(unsigned long r=0;r<nrecords;r++)
+         {
+            const double* const dbuffer=&buffer[r*numberofitems];
+            const unsigned long e=first+r;
+            //Fill in the navdata arrays
+            time[e]=dbuffer[0];
+            lat[e]=dbuffer[1]*180/PI;
+            lon[e]=dbuffer[2]*180/PI;
+            hei[e]=dbuffer[3];
+            roll[e]=dbuffer[7]*180/PI;
+            pitch[e]=dbuffer[8]*180/PI;
+            if(dbuffer[9]<0)
+               heading[e]=(dbuffer[9]*180/PI+360-dbuffer[10]*180/PI); //Heading plus 360 minus wander angle
+            else
+               heading[e]=(dbuffer[9]*180/PI-dbuffer[10]*180/PI);//Heading minus wander angle
+         }
       }
       //Test file position
-      unsigned long fileat=fin.tellg(); //get current pos
-      fin.seekg(0,std::ios::end);
-      unsigned long fileend=fin.tellg(); //get end of file pos
-      if(fileat!=fileend)
-         throw "SBET Reader has finished reading before the end of the file. Suggests numentries is wrong: "+ToString(this->GetNumEntries());
+      uint64_t fileat=filein.tellg(); //get current pos
+      if(fileat!=(uint64_t)(lastrecord+1)*sizeofrecord)
+         throw "SBET Reader has finished reading at the wrong position of the file. Suggests numentries is wrong: "+ToString(this->GetNumEntries());
       
       //Close the file
-      fin.close();
+      filein.close();
    }
 
    //Check the plausibility of the file
@@ -114,6 +135,20 @@ void SBETData::Reader()
    Logger::Log(GetInformation());
 }
 
+//-------------------------------------------------------------------------
+// Function to return the time of the given record of the SBET file
+//-------------------------------------------------------------------------
+double SBETData::RecordTime(const unsigned long record)
+{
+   double time=0;
+   filein.clear();
+   filein.seekg((uint64_t)record*sizeofrecord,std::ios::beg);
+   filein.read(reinterpret_cast<char*>(&time),sizeof(double));
+   if(filein.gcount()!=sizeof(double))
+      throw "Failed to read the time of SBET record "+ToString(record)+" from "+filename;
+   return time;
+}
+
 //-------------------------------------------------------------------------
 // Specim NAV file methods
 //-------------------------------------------------------------------------
@@ -225,7 +260,7 @@ SOLData::SOLData(const std::string filename)
    SOLRecord sol_record;
    completerecordsize=sol_record.GetSize();
    //int completerecordsize=sizeofheader+sizeofrecord;
-   uint64_t numentries=0;
+   numrecords=0;
 
    std::ifstream fin;
    fin.open(filename.c_str(),std::ios::binary);
@@ -245,11 +280,10 @@ SOLData::SOLData(const std::string filename)
       }
       else
       {
-         numentries=length / completerecordsize;
+         numrecords=length / completerecordsize;
       }
    }
-   //Create array of nav data lines
-   navcollection=new NavDataCollection(numentries);
+   //The array of nav data lines is created by the Reader
 
    //Copy the filename over
    this->filename=filename;
@@ -261,24 +295,32 @@ SOLData::SOLData(const std::string filename)
 //-------------------------------------------------------------------------
 void SOLData::Reader()
 {
-   //Test that numentries is not 0
-   if(this->GetNumEntries() == 0)
+   //Test that numrecords is not 0
+   if(numrecords == 0)
       throw "Trying to read data into 0 sized arrays in SOLData::Reader()";
 
    //int completerecordsize=sizeofheader+sizeofrecord;
-   std::ifstream fin;
-   fin.open(filename.c_str(),std::ios::binary);
-   if(!fin.is_open())
+   filein.open(filename.c_str(),std::ios::binary);
+   if(!filein.is_open())
    {
       throw "Cannot open SOL "+filename+" in SOLData::Reader()";
    }
    else
    {
-   
+      //Only load the records needed for the time window if one has been set
+      unsigned long firstrecord=0,lastrecord=numrecords-1;
+      if(usetimewindow)
+         FindWindowRecords(numrecords,firstrecord,lastrecord);
+      filein.clear();
+      filein.seekg((uint64_t)firstrecord*completerecordsize,std::ios::beg);
+
+      //Create array of nav data lines
+      navcollection=new NavDataCollection(lastrecord-firstrecord+1);
+
       for(unsigned long recordid=0;recordid<GetNumEntries();recordid++)
       {
          //read in a record into the buffer
-         this->record=new SOLRecord(fin);
+         this->record=new SOLRecord(filein);
          //Now only extract the parts we are interested in and throw away the rest
          
          navcollection->SetValues(recordid,NavDataCollection::TIME,this->record->Time());
@@ -292,7 +334,7 @@ void SOLData::Reader()
          else
             navcollection->SetValues(recordid,NavDataCollection::HEADING,this->record->Heading()*180/PI);//Heading
 
-         //std::cout<<recordid<<" "<<fin.tellg()<<" "<<this->record->Latitude()*180/PI<<" "<<this->record->Longitude()*180/PI<<" "<<this->record->Height()<<" "<<this->record->Roll()<<" "<<this->record->Pitch()<<" "<<this->record->Heading()<<std::endl;
+         //std::cout<<recordid<<" "<<filein.tellg()<<" "<<this->record->Latitude()*180/PI<<" "<<this->record->Longitude()*180/PI<<" "<<this->record->Height()<<" "<<this->record->Roll()<<" "<<this->record->Pitch()<<" "<<this->record->Heading()<<std::endl;
 
          //destroy this record - no longer required
          delete this->record;
@@ -301,14 +343,12 @@ void SOLData::Reader()
       }
 
       //Test file position
-      std::streampos fileat=fin.tellg(); //get current pos
-      fin.seekg(0,std::ios::end);
-      std::streampos fileend=fin.tellg(); //get end of file pos
-      if(fileat!=fileend)
-         throw "SOL Reader has finished reading before the end of the file. Suggests numentries is wrong: "+ToString(this->GetNumEntries());
+      uint64_t fileat=filein.tellg(); //get current pos
+      if(fileat!=(uint64_t)(lastrecord+1)*completerecordsize)
+         throw "SOL Reader has finished reading at the wrong position of the file. Suggests numentries is wrong: "+ToString(this->GetNumEntries());
       
       //Close the file
-      fin.close();
+      filein.close();
    }
 
    //Check the plausibility of the file
@@ -318,6 +358,168 @@ void SOLData::Reader()
    Logger::Log(GetInformation());
 }
 
+//-------------------------------------------------------------------------
+// Function to return the (GPS) time of the given record of the SOL file
+//-------------------------------------------------------------------------
+double SOLData::RecordTime(const unsigned long record)
+{
+   filein.clear();
+   filein.seekg((uint64_t)record*completerecordsize,std::ios::beg);
+   SOLRecord sol_record(filein);
+   return sol_record.Time();
+}
+
+//-------------------------------------------------------------------------
+// Navigation cache file identifier and the order the channels are stored in
+//-------------------------------------------------------------------------
+const char NavCacheData::identifier[8]={'A','P','L','N','A','V','C','1'};
+const NavDataCollection::NavDataItem NavCacheData::channelitems[NavCacheData::numberofchannels]={NavDataCollection::TIME,
+   NavDataCollection::LAT,NavDataCollection::LON,NavDataCollection::HEI,NavDataCollection::ROLL,NavDataCollection::PITCH,
+   NavDataCollection::HEADING};
+
+//-------------------------------------------------------------------------
+// Constructor for the navigation cache - maps the file and checks it
+//-------------------------------------------------------------------------
+NavCacheData::NavCacheData(const std::string filename)
+{
+   cache=new MappedFile(filename);
+   numrecords=0;
+   if((cache->Size() < sizeofheader)||(memcmp(cache->Data(),identifier,sizeof(identifier))!=0))
+   {
+      delete cache;
+      throw "File does not appear to be an APL navigation cache: "+filename;
+   }
+   uint64_t nrecords=0;
+   memcpy(&nrecords,cache->Data()+sizeof(identifier)+2*sizeof(uint64_t),sizeof(nrecords));
+   if(cache->Size()!=sizeofheader+nrecords*numberofchannels*sizeof(double))
+   {
+      delete cache;
+      throw "Navigation cache file may be corrupt - size does not match the number of records: "+filename;
+   }
+   numrecords=nrecords;
+   //The header is a multiple of 8 bytes so the channels are aligned in the mapping
+   for(unsigned int c=0;c<numberofchannels;c++)
+      channel[c]=reinterpret_cast<const double*>(cache->Data()+sizeofheader)+(uint64_t)c*numrecords;
+
+   //Copy the filename over
+   this->filename=filename;
+}
+
+NavCacheData::~NavCacheData()
+{
+   delete cache;
+}
+
+//-------------------------------------------------------------------------
+// Function to copy the records of the time window out of the cache
+//-------------------------------------------------------------------------
+void NavCacheData::Reader()
+{
+   //Test that numrecords is not 0
+   if(numrecords == 0)
+      throw "Trying to read data into 0 sized arrays in NavCacheData::Reader()";
+
+   //Only load the records needed for the time window if one has been set
+   unsigned long firstrecord=0,lastrecord=numrecords-1;
+   if(usetimewindow)
+      FindWindowRecords(numrecords,firstrecord,lastrecord);
+
+   navcollection=new NavDataCollection(lastrecord-firstrecord+1);
+   for(unsigned int c=0;c<numberofchannels;c++)
+      memcpy(navcollection->GetChannel(channelitems[c]),channel[c]+firstrecord,GetNumEntries()*sizeof(double));
+
+   //Check the plausibility of the data
+   CheckPlausibility();
+
+   //Output some information on the file
+   Logger::Log(GetInformation());
+}
+
+//-------------------------------------------------------------------------
+// Function to test if the cache file exists and was made from the source
+// file with its current size and modification time
+//-------------------------------------------------------------------------
+bool NavCacheData::IsCacheOf(const std::string cachefilename,const std::string sourcefilename)
+{
+   FileStatus source(sourcefilename);
+   if((!source.Exists())||(!FileStatus(cachefilename).Exists()))
+      return false;
+
+   std::ifstream fin;
+   fin.open(cachefilename.c_str(),std::ios::binary);
+   if(!fin.is_open())
+      return false;
+   char id[sizeof(identifier)]={0};
+   uint64_t sourcesize=0;
+   int64_t sourcetime=0;
+   uint64_t nrecords=0;
+   fin.read(id,sizeof(id));
+   fin.read(reinterpret_cast<char*>(&sourcesize),sizeof(sourcesize));
+   fin.read(reinterpret_cast<char*>(&sourcetime),sizeof(sourcetime));
+   fin.read(reinterpret_cast<char*>(&nrecords),sizeof(nrecords));
+   if(!fin)
+      return false;
+
+   //A truncated cache (e.g. from an interrupted write) is treated as out of date
+   if(FileStatus(cachefilename).Size()!=sizeofheader+nrecords*numberofchannels*sizeof(double))
+      return false;
+
+   return ((memcmp(id,identifier,sizeof(identifier))==0)&&(sourcesize==source.Size())&&(sourcetime==source.ModificationTime()));
+}
+
+//-------------------------------------------------------------------------
+// Function to write the navigation that has been read in from the source
+// file to a cache. It is written to a temporary file (unique to this
+// process so concurrent runs do not write the same file) and renamed so
+// that a partial cache is never left behind.
+//-------------------------------------------------------------------------
+void NavCacheData::Write(const std::string cachefilename,const std::string sourcefilename,DataHandler* const source)
+{
+   FileStatus status(sourcefilename);
+   if(!status.Exists())
+      throw "Cannot get the size and modification time of "+sourcefilename+" to write navigation cache.";
+
+   const std::string tempfilename=cachefilename+"."+ToString(ComputerInfo::ProcessID())+".tmp";
+   std::ofstream fout;
+   fout.open(tempfilename.c_str(),std::ios::binary);
+   if(!fout.is_open())
+      throw "Cannot open navigation cache file for writing: "+tempfilename;
+
+   //Write the header - padded out to sizeofheader
+   const uint64_t sourcesize=status.Size();
+   const int64_t sourcetime=status.ModificationTime();
+   const uint64_t nrecords=source->GetNumEntries();
+   char header[sizeofheader]={0};
+   memcpy(header,identifier,sizeof(identifier));
+   memcpy(header+sizeof(identifier),&sourcesize,sizeof(sourcesize));
+   memcpy(header+sizeof(identifier)+sizeof(uint64_t),&sourcetime,sizeof(sourcetime));
+   memcpy(header+sizeof(identifier)+2*sizeof(uint64_t),&nrecords,sizeof(nrecords));
+   fout.write(header,sizeofheader);
+
+   //Then each channel in turn
+   for(unsigned int c=0;c<numberofchannels;c++)
+      fout.write(reinterpret_cast<const char*>(source->GetChannel(channelitems[c])),nrecords*sizeof(double));
+
+   fout.close();
+   if(!fout)
+   {
+      std::remove(tempfilename.c_str());
+      throw "Failed to write navigation cache file: "+tempfilename;
+   }
+
+   //Rename over any old cache - this is atomic on POSIX but windows will not
+   //rename over an existing file so the old cache needs removing first
+   #ifdef _W32
+      std::remove(cachefilename.c_str());
+   #endif
+   if(std::rename(tempfilename.c_str(),cachefilename.c_str())!=0)
+   {
+      std::remove(tempfilename.c_str());
+      throw "Failed to rename navigation cache file "+tempfilename+" to "+cachefilename;
+   }
+   Logger::Log("Written navigation cache file: "+cachefilename);
+}
+
 //-------------------------------------------------------------------------
 // Function to read in a SOL file record data from the current position 
 // in the stream - no checking on whether it is a valid record
@@ -415,6 +617,244 @@ void SOLRecordHeader::Read(std::ifstream &fin)
    }
 }
 
+//-------------------------------------------------------------------------
+// Constructor for the buffered text line reader - opens the file
+//-------------------------------------------------------------------------
+TextLineReader::TextLineReader(const std::string filename)
+{
+   start=0;
+   end=0;
+   endoffile=false;
+   fin.open(filename.c_str(),std::ios::binary);
+   if(fin.is_open())
+      buffer.resize(initialbuffersize+1);
+}
+
+//-------------------------------------------------------------------------
+// Get the next line from the file - returns false when there are no more
+// lines. The line is null terminated and left in the buffer.
+//-------------------------------------------------------------------------
+bool TextLineReader::NextLine(char*& line,size_t& length)
+{
+   if(!fin.is_open())
+      return false;
+
+   while(true)
+   {
+      char* first=&buffer[0]+start;
+      char* newline=static_cast<char*>(memchr(first,'\n',end-start));
+      if((newline!=NULL)||((endoffile==true)&&(end>start)))
+      {
+         //A complete line (or the last line of the file without a newline)
+         if(newline==NULL)
+            newline=&buffer[0]+end;
+         *newline='\0';
+         length=newline-first;
+         start+=length+1;
+         if(start>end)
+            start=end;
+         if((length>0)&&(first[length-1]=='\r'))
+            first[--length]='\0';
+         line=first;
+         return true;
+      }
+      else if(endoffile==true)
+      {
+         return false;
+      }
+
+      //Move the partial line to the front of the buffer and read some more,
+      //growing the buffer if a single line fills it
+      if(start>0)
+      {
+         memmove(&buffer[0],&buffer[start],end-start);
+         end-=start;
+         start=0;
+      }
+      size_t capacity=buffer.size()-1;
+      if(end==capacity)
+      {
+         buffer.resize(2*capacity+1);
+         capacity=buffer.size()-1;
+      }
+      fin.read(&buffer[end],capacity-end);
+      end+=fin.gcount();
+      if(!fin)
+         endoffile=true;
+   }
+}
+
+//-------------------------------------------------------------------------
+// Split the line into items on the delimiter, storing pointers into line
+//-------------------------------------------------------------------------
+NMEASentence::NMEASentence(const char* const line,const size_t length,const char delim)
+{
+   const char* const lineend=line+length;
+   const char* b=line;
+   nitems=0;
+   while(true)
+   {
+      const char* e=static_cast<const char*>(memchr(b,delim,lineend-b));
+      if(e==NULL)
+         e=lineend;
+      if(nitems<maxitems)
+      {
+         itembegin[nitems]=b;
+         itemend[nitems]=e;
+      }
+      nitems++;
+      if(e==lineend)
+         break;
+      b=e+1;
+   }
+}
+
+//-------------------------------------------------------------------------
+// Get the start and end of the item - items that do not exist are empty
+//-------------------------------------------------------------------------
+void NMEASentence::GetItem(const unsigned int item,const char*& b,const char*& e)const
+{
+   if((item<nitems)&&(item<maxitems))
+   {
+      b=itembegin[item];
+      e=itemend[item];
+   }
+   else
+   {
+      b="";
+      e=b;
+   }
+}
+
+//-------------------------------------------------------------------------
+// Test if the item is equal to the given string
+//-------------------------------------------------------------------------
+bool NMEASentence::ItemIs(const unsigned int item,const char* const str)const
+{
+   const char *b=NULL,*e=NULL;
+   GetItem(item,b,e);
+   size_t len=strlen(str);
+   return ((size_t)(e-b)==len)&&(memcmp(b,str,len)==0);
+}
+
+//-------------------------------------------------------------------------
+// Return a copy of the item - for messages rather than parsing
+//-------------------------------------------------------------------------
+std::string NMEASentence::Item(const unsigned int item)const
+{
+   const char *b=NULL,*e=NULL;
+   GetItem(item,b,e);
+   return std::string(b,e);
+}
+
+//-------------------------------------------------------------------------
+// Convert the item to a double - returns 0 if no number could be read
+// and the leading number if followed by other characters (e.g. checksum)
+//-------------------------------------------------------------------------
+double NMEASentence::ItemToDouble(const unsigned int item)const
+{
+   const char *b=NULL,*e=NULL;
+   GetItem(item,b,e);
+   //Copy to a null terminated stack buffer so strtod cannot run past the item
+   char number[64];
+   size_t len=std::min((size_t)(e-b),sizeof(number)-1);
+   memcpy(number,b,len);
+   number[len]='\0';
+   char* numberend=NULL;
+   double val=strtod(number,&numberend);
+   if(numberend==number)
+      return 0;
+   return val;
+}
+
+//-------------------------------------------------------------------------
+// Move b and e inwards past any leading and trailing whitespace
+//-------------------------------------------------------------------------
+static void TrimItemWhitespace(const char*& b,const char*& e)
+{
+   while((b<e)&&(isspace((unsigned char)*b)))
+      b++;
+   while((e>b)&&(isspace((unsigned char)*(e-1))))
+      e--;
+}
+
+//-------------------------------------------------------------------------
+// Test if the characters are all digits (allowing a leading minus sign if
+// allownegative is true)
+//-------------------------------------------------------------------------
+static bool IsInteger(const char* b,const char* e,const bool allownegative)
+{
+   if((allownegative==true)&&(b<e)&&(*b=='-'))
+      b++;
+   for(;b<e;b++)
+   {
+      if((*b<'0')||(*b>'9'))
+         return false;
+   }
+   return true;
+}
+
+//-------------------------------------------------------------------------
+// Convert the item to an unsigned int - returns 0 if it is not only digits
+//-------------------------------------------------------------------------
+unsigned int NMEASentence::ItemToUINT(const unsigned int item,const bool stripchecksum)const
+{
+   const char *b=NULL,*e=NULL;
+   GetItem(item,b,e);
+   if(stripchecksum==true)
+   {
+      const char* checksum=static_cast<const char*>(memchr(b,'*',e-b));
+      if(checksum!=NULL)
+         e=checksum;
+   }
+   TrimItemWhitespace(b,e);
+   if(!IsInteger(b,e,false))
+      return 0;
+   unsigned int val=0;
+   for(;b<e;b++)
+      val=val*10+(*b-'0');
+   return val;
+}
+
+//-------------------------------------------------------------------------
+// Convert count characters of the item from offset to an int - returns 0
+// if they are not only digits (with an optional leading minus sign)
+//-------------------------------------------------------------------------
+int NMEASentence::ItemToINT(const unsigned int item,const size_t offset,const size_t count)const
+{
+   const char *b=NULL,*e=NULL;
+   GetItem(item,b,e);
+   if(offset>(size_t)(e-b))
+      return 0;
+   b+=offset;
+   if(count<(size_t)(e-b))
+      e=b+count;
+   TrimItemWhitespace(b,e);
+   if(!IsInteger(b,e,true))
+      return 0;
+   bool negative=false;
+   if((b<e)&&(*b=='-'))
+   {
+      negative=true;
+      b++;
+   }
+   int val=0;
+   for(;b<e;b++)
+      val=val*10+(*b-'0');
+   return negative ? -val : val;
+}
+
+//-------------------------------------------------------------------------
+// Test the item is an integer (digits with an optional leading minus sign)
+//-------------------------------------------------------------------------
+bool NMEASentence::ItemIsNumbersOnly(const unsigned int item)const
+{
+   const char *b=NULL,*e=NULL;
+   GetItem(item,b,e);
+   //CheckNumbersOnly does not ignore whitespace
+   return IsInteger(b,e,true);
+}
+
 //-------------------------------------------------------------------------
 // Constructor for NMEA style specim nav file class
 //-------------------------------------------------------------------------
@@ -446,29 +886,27 @@ NMEASpecimNavData::NMEASpecimNavData(std::string filename)
 //-------------------------------------------------------------------------
 unsigned long NMEASpecimNavData::ScanNumSyncs()
 {
-   std::string line;
+   char* line=NULL;
+   size_t length=0;
    unsigned long syncs=0;
-   std::ifstream fin;
-   fin.open(filename.c_str());
-   if(!fin.is_open())
+   TextLineReader fin(filename);
+   if(!fin.IsOpen())
    {
       throw "Cannot open .nav "+filename+" in NMEASpecimNavData::Reader()";
    }
    else
    {   
-      while(!fin.eof())
+      while(fin.NextLine(line,length))
       {
-         getline(fin,line);
-         if(GetItemFromString(line,0,delim).compare("$SPTSMP2")==0)
+         NMEASentence sentence(line,length,delim);
+         if(sentence.ItemIs(0,"$SPTSMP2"))
          {
-            SPTSMP2 s(line,delim);
+            SPTSMP2 s(sentence);
             //Only use good messages
             if(s.Bad() == false)
                syncs++;
          }
       }
-      fin.close();
-      fin.clear();
    }
    return syncs;
 }
@@ -479,29 +917,27 @@ unsigned long NMEASpecimNavData::ScanNumSyncs()
 //-------------------------------------------------------------------------
 unsigned long NMEASpecimNavData::GetNumRecords()
 {
-   std::string line;
+   char* line=NULL;
+   size_t length=0;
    unsigned long records=0;
-   std::ifstream fin;
-   fin.open(filename.c_str());
-   if(!fin.is_open())
+   TextLineReader fin(filename);
+   if(!fin.IsOpen())
    {
       throw "Cannot open .nav "+filename+" in NMEASpecimNavData::Reader()";
    }
    else
    {   
-      while(!fin.eof())
+      while(fin.NextLine(line,length))
       {
-         getline(fin,line);
-         if(GetItemFromString(line,0,delim).compare("$GPGGA")==0)
+         NMEASentence sentence(line,length,delim);
+         if(sentence.ItemIs(0,"$GPGGA"))
          {
-            GPGGA g(line,delim);
+            GPGGA g(sentence);
             //Only use good messages
             if(g.Bad() == false)
                records++;
          }
       }
-      fin.close();
-      fin.clear();
    }
    return records;
 }
@@ -512,22 +948,22 @@ unsigned long NMEASpecimNavData::GetNumRecords()
 //-------------------------------------------------------------------------
 unsigned int NMEASpecimNavData::GetFirstDayOfWeekSecs()
 {
-   std::string line;
+   char* line=NULL;
+   size_t length=0;
    unsigned int secs=0;
-   std::ifstream fin;
-   fin.open(filename.c_str());
-   if(!fin.is_open())
+   TextLineReader fin(filename);
+   if(!fin.IsOpen())
    {
       throw "Cannot open .nav "+filename+" in NMEASpecimNavData::Reader()";
    }
    else
    {   
-      while(!fin.eof())
+      while(fin.NextLine(line,length))
       {
-         getline(fin,line);
-         if(GetItemFromString(line,0,delim).compare("$GPZDA")==0)
+         NMEASentence sentence(line,length,delim);
+         if(sentence.ItemIs(0,"$GPZDA"))
          {
-            GPZDA g(line,delim);
+            GPZDA g(sentence);
             //If the data is bad then do nothing and get next record
             if(g.Bad() == false)
             {
@@ -536,8 +972,6 @@ unsigned int NMEASpecimNavData::GetFirstDayOfWeekSecs()
             }
          }
       }
-      fin.close();
-      fin.clear();
    }
    return secs;
 }
@@ -548,141 +982,128 @@ unsigned int NMEASpecimNavData::GetFirstDayOfWeekSecs()
 //-------------------------------------------------------------------------
 void NMEASpecimNavData::Reader()
 {
-   std::string message_key;
-   std::string line;
-   std::ifstream fin;
+   char* line=NULL;
+   size_t length=0;
 
    bool record_complete=true;
    unsigned long record=0;
    unsigned long sync=0;
 
-   GPGGA* gpgga=NULL;
-   PRDID* prdid=NULL;
-   GPZDA* gpzda=NULL;
-   SPTSMP* sptsmp=NULL;
-   SPTSMP2* sptsmp2=NULL;
-
    //Test that numentries is not 0
    if(this->GetNumEntries() == 0)
       throw "Trying to read data into 0 sized arrays in SpecimNavData::Reader()";
 
-   fin.open(filename.c_str());
-   if(!fin.is_open())
+   TextLineReader fin(filename);
+   if(!fin.IsOpen())
    {
       throw "Cannot open .nav "+filename+" in NMEASpecimNavData::Reader()";
    }
    else
    {
-      while(!fin.eof())
+      while(fin.NextLine(line,length))
       {
-         //Get a line from the file - maybe getline is better in case of rogue spaces?
-         fin>>line;
-         //Get the key to the message type
-         message_key=GetItemFromString(line,0,delim);
+         //Skip blank lines
+         if(length==0)
+            continue;
+         //Split the line in place - the key to the message type is item 0
+         NMEASentence message(line,length,delim);
 
-         if(message_key.compare("$GPGGA")==0)
+         if(message.ItemIs(0,"$GPGGA"))
          {
             //This is a position message - use this as a nav record
             if(record_complete==true) //ie not mid way through a record
             {
-               gpgga=new GPGGA(line,delim);
+               GPGGA gpgga(message);
                //Test if object is bad - most likely because it is incomplete
-               if(gpgga->Bad()==false)
+               if(gpgga.Bad()==false)
                {
                   //Nasty piece of code to deal with when date change message appears after the time message at 00:00:00 within the nav file
-                  if((gpgga->secofday==0)&&(record!=0))
+                  if((gpgga.secofday==0)&&(record!=0))
                   {
                      //If the previous record time value is the same as this second + the day of week + another day - 1 second
-                     if(navcollection->GetValue(record-1,NavDataCollection::TIME)==gpgga->secofday+this->dayofweeksecs+3600*24-1)
+                     if(navcollection->GetValue(record-1,NavDataCollection::TIME)==gpgga.secofday+this->dayofweeksecs+3600*24-1)
                      {
                         //Then the dayofweeksecs has not yet been updated by the GPZDA message
                         //Add on an extra day of seconds here manually
-                        navcollection->SetValues(record,NavDataCollection::TIME,gpgga->secofday+this->dayofweeksecs+3600*24);
+                        navcollection->SetValues(record,NavDataCollection::TIME,gpgga.secofday+this->dayofweeksecs+3600*24);
                      }
                   }
                   else
                   {
                      //Normal operation for when the secofday is not 0
-                     navcollection->SetValues(record,NavDataCollection::TIME,gpgga->secofday+this->dayofweeksecs);
+                     navcollection->SetValues(record,NavDataCollection::TIME,gpgga.secofday+this->dayofweeksecs);
                   }
 
-                  navcollection->SetValues(record,NavDataCollection::LAT,gpgga->lat);
-                  navcollection->SetValues(record,NavDataCollection::LON,gpgga->lon);   
-                  navcollection->SetValues(record,NavDataCollection::HEI,gpgga->alt);
+                  navcollection->SetValues(record,NavDataCollection::LAT,gpgga.lat);
+                  navcollection->SetValues(record,NavDataCollection::LON,gpgga.lon);   
+                  navcollection->SetValues(record,NavDataCollection::HEI,gpgga.alt);
                   record_complete=false;
                }
-
-               delete gpgga;        
             }    
          }        
-         else if(message_key.compare("$PRDID")==0)
+         else if(message.ItemIs(0,"$PRDID"))
          {
             //This is an attitude message - ONLY use this if it follows a GPGGA record
             //because there appears to be ~10x the amount of prdids than gpggas
             if(record_complete==false)   
             {
-               prdid=new PRDID(line,delim);
+               PRDID prdid(message);
                //Test if object is bad - most likely because it is incomplete
-               if(prdid->Bad()==false)
+               if(prdid.Bad()==false)
                {
-                  navcollection->SetValues(record,NavDataCollection::ROLL,prdid->roll);
-                  navcollection->SetValues(record,NavDataCollection::PITCH,prdid->pitch);
-                  navcollection->SetValues(record,NavDataCollection::HEADING,prdid->heading);    
+                  navcollection->SetValues(record,NavDataCollection::ROLL,prdid.roll);
+                  navcollection->SetValues(record,NavDataCollection::PITCH,prdid.pitch);
+                  navcollection->SetValues(record,NavDataCollection::HEADING,prdid.heading);    
                   record_complete=true;
                   record++;
                }        
-
-               delete prdid;
             }
          }
-         else if(message_key.compare("$GPZDA")==0)
+         else if(message.ItemIs(0,"$GPZDA"))
          {
             //This is a date message - use this to get secofday into secofweek
-            gpzda=new GPZDA(line,delim);
+            GPZDA gpzda(message);
             //Test if object is bad - most likely because it is incomplete
-            if(gpzda->Bad()==false)
+            if(gpzda.Bad()==false)
             {
-               if(dayofweeksecs!=gpzda->secofweek_to_startofday)
+               if(dayofweeksecs!=gpzda.secofweek_to_startofday)
                {
                   //Day of week has changed mid way through file?
-                  if(dayofweeksecs == gpzda->secofweek_to_startofday - 3600*24)
+                  if(dayofweeksecs == gpzda.secofweek_to_startofday - 3600*24)
                   {
                      //Gone over to next day - this is plausible
                      //Update the dayofweeksecs
-                     dayofweeksecs=gpzda->secofweek_to_startofday;
+                     dayofweeksecs=gpzda.secofweek_to_startofday;
                   }
                   else
                      throw "Day of week has changed by more than 1 day (or gone backwards?) in nav file.";
                }
             }
-
-            delete gpzda;
          }
-         else if(message_key.compare("$SPTSMP")==0)
+         else if(message.ItemIs(0,"$SPTSMP"))
          {
             //This is a specim time stamp message (equivalent to #998)
-            sptsmp=new SPTSMP(line,delim);
+            SPTSMP sptsmp(message);
             //Test if object is bad - most likely because it is incomplete
-            if(sptsmp->Bad()==false)
+            if(sptsmp.Bad()==false)
             {
-               persecond_syncdelay.push_back(sptsmp->delay);
-               persecond_frame.push_back(sptsmp->framenumber);
+               persecond_syncdelay.push_back(sptsmp.delay);
+               persecond_frame.push_back(sptsmp.framenumber);
                if(record==0)
                   persecond_syncgps.push_back(-1); //Get at a later point when we have the next record - store as -1 (assume time is never -ve)
                else
                   persecond_syncgps.push_back((int)(navcollection->GetValue(record-1,NavDataCollection::TIME)));
             }
-            delete sptsmp;            
          }
-         else if(message_key.compare("$SPTSMP2")==0)
+         else if(message.ItemIs(0,"$SPTSMP2"))
          {
             //This is a specim sync message (equivalent to #999)
             //Get the sync time
-            sptsmp2=new SPTSMP2(line,delim);
+            SPTSMP2 sptsmp2(message);
             //Test if object is bad - most likely because it is incomplete
-            if(sptsmp2->Bad()==false)
+            if(sptsmp2.Bad()==false)
             {
-               syncdelay[sync]=sptsmp2->delayvalue;
+               syncdelay[sync]=sptsmp2.delayvalue;
                //Also store GPS time (integer part) 
                if(record!=0)
                   syncgps[sync]=(int)(navcollection->GetValue(record-1,NavDataCollection::TIME) +1);
@@ -691,12 +1112,11 @@ void NMEASpecimNavData::Reader()
 
                sync++;
             }
-            delete sptsmp2;
          }
          else
          {
             //Unrecoginsed message id
-            Logger::Log("Unrecognised specim nav message ID: "+message_key+". Assuming corrupt record and trying again ...");
+            Logger::Log("Unrecognised specim nav message ID: "+message.Item(0)+". Assuming corrupt record and trying again ...");
          }
       }
    }
@@ -1017,27 +1437,24 @@ SpecimFileChooser::SpecimFileChooser(std::string filename)
 {
    spnav=NULL;
    asciifile=false;
-   std::string line;
-   std::ifstream fin;
-   fin.open(filename.c_str());
-   if(!fin.is_open())
+   char* line=NULL;
+   size_t length=0;
+   TextLineReader fin(filename);
+   if(!fin.IsOpen())
    {
       throw "Specim nav file failed to open: "+filename;
    }
    else
    {
-      while(!fin.eof())
+      while(fin.NextLine(line,length))
       {
-         std::getline(fin,line);
-         if(GetItemFromString(line,0,',').compare("$GPGGA")==0)
+         if(NMEASentence(line,length,',').ItemIs(0,"$GPGGA"))
          {
             //File is most likely ascii
             asciifile=true;
             break;
          }
       }
-      fin.close();
-      fin.clear();
    }
 
    if(asciifile==true)
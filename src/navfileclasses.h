@@ -14,11 +14,15 @@
 #include "datahandler.h"
 #include "commonfunctions.h"
 #include "logger.h"
+#include "os_dependant.h"
 #include <string>
 #include <iostream>
 #include <fstream>
 #include <cmath>
 #include <list>
+#include <vector>
+#include <algorithm>
+#include <ctime>
 
 #ifndef PI_
 #define PI_
@@ -38,7 +42,12 @@ public:
 
    static unsigned int GetRecordSize(){return sizeofrecord;}
 private:
+   double RecordTime(const unsigned long record);
+   std::ifstream filein;
+   unsigned long numrecords; //number of records in the file
+   static const unsigned int numberofitems=17; //doubles per record
    static const unsigned int sizeofrecord=136; //17*8 bytes
+   static const unsigned int recordsperblock=8192; //number of records to read from disk at a time
 };
 
 
@@ -198,11 +207,44 @@ public:
    void Reader();
    
 private:
+   double RecordTime(const unsigned long record);
+   std::ifstream filein;
    SOLRecord* record;
    unsigned int completerecordsize;
+   unsigned long numrecords; //number of records in the file
 };
 
 
+//-------------------------------------------------------------------------
+// Binary cache of the navigation parsed from a SBET or SOL file so that
+// repeated runs over the same file do not have to parse it again. The
+// cache holds the size and modification time of the file it was made from
+// and the time, lat, lon, hei, roll, pitch and heading arrays. It is memory
+// mapped and only the records for the time window are copied out.
+//-------------------------------------------------------------------------
+class NavCacheData : public DataHandler
+{
+public:
+   NavCacheData(const std::string filename);
+   ~NavCacheData();
+   void Reader();
+
+   //Test if the cache exists and was written from the source file as it currently is
+   static bool IsCacheOf(const std::string cachefilename,const std::string sourcefilename);
+   //Write the navigation read in by source from sourcefilename to a cache file
+   static void Write(const std::string cachefilename,const std::string sourcefilename,DataHandler* const source);
+
+private:
+   double RecordTime(const unsigned long record){return channel[0][record];}
+   MappedFile* cache;
+   unsigned long numrecords;
+   static const unsigned int numberofchannels=7;
+   static const NavDataCollection::NavDataItem channelitems[numberofchannels];
+   const double* channel[numberofchannels]; //pointers to the channel arrays in the cache
+   static const char identifier[8];
+   static const unsigned int sizeofheader=64; //identifier, source size, source time and number of records - padded
+};
+
 //-------------------------------------------------------------------------
 //Abstract class to inherit from for different message types
 //-------------------------------------------------------------------------
@@ -343,6 +385,59 @@ private:
 //-------------------------------------------------------------------------
 //-------------------------------------------------------------------------
 
+//-------------------------------------------------------------------------
+// Class to read a text file one line at a time through a large buffer.
+// Lines are returned as pointers into the buffer, null terminated and with
+// any trailing carriage return removed, so no string is created per line.
+// A line is only valid until the next call to NextLine.
+//-------------------------------------------------------------------------
+class TextLineReader
+{
+public:
+   TextLineReader(const std::string filename);
+   bool IsOpen()const{return fin.is_open();}
+   bool NextLine(char*& line,size_t& length);
+
+private:
+   static const size_t initialbuffersize=1048576;
+   std::ifstream fin;
+   std::vector<char> buffer; //one larger than the capacity to allow a terminator on the last line
+   size_t start,end;
+   bool endoffile;
+};
+
+//-------------------------------------------------------------------------
+// Class to split a line of text into delimiter separated items in place.
+// Items are held as pointers into the line (which must outlive this
+// object) and are only converted when asked for, without creating strings.
+// Items past the maximum number are counted but not stored.
+//-------------------------------------------------------------------------
+class NMEASentence
+{
+public:
+   NMEASentence(const char* const line,const size_t length,const char delim);
+
+   //Number of items in the line - as GetNumberOfItemsFromString
+   size_t NumberOfItems()const{return nitems;}
+   bool ItemIs(const unsigned int item,const char* const str)const;
+   std::string Item(const unsigned int item)const;
+
+   //Conversions follow StringToDouble(str,false), StringToUINT and StringToINT,
+   //stripchecksum removes everything from a '*' onwards before converting
+   double ItemToDouble(const unsigned int item)const;
+   unsigned int ItemToUINT(const unsigned int item,const bool stripchecksum=false)const;
+   int ItemToINT(const unsigned int item,const size_t offset=0,const size_t count=std::string::npos)const;
+   //As CheckNumbersOnly but returns false rather than throwing
+   bool ItemIsNumbersOnly(const unsigned int item)const;
+
+private:
+   static const unsigned int maxitems=32;
+   void GetItem(const unsigned int item,const char*& b,const char*& e)const;
+   const char* itembegin[maxitems];
+   const char* itemend[maxitems];
+   size_t nitems;
+};
+
 //-------------------------------------------------------------------------
 // Base class for NMEA style Specim nav files
 //-------------------------------------------------------------------------
@@ -356,15 +451,6 @@ public:
    bool Bad() const {return bad;}
 
 protected:   
-   virtual std::string StripChecksum(std::string str)
-   {
-      size_t index=str.find('*');
-      if(index!=std::string::npos)
-      {
-         str=str.substr(0,index);
-      }
-      return str;
-   }
    std::string id;  
    bool bad; 
 };
@@ -379,28 +465,29 @@ protected:
 class GPZDA : public MessageNMEA
 {
 public:
-   GPZDA(std::string message,char delim)
+   GPZDA(const NMEASentence& message)
    {
-      std::string delimstr=std::string(1,delim);
       id="$GPZDA";
-      if(id.compare(GetItemFromString(message,0,delim))!=0)
+      if(!message.ItemIs(0,id.c_str()))
          throw "Given message does not contain the GPZDA id tag in position 0.";
 
       //Test there are 8 objects separated by delim character in string
-      if(GetNumberOfItemsFromString(message,delimstr)!=8)
+      if(message.NumberOfItems()!=8)
       {
          bad=true;
          return;
       }
 
-      day=StringToUINT(GetItemFromString(message,2,delim));
-      month=StringToUINT(GetItemFromString(message,3,delim));
-      year=StringToUINT(GetItemFromString(message,4,delim));     
-      //We want to match a particular format string, we shall use dd-mm-yyyy
-      std::string date=pad(GetItemFromString(message,2,delim),'0',2)+"-"
-                       +pad(GetItemFromString(message,3,delim),'0',2)+"-"
-                       +pad(GetItemFromString(message,4,delim),'0',2);
-      dayofweek=GetDayOfWeek(date,"dd-mm-yyyy");
+      day=message.ItemToUINT(2);
+      month=message.ItemToUINT(3);
+      year=message.ItemToUINT(4);     
+      //Fill a time struct with the date to get the day of the week - as GetDayOfWeek
+      struct tm mytime={0};
+      mytime.tm_mday=message.ItemToINT(2);
+      mytime.tm_mon=message.ItemToINT(3)-1;
+      mytime.tm_year=message.ItemToINT(4)-1900;
+      mktime(&mytime);
+      dayofweek=mytime.tm_wday;
       secofweek_to_startofday=dayofweek*3600*24;
    }
    unsigned int day,month,year;
@@ -415,23 +502,23 @@ public:
 class PRDID : public MessageNMEA
 {
 public:
-   PRDID(std::string message,char delim)
+   PRDID(const NMEASentence& message)
    {      
-      std::string delimstr=std::string(1,delim);
       id="$PRDID";
-      if(id.compare(GetItemFromString(message,0,delim))!=0)
+      if(!message.ItemIs(0,id.c_str()))
          throw "Given message does not contain the PRDID id tag in position 0.";
 
       //Test there are 4 objects separated by delim character in string
-      if(GetNumberOfItemsFromString(message,delimstr)!=4)
+      if(message.NumberOfItems()!=4)
       {
          bad=true;
          return;
       }
 
-      pitch=StringToDouble(GetItemFromString(message,1,delim),false);
-      roll=StringToDouble(GetItemFromString(message,2,delim),false);
-      heading=StringToDouble(StripChecksum(GetItemFromString(message,3,delim)),false);
+      pitch=message.ItemToDouble(1);
+      roll=message.ItemToDouble(2);
+      //Conversion stops at the checksum
+      heading=message.ItemToDouble(3);
    }
    double pitch,roll,heading;
 };
@@ -445,46 +532,46 @@ public:
 class GPGGA : public MessageNMEA
 {
 public:
-   GPGGA(std::string message,char delim)
+   GPGGA(const NMEASentence& message)
    {      
-      std::string delimstr=std::string(1,delim);
       id="$GPGGA";
-      if(id.compare(GetItemFromString(message,0,delim))!=0)
+      if(!message.ItemIs(0,id.c_str()))
          throw "Given message does not contain the GPGGA id tag in position 0.";
 
       //Test there are 15 objects separated by delim character in string
-      if(GetNumberOfItemsFromString(message,delimstr)!=15)
+      if(message.NumberOfItems()!=15)
       {
          bad=true;
          return;
       }
 
       //Get the TIME and convert into seconds of day
-      std::string time=GetItemFromString(message,1,delim);
-      int hh=StringToINT(time.substr(0,2));
-      int mm=StringToINT(time.substr(2,2));
-      int ss=StringToINT(time.substr(4,2));
-      //double ss=StringToDouble(time.substr(4)); //As advised by Specim - just use the rounded down version of seconds - not full decimal
+      int hh=message.ItemToINT(1,0,2);
+      int mm=message.ItemToINT(1,2,2);
+      int ss=message.ItemToINT(1,4,2);
+      //As advised by Specim - just use the rounded down version of seconds - not full decimal
       secofday=hh*3600 + mm*60 +ss;
       //Get the Latitude and convert to degrees
       //Lat and Lon are stored in GPGGA as (d)ddmm.mmmm
-      int latdeg=int(StringToDouble(GetItemFromString(message,2,delim),false)/100.0);
-      double latmin=StringToDouble(GetItemFromString(message,2,delim),false) - latdeg*100 ;
+      double latddmm=message.ItemToDouble(2);
+      int latdeg=int(latddmm/100.0);
+      double latmin=latddmm - latdeg*100 ;
       lat= latdeg + (latmin / 60.0);
 
-      if(GetItemFromString(message,3,delim).compare("S")==0)
+      if(message.ItemIs(3,"S"))
          lat=-lat;
 
       //Get the Longitude and convert to degrees
-      int londeg=int(StringToDouble(GetItemFromString(message,4,delim),false)/100.0);
-      double lonmin=StringToDouble(GetItemFromString(message,4,delim),false) - londeg*100 ;
+      double londddmm=message.ItemToDouble(4);
+      int londeg=int(londddmm/100.0);
+      double lonmin=londddmm - londeg*100 ;
       lon=londeg + (lonmin / 60.0);
 
-      if(GetItemFromString(message,5,delim).compare("W")==0)
+      if(message.ItemIs(5,"W"))
          lon=-lon;
       //Get the altitude and convert to above ellipsoid
-      double height_mean_sea=StringToDouble(GetItemFromString(message,7,delim),false);
-      double geoid_ellipsoid_sep=StringToDouble(GetItemFromString(message,9,delim),false);
+      double height_mean_sea=message.ItemToDouble(7);
+      double geoid_ellipsoid_sep=message.ItemToDouble(9);
       alt=height_mean_sea + geoid_ellipsoid_sep;
 
    }
@@ -500,21 +587,20 @@ public:
 class SPTSMP2 : public MessageNMEA
 {
 public:
-   SPTSMP2(std::string message,char delim)
+   SPTSMP2(const NMEASentence& message)
    {      
-      std::string delimstr=std::string(1,delim);
       id="$SPTSMP2";
-      if(id.compare(GetItemFromString(message,0,delim))!=0)
+      if(!message.ItemIs(0,id.c_str()))
          throw "Given message does not contain the SPTSMP2 id tag in position 0.";
 
       //Test there are 2 objects separated by delim character in string
-      if(GetNumberOfItemsFromString(message,delimstr)!=2)
+      if(message.NumberOfItems()!=2)
       {
          bad=true;
          return;
       }
       
-      delayvalue=StringToDouble(StripChecksum(GetItemFromString(message,1,delim)),false)/1000.0;
+      delayvalue=message.ItemToDouble(1)/1000.0;
    }
    double delayvalue;
 };
@@ -528,36 +614,27 @@ public:
 class SPTSMP : public MessageNMEA
 {
 public:
-   SPTSMP(std::string message,char delim)
+   SPTSMP(const NMEASentence& message)
    {      
-      std::string delimstr=std::string(1,delim);
       id="$SPTSMP";
-      if(id.compare(GetItemFromString(message,0,delim))!=0)
+      if(!message.ItemIs(0,id.c_str()))
          throw "Given message does not contain the SPTSMP id tag in position 0.";
 
       //Test there are 4 objects separated by delim character in string
-      if(GetNumberOfItemsFromString(message,delimstr)!=4)
+      if(message.NumberOfItems()!=4)
       {
          bad=true;
          return;
       }
       //Test that there are only numbers in the string message components
-      //If it throws an exception then skip these messages
-      try
-      {
-         CheckNumbersOnly(GetItemFromString(message,1,delim));
-         CheckNumbersOnly(GetItemFromString(message,2,delim));
-      }
-      catch(...)
+      if(!message.ItemIsNumbersOnly(1) || !message.ItemIsNumbersOnly(2))
       {
          throw "There appears to be a non-numeric value in a specim time stamp SPTSMP message in the raw .nav file. Please correct this and re-run.";
-         //bad=true;
-         //return;
       }
 
-      delay=StringToDouble(GetItemFromString(message,1,delim),false)/10000.0;
-      framenumber=StringToUINT(GetItemFromString(message,2,delim));
-      triggerflag=StringToUINT(StripChecksum(GetItemFromString(message,3,delim)));
+      delay=message.ItemToDouble(1)/10000.0;
+      framenumber=message.ItemToUINT(2);
+      triggerflag=message.ItemToUINT(3,true);
    }
 
    unsigned int framenumber,triggerflag;
@@ -612,7 +689,7 @@ public:
    int GetFrame(const unsigned long i){return spnav->GetFrame(i);}
    unsigned long GetNumSyncs(){return spnav->GetNumSyncs();}
    unsigned long GetNumEntries(){return spnav->GetNumEntries();}
-   NavDataLine* GetLine(const unsigned long l){return spnav->GetLine(l);}
+   NavDataLine GetLine(const unsigned long l){return spnav->GetLine(l);}
    bool UsePerSecondForSync(){return spnav->UsePerSecondForSync();}
    bool IsASCII(){return asciifile;}
 
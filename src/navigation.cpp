@@ -18,6 +18,10 @@
 #include <cstdlib>
 #include <cmath>
 #include <iostream>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <sstream>
 
 #include "navigationsyncer.h"
 #include "navigationinterpolator.h"
@@ -32,10 +36,16 @@
 //-------------------------------------------------------------------------
 const std::string DESCRIPTION="Navigation Interpolation Software";
 
+//-------------------------------------------------------------------------
+// Seconds of post-processed navigation to load either side of the scan 
+// times - covers the leap seconds and interpolation/smoothing at the ends
+//-------------------------------------------------------------------------
+const double navigationwindowpadding=60;
+
 //----------------------------------------------------------------
 //Number of options that can be on command line
 //----------------------------------------------------------------
-const int number_of_possible_options = 14;
+const int number_of_possible_options = 17;
 
 //----------------------------------------------------------------
 //Option names that can be on command line
@@ -54,6 +64,9 @@ const std::string availableopts[number_of_possible_options]={
 "-nonav",
 "-qualityfile",
 "-force",
+"-navcache",
+"-batch",
+"-threads",
 "-help"
 }; 
 
@@ -74,6 +87,9 @@ const std::string optsdescription[number_of_possible_options]={
 "If no Specim navigation file exists for this line.",
 "An optional BIL filename to output the quality flags to for the navigation.",
 "Force the processing when 'time goes backwards' in a navigation file (only use without processed nav when the data is not used for further processing). DO NOT USE FOR TYPICAL DATA PROCESSING.",
+"Binary cache file of the parsed SBET/SOL data, created (or updated) from the -procnav file if needed. Reuse it to speed up repeated runs on the same SBET/SOL file.",
+"Text file listing the lines to process against a single load of the -procnav file, one per line: level-1 file, output file, Specim .nav file (or -nonav) and optionally a quality flag output file. Replaces the -lev1, -output, -nav/-nonav and -qualityfile options.",
+"Maximum number of threads to use. In -batch mode they are shared between the lines processed at the same time (default is one line at a time, using a thread per processor).",
 "Display this help"
 }; 
 
@@ -83,6 +99,74 @@ const std::string optsdescription[number_of_possible_options]={
 //----------------------------------------------------------------
 bool GLOBAL_FORCE=false;
 
+//-------------------------------------------------------------------------
+// Processing settings that are the same for every level-1 line
+//-------------------------------------------------------------------------
+struct NavigationSettings
+{
+   std::string postprocnavfile; //empty if using the Specim nav files
+   std::string interpmethod;
+   double scantimeoffset;
+   double posattoffset;
+   unsigned int smoothkernelsize;
+   unsigned int linethreads; //threads each line may use, 0 for one per processor
+   Boresight* boresight;
+   Leverarm* leverarm;
+};
+
+//-------------------------------------------------------------------------
+// A level-1 line to create the navigation for. The processing is split in
+// two so that the scan times of all the lines can be found before the
+// post-processed navigation is read in (once) to interpolate them.
+//-------------------------------------------------------------------------
+class NavigationLine
+{
+public:
+   NavigationLine(std::string lev1,std::string output,std::string specimnav,std::string quality);
+   ~NavigationLine();
+
+   //Find the per scan times from the Specim nav file
+   void FindScanTimes(const NavigationSettings& settings);
+   //Interpolate the navigation to the scan times and write it out. If navigation
+   //is NULL then the line's Specim nav file is read in and used instead
+   void Interpolate(const NavigationSettings& settings,DataHandler* const navigation,Mutex& writemutex);
+
+   std::string level1file,outputfile,specimnavfile,qualityfile;
+   std::string info; //extra information for the output hdr files
+   std::string error; //set if processing of this line has failed
+   bool errorreported;
+   NavigationSyncer* syncer;
+};
+
+//-------------------------------------------------------------------------
+// Task to run one of the stages of processing over all the lines, sharing
+// the lines out between the threads. Errors are stored in the line rather
+// than stopping the other lines.
+//-------------------------------------------------------------------------
+class NavigationLineTask : public ThreadedTask
+{
+public:
+   enum Stage {SCANTIMES,INTERPOLATE};
+   NavigationLineTask(std::vector<NavigationLine*>& lines,const NavigationSettings& settings,DataHandler* const navigation,const Stage stage)
+      :lines(lines),settings(settings),navigation(navigation),stage(stage),nextline(0){}
+
+protected:
+   void Run(const unsigned int threadindex);
+
+private:
+   std::vector<NavigationLine*>& lines;
+   const NavigationSettings& settings;
+   DataHandler* const navigation;
+   const Stage stage;
+   size_t nextline;
+   Mutex linemutex;
+   Mutex writemutex; //BILWriter is not safe to create on several threads at once
+};
+
+std::vector<NavigationLine*> ReadBatchFile(const std::string filename);
+unsigned int ReportFailedLines(std::vector<NavigationLine*>& lines,const bool batch);
+
+
 int main(int argc,char* argv[])
 {
    //Set the precision of the data output to the terminal
@@ -104,8 +188,14 @@ int main(int argc,char* argv[])
    std::string strLevel1File="";
    //Post-processed nav file name 
    std::string strPostProcNavFile="";
-   //Pointer to a NavigationInterpolator
-   NavigationInterpolator* interpolator=NULL;
+   //Binary cache of the post-processed nav file
+   std::string strNavCacheFile="";
+   //File listing the lines to process in batch mode
+   std::string strBatchFile="";
+   //Number of lines to process at once in batch mode
+   unsigned int numthreads=1;
+   //Whether the total number of threads has been limited with -threads
+   bool limitthreads=false;
    //Pointer to a boresight onject
    Boresight* boresight=NULL;
    //Pointer to a lever arm object
@@ -181,6 +271,24 @@ int main(int argc,char* argv[])
          throw "";
       }
    
+      //-------------------------------------------------------------------
+      // Is a batch file of lines to process on the command line (ITS OPTIONAL)
+      //-------------------------------------------------------------------
+      if(cl->OnCommandLine("-batch"))
+      {
+         //Check that an argument follows the batch option - and get it if it exists
+         if(cl->GetArg("-batch").compare(optiononly)!=0)
+         {
+            strBatchFile=cl->GetArg("-batch");
+            log.Add("Will process the lines listed in batch file: "+strBatchFile);
+         }
+         else
+            throw CommandLine::CommandLineException("Argument -batch must immediately precede the batch filename.\n");
+
+         if((cl->OnCommandLine("-nav"))||(cl->OnCommandLine("-nonav"))||(cl->OnCommandLine("-output"))||(cl->OnCommandLine("-lev1"))||(cl->OnCommandLine("-qualityfile")))
+            throw CommandLine::CommandLineException("Options -lev1, -output, -nav, -nonav and -qualityfile are given per line in the batch file and cannot be used with -batch.\n");
+      }
+
       //-------------------------------------------------------------------
       // Is the Specim .nav file on the command line (IT MUST BE PRESENT)
       //-------------------------------------------------------------------
@@ -206,7 +314,7 @@ int main(int argc,char* argv[])
          else
             strSpecimNavFile="NULL";
       }
-      else
+      else if(strBatchFile=="")
       {
          //Throw an exception
          throw CommandLine::CommandLineException("Argument -nav [Specim navigation file] or -nonav must be present on the command line.\n");  
@@ -226,7 +334,7 @@ int main(int argc,char* argv[])
          else
             throw CommandLine::CommandLineException("Argument -output must immediately precede the output filename.\n");
       }
-      else
+      else if(strBatchFile=="")
       {
          //Throw an exception
          throw CommandLine::CommandLineException("Argument -output [the file to write to] must be present on the command line.\n");  
@@ -246,7 +354,7 @@ int main(int argc,char* argv[])
          else
             throw CommandLine::CommandLineException("Argument -lev1 must immediately precede the level-1 filename.\n");
       }
-      else
+      else if(strBatchFile=="")
       {
          //Throw an exception
          throw CommandLine::CommandLineException("Argument -lev1 [the level-1 hyperspectral file] must be present on the command line.\n");  
@@ -455,6 +563,43 @@ int main(int argc,char* argv[])
          GLOBAL_FORCE=false;
       }
 
+      //-------------------------------------------------------------------
+      // Cache of the parsed post-processed nav file (ITS OPTIONAL)
+      //-------------------------------------------------------------------
+      if(cl->OnCommandLine("-navcache"))
+      {
+         //Check that an argument follows the navcache option - and get it if it exists
+         if(cl->GetArg("-navcache").compare(optiononly)!=0)
+         {
+            if(strPostProcNavFile!="")
+            {
+               strNavCacheFile=cl->GetArg("-navcache");
+               log.Add("Will read the SBET/SOL data through the cache file: "+strNavCacheFile);
+            }
+            else
+               log.Add("No SBET/SOL file has been given, therefore will ignore the -navcache option.");
+         }
+         else
+            throw CommandLine::CommandLineException("Argument -navcache must immediately precede the navigation cache filename.\n");
+      }
+
+      //-------------------------------------------------------------------
+      // Get the number of lines to process at once in batch mode
+      //-------------------------------------------------------------------
+      if(cl->OnCommandLine("-threads"))
+      {
+         if(cl->NumArgsOfOpt("-threads")!=1)
+         {
+            throw CommandLine::CommandLineException("-threads should immediately preceed the number of threads to use. Got: "+cl->GetArg("-threads"));      
+         }
+         numthreads=StringToUINT(TrimWhitespace(cl->GetArg("-threads")));
+         if(numthreads==0)
+         {
+            throw CommandLine::CommandLineException("-threads should be at least 1. Got: "+cl->GetArg("-threads"));      
+         }
+         limitthreads=true;
+      }
+
       //-------------------------------------------------------------------
       // ENTER NEW COMMAND LINE OPTIONS HERE
       //-------------------------------------------------------------------
@@ -502,158 +647,399 @@ int main(int argc,char* argv[])
    info=info+";leverarm (X,Y,Z) = "+ToString(leverarm->X())+" "+ToString(leverarm->Y())+" "+ToString(leverarm->Z())+"\n";
 
 
+   //Settings for processing every line
+   NavigationSettings settings;
+   settings.postprocnavfile=strPostProcNavFile;
+   settings.interpmethod=strinterpmethod;
+   settings.scantimeoffset=scantimeoffset;
+   settings.posattoffset=posattoffset;
+   settings.smoothkernelsize=smoothkernelsize;
+   settings.linethreads=0;
+   settings.boresight=boresight;
+   settings.leverarm=leverarm;
+
+   //The lines to process - only the one from the command line if not in batch mode
+   std::vector<NavigationLine*> lines;
+   const bool batch=(strBatchFile!="");
+   unsigned int nfailed=0;
+
    try
    { 
+      if(batch)
+         lines=ReadBatchFile(strBatchFile);
+      else
+         lines.push_back(new NavigationLine(strLevel1File,strOutputFile,strSpecimNavFile,(WRITE_QUALITY==true) ? strOutputFlagFile : ""));
+      for(unsigned int l=0;l<lines.size();l++)
+         lines[l]->info=info;
+      //Share the -threads limit between the lines processed at the same time
+      //so that each line's interpolation does not start more on top
+      const unsigned int maxthreads=numthreads;
+      numthreads=std::max<unsigned int>(1,std::min<unsigned int>(numthreads,lines.size()));
+      if(limitthreads)
+         settings.linethreads=maxthreads/numthreads;
+
       //-------------------------------------------------------------------
       // In this section we deal with getting per scan times
       //-------------------------------------------------------------------
+      NavigationLineTask(lines,settings,NULL,NavigationLineTask::SCANTIMES).RunOnThreads(numthreads);
+      nfailed=ReportFailedLines(lines,batch);
 
-      //Set up navigation syncer to get per scan line times
-      NavigationSyncer syncer(strSpecimNavFile,strLevel1File);
-
-      //Add the y start value to the output header file.
-      info=info+"y start = "+ToString(syncer.GetCropTimeOffset())+"\n";
-
-      //Get the perscan line times
-      log.Add("Finding per-scan times...");
-      log.Flush();
-      syncer.FindScanTimes();
-
-      //Correct the times for GPS leapseconds if from SBET/SOL file
-      //This is because the times from the Specim nav file are in GPS time
-      //and SBET/SOL times are in UTC. So this adds leapseconds onto the times 
-      //which have been derived from the Specim data, making them relevant
-      //for querying the data from the SBET/SOL file.
-      //Ignore (for the moment) if from Specim Nav file - adds time on
-      //to that data before writing out (see below)
-      if(strPostProcNavFile!="")
-         syncer.ApplyLeapSeconds();
+      //-------------------------------------------------------------------
+      // In this section we deal with getting per scan navigation data
+      //-------------------------------------------------------------------
 
-      //Apply a user-defined time offset to the scans
-      if(scantimeoffset!=0)
+      //Read in the post-processed navigation once for all the lines. Specim
+      //nav files are per line so are read in by each line
+      DataHandler* navigation=NULL;
+      if((strPostProcNavFile!="")&&(nfailed<lines.size()))
       {
-         log.Add("\nApplying user defined timing offset...");
+         //Only load the part of the SBET/SOL file around the scan times. It is padded
+         //for the position-attitude shift and by the smoothing kernel for the filter
+         bool first=true;
+         double firsttime=0,lasttime=0;
+         for(unsigned int l=0;l<lines.size();l++)
+         {
+            if(lines[l]->error!="")
+               continue;
+            const double* const times=lines[l]->syncer->PtrToTimes();
+            for(unsigned long i=0;i<lines[l]->syncer->NumScans();i++)
+            {
+               if(first)
+               {
+                  firsttime=lasttime=times[i];
+                  first=false;
+               }
+               firsttime=std::min(firsttime,times[i]);
+               lasttime=std::max(lasttime,times[i]);
+            }
+         }
+         const double padding=navigationwindowpadding+fabs(posattoffset);
+         log.Add("Reading navigation data...");
          log.Flush();
-         syncer.ApplyTimeShift(scantimeoffset);
-         info=info+";User defined scan timing offset added onto data: "+ToString(scantimeoffset)+"\n";
+         navigation=NavigationInterpolator::LoadNavigation(strPostProcNavFile,firsttime-padding,lasttime+padding,smoothkernelsize+1,strNavCacheFile);
+
+         //Smooth the nav data
+         if(smoothkernelsize!=0)
+         {
+            log.Add("Smoothing the data using a triangular low-pass filter...");
+            log.Flush();
+            navigation->Smooth(Triangle,smoothkernelsize);
+         }
       }
 
-      //-------------------------------------------------------------------
-      // In this section we deal with getting per scan navigation data
-      //-------------------------------------------------------------------
+      //Interpolate, correct and write out the navigation for each line
+      NavigationLineTask(lines,settings,navigation,NavigationLineTask::INTERPOLATE).RunOnThreads(numthreads);
+      if(navigation!=NULL)
+         delete navigation;
+      nfailed=ReportFailedLines(lines,batch);
 
-      //Set up an interpolator to interpolate the navigation to the scan lines
-      log.Add("Creating Navigation Interpolation object...");
-      log.Flush();
-      if(strPostProcNavFile!="")
-         interpolator=new NavigationInterpolator(strPostProcNavFile,strLevel1File);
-      else
-         interpolator=new NavigationInterpolator(strSpecimNavFile,strLevel1File);         
+      for(unsigned int l=0;l<lines.size();l++)
+         delete lines[l];
+   }
+   catch(std::string e)
+   {
+      Logger::Error(e);
+      exit(1);
+   }
+   catch(const char* e)
+   {
+      Logger::Error(e);
+      exit(1);
+   }
+   catch(BinaryReader::BRexception e)
+   {
+      Logger::Error(std::string(e.what())+"\n"+e.info);
+      exit(1); 
+   }
+   catch(BILWriter::BILexception e)
+   {
+      Logger::Error(std::string(e.what())+"\n"+e.info);
+      exit(1); 
+   }
+   catch(std::exception &e)
+   {
+      Logger::Error(e.what());
+      exit(1);
+   }
+
+   if(nfailed!=0)
+   {
+      Logger::Error("Navigation processing failed for "+ToString(nfailed)+" of the lines in the batch file.");
+      exit(1);
+   }
+
+   Logger::Log("Navigation processing completed. \n \n");
+
+   //Delete the command line object
+   if(cl!=NULL)
+      delete cl;
+   if(boresight!=NULL)
+      delete boresight;
+   if(leverarm!=NULL)
+      delete leverarm;
+}
+
+//-------------------------------------------------------------------------
+// NavigationLine constructor
+//-------------------------------------------------------------------------
+NavigationLine::NavigationLine(std::string lev1,std::string output,std::string specimnav,std::string quality)
+{
+   level1file=lev1;
+   outputfile=output;
+   specimnavfile=specimnav;
+   qualityfile=quality;
+   info="";
+   error="";
+   errorreported=false;
+   syncer=NULL;
+}
+
+NavigationLine::~NavigationLine()
+{
+   if(syncer!=NULL)
+      delete syncer;
+}
+
+//-------------------------------------------------------------------------
+// Function to get the per scan times of the line
+//-------------------------------------------------------------------------
+void NavigationLine::FindScanTimes(const NavigationSettings& settings)
+{
+   //Set up navigation syncer to get per scan line times
+   syncer=new NavigationSyncer(specimnavfile,level1file);
+
+   //Add the y start value to the output header file.
+   info=info+"y start = "+ToString(syncer->GetCropTimeOffset())+"\n";
+
+   //Get the perscan line times
+   Logger::Log("Finding per-scan times for "+level1file+"...");
+   syncer->FindScanTimes();
+
+   //Correct the times for GPS leapseconds if from SBET/SOL file
+   //This is because the times from the Specim nav file are in GPS time
+   //and SBET/SOL times are in UTC. So this adds leapseconds onto the times 
+   //which have been derived from the Specim data, making them relevant
+   //for querying the data from the SBET/SOL file.
+   //Ignore (for the moment) if from Specim Nav file - adds time on
+   //to that data before writing out (see Interpolate)
+   if(settings.postprocnavfile!="")
+      syncer->ApplyLeapSeconds();
+
+   //Apply a user-defined time offset to the scans
+   if(settings.scantimeoffset!=0)
+   {
+      Logger::Log("\nApplying user defined timing offset...");
+      syncer->ApplyTimeShift(settings.scantimeoffset);
+      info=info+";User defined scan timing offset added onto data: "+ToString(settings.scantimeoffset)+"\n";
+   }
+}
+
+//-------------------------------------------------------------------------
+// Function to interpolate the navigation to the scan times of the line,
+// apply the lever arm and boresight and write out the result
+//-------------------------------------------------------------------------
+void NavigationLine::Interpolate(const NavigationSettings& settings,DataHandler* const navigation,Mutex& writemutex)
+{
+   //Set up an interpolator to interpolate the navigation to the scan lines
+   Logger::Log("Creating Navigation Interpolation object for "+level1file+"...");
+   NavigationInterpolator* interpolator=NULL;
+   if(navigation!=NULL)
+      interpolator=new NavigationInterpolator(navigation,level1file);
+   else
+      interpolator=new NavigationInterpolator(specimnavfile,level1file);
+   interpolator->SetMaxThreads(settings.linethreads);
 
+   try
+   {
       //Assign the scan times to the interpolator - these are just 
       //pointing to the data so dont delete the syncer
-      log.Add("\nSetting times to interpolation object...");
-      log.Flush();
-      double* scantimes=NULL;
-      scantimes=syncer.PtrToTimes();
-      interpolator->SetTimes(scantimes);
+      Logger::Log("\nSetting times to interpolation object...");
+      interpolator->SetTimes(syncer->PtrToTimes());
 
-      //Smooth the nav data
-      if(smoothkernelsize!=0)
+      //Smooth the nav data - shared navigation has already been smoothed
+      if(settings.smoothkernelsize!=0)
       {
-         log.Add("Smoothing the data using a triangular low-pass filter...");
-         log.Flush();
-         info=info+";Smoothed input navigation data using a triangular low-pass filter with kernel size: "+ToString(smoothkernelsize)+"\n";
-         interpolator->SmoothNavData(Triangle,smoothkernelsize);
+         if(navigation==NULL)
+         {
+            Logger::Log("Smoothing the data using a triangular low-pass filter...");
+            interpolator->SmoothNavData(Triangle,settings.smoothkernelsize);
+         }
+         info=info+";Smoothed input navigation data using a triangular low-pass filter with kernel size: "+ToString(settings.smoothkernelsize)+"\n";
       }
 
       //Interpolate the data to the scan times
-      log.Add("\nInterpolating navigation data to scan times...");
-      log.Flush();
-      if(strinterpmethod.compare("Linear")==0)
+      Logger::Log("\nInterpolating navigation data to scan times...");
+      if(settings.interpmethod.compare("Linear")==0)
       {
          interpolator->Interpolate(Linear);
-         if(posattoffset!=0)
-            interpolator->PosAttShift(Linear,posattoffset);
+         if(settings.posattoffset!=0)
+            interpolator->PosAttShift(Linear,settings.posattoffset);
       }
-      else if(strinterpmethod.compare("Spline")==0)
+      else if(settings.interpmethod.compare("Spline")==0)
       {
          interpolator->Interpolate(CubicSpline);
-         if(posattoffset!=0)
-            interpolator->PosAttShift(Linear,posattoffset);
+         if(settings.posattoffset!=0)
+            interpolator->PosAttShift(Linear,settings.posattoffset);
       }
       else
          throw "Unknown interpolation method. Expected 'Linear' or 'Spline'";
 
       //Apply the lever arm offsets to the interpolated position data
-      log.Add("Adding leverarm correction...");
-      log.Flush();
-      interpolator->ApplyLeverarm(leverarm);    
+      Logger::Log("Adding leverarm correction...");
+      interpolator->ApplyLeverarm(settings.leverarm);    
 
       //Apply the boresight offsets to the interpolated attitude data
-      log.Add("Adding boresight correction...");
-      log.Flush();
-      interpolator->ApplyBoresight(boresight);
+      Logger::Log("Adding boresight correction...");
+      interpolator->ApplyBoresight(settings.boresight);
 
       //If the times are from the Specim nav file then they must be converted
       //from GPS time to UTC by adding on the leap seconds.
-      if(strPostProcNavFile=="")
-         syncer.ApplyLeapSeconds();
-      scantimes=syncer.PtrToTimes();
-      interpolator->SetTimes(scantimes);
+      if(settings.postprocnavfile=="")
+         syncer->ApplyLeapSeconds();
+      interpolator->SetTimes(syncer->PtrToTimes());
 
       //Check the plausibilty of the interpolated data
       interpolator->CheckPlausibility();
 
       //Write out the data
-      log.Add("\nWriting data out...");
-      log.Flush();
-      interpolator->Writer(strOutputFile,info);
+      Logger::Log("\nWriting data out to "+outputfile+"...");
+      ScopedLock lock(writemutex);
+      interpolator->Writer(outputfile,info);
 
       //Write out the quality flags
-      if(WRITE_QUALITY==true)
+      if(qualityfile!="")
       {
-         interpolator->WriteFlags(strOutputFlagFile);
+         interpolator->WriteFlags(qualityfile);
       }
-
-      //delete the interpolator
-      delete interpolator;
-
-   }
-   catch(std::string e)
-   {
-      Logger::Error(e);
-      exit(1);
    }
-   catch(const char* e)
+   catch(...)
    {
-      Logger::Error(e);
-      exit(1);
+      delete interpolator;
+      throw;
    }
-   catch(BinaryReader::BRexception e)
+
+   //delete the interpolator
+   delete interpolator;
+}
+
+//-------------------------------------------------------------------------
+// Run the stage of processing on the lines that have not yet failed
+//-------------------------------------------------------------------------
+void NavigationLineTask::Run(const unsigned int threadindex)
+{
+   while(true)
    {
-      Logger::Error(std::string(e.what())+"\n"+e.info);
-      exit(1); 
+      NavigationLine* line=NULL;
+      {
+         ScopedLock lock(linemutex);
+         if(nextline>=lines.size())
+            break;
+         line=lines[nextline++];
+      }
+      if(line->error!="")
+         continue;
+
+      try
+      {
+         if(stage==SCANTIMES)
+            line->FindScanTimes(settings);
+         else
+            line->Interpolate(settings,navigation,writemutex);
+      }
+      catch(std::string e)
+      {
+         line->error=e;
+      }
+      catch(const char* e)
+      {
+         line->error=e;
+      }
+      catch(BinaryReader::BRexception e)
+      {
+         line->error=std::string(e.what())+"\n"+e.info;
+      }
+      catch(BILWriter::BILexception e)
+      {
+         line->error=std::string(e.what())+"\n"+e.info;
+      }
+      catch(std::exception &e)
+      {
+         line->error=e.what();
+      }
    }
-   catch(BILWriter::BILexception e)
+}
+
+//-------------------------------------------------------------------------
+// Function to read the list of lines to process from a batch file. Each
+// line of the file is: level-1 file, output file, Specim nav file (or
+// -nonav) and optionally the quality flag file - separated by whitespace.
+// Blank lines and lines starting with # are ignored.
+//-------------------------------------------------------------------------
+std::vector<NavigationLine*> ReadBatchFile(const std::string filename)
+{
+   std::vector<NavigationLine*> lines;
+   std::ifstream fin;
+   fin.open(filename.c_str());
+   if(!fin.is_open())
    {
-      Logger::Error(std::string(e.what())+"\n"+e.info);
-      exit(1); 
+      throw "Cannot open batch file: "+filename;
    }
-   catch(std::exception &e)
+
+   std::string line;
+   unsigned long linenumber=0;
+   while(std::getline(fin,line))
    {
-      Logger::Error(e.what());
-      exit(1);
+      linenumber++;
+      line=TrimWhitespace(line);
+      if((line=="")||(line[0]=='#'))
+         continue;
+
+      std::istringstream items(line);
+      std::vector<std::string> item;
+      std::string it;
+      while(items>>it)
+         item.push_back(it);
+      if((item.size()<3)||(item.size()>4))
+      {
+         for(unsigned int l=0;l<lines.size();l++)
+            delete lines[l];
+         throw "Line "+ToString(linenumber)+" of batch file "+filename+" should have the level-1 file, output file, Specim nav file (or -nonav) and optionally a quality file: "+line;
+      }
+      if(item[2]=="-nonav")
+         item[2]="NULL";
+      lines.push_back(new NavigationLine(item[0],item[1],item[2],(item.size()==4) ? item[3] : ""));
    }
+   fin.close();
 
-   Logger::Log("Navigation processing completed. \n \n");
+   if(lines.size()==0)
+      throw "No lines to process found in batch file: "+filename;
 
-   //Delete the command line object
-   if(cl!=NULL)
-      delete cl;
-   if(boresight!=NULL)
-      delete boresight;
-   if(leverarm!=NULL)
-      delete leverarm;
+   return lines;
 }
 
+//-------------------------------------------------------------------------
+// Function to report any lines that have failed that have not already been
+// reported. If not in batch mode then the program exits on failure.
+// Returns the total number of lines that have failed.
+//-------------------------------------------------------------------------
+unsigned int ReportFailedLines(std::vector<NavigationLine*>& lines,const bool batch)
+{
+   unsigned int nfailed=0;
+   for(unsigned int l=0;l<lines.size();l++)
+   {
+      if(lines[l]->error=="")
+         continue;
+      nfailed++;
+      if(lines[l]->errorreported==true)
+         continue;
+      lines[l]->errorreported=true;
+      if(batch)
+         Logger::Error("Failed to process "+lines[l]->level1file+": "+lines[l]->error);
+      else
+      {
+         Logger::Error(lines[l]->error);
+         exit(1);
+      }
+   }
+   return nfailed;
+}
@@ -25,20 +25,62 @@ NavigationInterpolator::NavigationInterpolator()
    navcollection=NULL;
    nscans=0;
    dhandle=NULL;
+   ownsdhandle=true;
+   maxthreads=0;
 }
 
 //-------------------------------------------------------------------------
 // NavigationInterpolator constructor using nav file and lev1 file to set up
 //-------------------------------------------------------------------------
-NavigationInterpolator::NavigationInterpolator(std::string navfilename, std::string lev1filename)
+NavigationInterpolator::NavigationInterpolator(std::string navfilename, std::string lev1filename,const double windowstart,const double windowend,
+                                               const unsigned long windowpadrecords,const std::string navcachefilename)
 {
    //Set to NULL here anyway just to be safe - they should all be none-null by the end of this function
    scanid=NULL;
    navcollection=NULL;
    nscans=0;
    dhandle=NULL;
+   ownsdhandle=true;
+   maxthreads=0;
    //hdrsync=0;
 
+   //Need to read in the level1 file hdr info to get nscans
+   ReadLevel1Header(lev1filename);
+
+   //Setup the data arrays
+   SetupArrays();
+
+   //read in the data
+   dhandle=LoadNavigation(navfilename,windowstart,windowend,windowpadrecords,navcachefilename);
+}
+
+//-------------------------------------------------------------------------
+// NavigationInterpolator constructor using navigation that has already been
+// read in (and is shared with other interpolators) and a lev1 file to set up
+//-------------------------------------------------------------------------
+NavigationInterpolator::NavigationInterpolator(DataHandler* const navigation,std::string lev1filename)
+{
+   scanid=NULL;
+   navcollection=NULL;
+   nscans=0;
+   dhandle=navigation;
+   ownsdhandle=false;
+   maxthreads=0;
+
+   ReadLevel1Header(lev1filename);
+   SetupArrays();
+}
+
+//-------------------------------------------------------------------------
+// Function to create a handler for the navigation file and read it in -
+// only the time window (plus padding records) if end > start. SBET/SOL
+// files are read through the cache file if one is given.
+//-------------------------------------------------------------------------
+DataHandler* NavigationInterpolator::LoadNavigation(std::string navfilename,const double windowstart,const double windowend,
+                                                    const unsigned long windowpadrecords,const std::string navcachefilename)
+{
+   DataHandler* navigation=NULL;
+
    //Call function to detect file type
    FILETYPE ftype=DetectFileType(navfilename);
  
@@ -55,19 +97,35 @@ NavigationInterpolator::NavigationInterpolator(std::string navfilename, std::str
       //Nav file is a specim .nav file
       SpecimFileChooser spf(navfilename);
       if(spf.IsASCII()==true)
-         dhandle=new NMEASpecimNavData(navfilename);
+         navigation=new NMEASpecimNavData(navfilename);
       else
-         dhandle=new BinSpecimNavData(navfilename);
+         navigation=new BinSpecimNavData(navfilename);
    }
    //else if(postfix.compare(".out")==0)
-   else if(ftype==SBET)
+   else if((ftype==SBET)||(ftype==SOL))
    {
-      //Nav file is a SBET file
-      dhandle=new SBETData(navfilename);
-   }
-   else if(ftype==SOL)
-   {
-      dhandle=new SOLData(navfilename);
+      //Read the SBET/SOL data from the cache rather than parsing the file
+      if((navcachefilename!="")&&(UpdateNavigationCache(navfilename,ftype,navcachefilename)))
+      {
+         try
+         {
+            navigation=new NavCacheData(navcachefilename);
+         }
+         catch(std::string e)
+         {
+            Logger::Warning("Failed to open navigation cache file, will read the navigation file directly: "+e);
+            navigation=NULL;
+         }
+      }
+
+      //Otherwise read the SBET/SOL file directly
+      if(navigation==NULL)
+      {
+         if(ftype==SBET)
+            navigation=new SBETData(navfilename);
+         else
+            navigation=new SOLData(navfilename);
+      }
    }
    else if(ftype==BADFILE)
    {
@@ -79,7 +137,29 @@ NavigationInterpolator::NavigationInterpolator(std::string navfilename, std::str
       throw "Navigation file is of an unrecognised format (in NavigationInterpolator()): "+navfilename;
    }
 
-   //Need to read in the level1 file hdr info to get nscans
+   //Only load the nav data for the time window if one is given
+   if(windowend > windowstart)
+      navigation->SetTimeWindow(windowstart,windowend,windowpadrecords);
+
+   //read in the data
+   try
+   {
+      navigation->Reader();
+   }
+   catch(...)
+   {
+      delete navigation;
+      throw;
+   }
+   return navigation;
+}
+
+//-------------------------------------------------------------------------
+// Function to read the number of scans and GPS start/stop times from the
+// level 1 file header
+//-------------------------------------------------------------------------
+void NavigationInterpolator::ReadLevel1Header(std::string lev1filename)
+{
    BinFile bilin(lev1filename);
    //Get the number of scan lines
    nscans=StringToUINT(bilin.FromHeader("lines"));
@@ -94,13 +174,50 @@ NavigationInterpolator::NavigationInterpolator(std::string navfilename, std::str
    gpsstoptime=TrimWhitespace(ReplaceAllWith(&gpsstoptime,':',' '));
    DEBUGPRINT("GPS Start/Stop times:"<<gpsstarttime<<" "<<gpsstoptime)
    bilin.Close();
+}
 
-   //Setup the data arrays
-   SetupArrays();
+//-------------------------------------------------------------------------
+// Function to check the navigation cache is up to date with the SBET/SOL
+// file and (re)create it from the whole file if not. Returns false if the
+// cache could not be created, in which case the file should be read directly.
+//-------------------------------------------------------------------------
+bool NavigationInterpolator::UpdateNavigationCache(const std::string navfilename,const FILETYPE ftype,const std::string navcachefilename)
+{
+   if(NavCacheData::IsCacheOf(navcachefilename,navfilename))
+   {
+      Logger::Log("Will read navigation from cache file: "+navcachefilename);
+      return true;
+   }
 
-   //read in the data
-   dhandle->Reader();
+   Logger::Log("Creating navigation cache file "+navcachefilename+" from the whole of "+navfilename);
+   DataHandler* source=NULL;
+   std::string error="";
+   try
+   {
+      if(ftype==SBET)
+         source=new SBETData(navfilename);
+      else
+         source=new SOLData(navfilename);
+      source->Reader();
+      NavCacheData::Write(navcachefilename,navfilename,source);
+   }
+   catch(std::string e)
+   {
+      error=e;
+   }
+   catch(const char* e)
+   {
+      error=e;
+   }
 
+   if(source!=NULL)
+      delete source;
+   if(error!="")
+   {
+      Logger::Warning("Failed to create navigation cache file, will read the navigation file directly: "+error);
+      return false;
+   }
+   return true;
 }
 
 //-------------------------------------------------------------------------
@@ -112,7 +229,7 @@ NavigationInterpolator::~NavigationInterpolator()
       delete[] scanid;
    if(navcollection!=NULL);
       delete navcollection;
-   if(dhandle!=NULL)
+   if((dhandle!=NULL)&&(ownsdhandle==true))
       delete dhandle;
 }
 
@@ -155,22 +272,25 @@ void NavigationInterpolator::SetTimes(const double* const times)
 // Function to interpolate the navigation data to the scan times using the given function
 //-------------------------------------------------------------------------
 
-void NavigationInterpolator::Interpolate(void (*f)(const double*,const int,DataHandler*,NavDataCollection*,std::string,std::string))
+void NavigationInterpolator::Interpolate(void (*f)(const double*,const int,DataHandler*,NavDataCollection*,std::string,std::string,const unsigned int))
 {
    //Create an array of times
    double* times=new double[this->nscans];
+   const double* navtimes=dhandle->GetChannel(NavDataCollection::TIME);
+   const double navstart=navtimes[0];
+   const double navend=navtimes[dhandle->GetNumEntries()-1];
    for(unsigned int i=0;i<this->nscans;i++)
    {
       times[i]=this->navcollection->GetValue(i,NavDataCollection::TIME);
       //Added a test to see if all interpolated times are within nav data 
-      if((times[i] > dhandle->GetLine(dhandle->GetNumEntries()-1)->time) || (times[i] < dhandle->GetLine(0)->time))
+      if((times[i] > navend) || (times[i] < navstart))
       {
          throw "Interpolated time is outside the range of the navigation data for scan line: "+ToString(i)+" and time:"+ToString(times[i]);
       }      
    }
 
    //Call the function
-   f(times,this->nscans,dhandle,navcollection,this->gpsstarttime,this->gpsstoptime);
+   f(times,this->nscans,dhandle,navcollection,this->gpsstarttime,this->gpsstoptime,maxthreads);
 
    //clean up after ourselves.
    delete[] times;
@@ -240,41 +360,89 @@ void NavigationInterpolator::WriteFlags(std::string outfilename,std::string extr
 //-------------------------------------------------------------------------
 // Function to add on the boresight offset onto the per scan data
 //-------------------------------------------------------------------------
-void NavigationInterpolator::ApplyBoresight(Boresight* boresight)
+void NavigationInterpolator::ApplyBoresight(const Boresight* const boresight)
 {
+   double* roll=navcollection->GetChannel(NavDataCollection::ROLL);
+   double* pitch=navcollection->GetChannel(NavDataCollection::PITCH);
+   double* heading=navcollection->GetChannel(NavDataCollection::HEADING);
+   boresight->ApplyBoresight(roll,pitch,heading,nscans);
+}
 
-   for(unsigned int i=0;i<nscans;i++)
+//-------------------------------------------------------------------------
+// Class to apply the lever arm to the per scan position data, sharing 
+// contiguous blocks of scans between threads
+//-------------------------------------------------------------------------
+class LeverarmTask : public ThreadedTask
+{
+public:
+   LeverarmTask(const Leverarm* const leverarm,NavDataCollection* const navcollection,const unsigned long nscans)
+      :leverarm(leverarm),navcollection(navcollection),nscans(nscans),nthreads(1){}
+   void Apply(const unsigned int maxthreads);
+
+protected:
+   void Run(const unsigned int threadindex);
+
+private:
+   //Minimum number of scans to give to a thread - fewer than this and it
+   //is quicker to not start the thread
+   static const unsigned long MINSCANSPERTHREAD=4096;
+
+   const Leverarm* const leverarm;
+   NavDataCollection* const navcollection;
+   const unsigned long nscans;
+   unsigned int nthreads;
+};
+
+//-------------------------------------------------------------------------
+// Apply the lever arm to all scans, on up to maxthreads threads (one per
+// processor if 0) for long lines and on this thread for short ones
+//-------------------------------------------------------------------------
+void LeverarmTask::Apply(const unsigned int maxthreads)
+{
+   nthreads=std::min<unsigned long>(nscans/MINSCANSPERTHREAD,(maxthreads==0) ? ThreadedTask::NumberOfProcessors() : maxthreads);
+   if(nthreads<=1)
    {
-      boresight->ApplyBoresight(navcollection->GetReferenceValue(i,NavDataCollection::ROLL),
-                                navcollection->GetReferenceValue(i,NavDataCollection::PITCH),
-                                navcollection->GetReferenceValue(i,NavDataCollection::HEADING));
+      nthreads=1;
+      Run(0);
    }
+   else
+      RunOnThreads(nthreads);
+}
+
+//-------------------------------------------------------------------------
+// Function run on each thread - applies the lever arm to this threads block
+//-------------------------------------------------------------------------
+void LeverarmTask::Run(const unsigned int threadindex)
+{
+   const unsigned long first=(nscans*threadindex)/nthreads;
+   const unsigned long last=(nscans*(threadindex+1))/nthreads;
+
+   const double* roll=navcollection->GetChannel(NavDataCollection::ROLL);
+   const double* pitch=navcollection->GetChannel(NavDataCollection::PITCH);
+   const double* heading=navcollection->GetChannel(NavDataCollection::HEADING);
+   double* lat=navcollection->GetChannel(NavDataCollection::LAT);
+   double* lon=navcollection->GetChannel(NavDataCollection::LON);
+   double* hei=navcollection->GetChannel(NavDataCollection::HEI);
+   leverarm->ApplyLeverArm(roll+first,pitch+first,heading+first,lat+first,lon+first,hei+first,last-first);
 }
 
 //-------------------------------------------------------------------------
 // Function to add on the lever arm offsets to the per scan position data
 //-------------------------------------------------------------------------
-void NavigationInterpolator::ApplyLeverarm(Leverarm* leverarm)
+void NavigationInterpolator::ApplyLeverarm(const Leverarm* const leverarm)
 {
    //For each epoch (a scan line of data) we need to apply the lever arm
    //onto the GPS position, the lever arm will be different for each epoch
    //depending on the roll, pitch, heading of the aircraft
-
-   for(unsigned int i=0;i<nscans;i++)
-   {
-      leverarm->ApplyLeverArm(navcollection->GetValue(i,NavDataCollection::ROLL),navcollection->GetValue(i,NavDataCollection::PITCH),
-                              navcollection->GetValue(i,NavDataCollection::HEADING),
-                              navcollection->GetReferenceValue(i,NavDataCollection::LAT),
-                              navcollection->GetReferenceValue(i,NavDataCollection::LON),
-                              navcollection->GetReferenceValue(i,NavDataCollection::HEI));
-   }
+   LeverarmTask task(leverarm,navcollection,nscans);
+   task.Apply(maxthreads);
 }
 
 //-------------------------------------------------------------------------
 // Function to apply a shift between the position and attitude data
 // that keeps the position the same but moves the attitude data
 //-------------------------------------------------------------------------
-void NavigationInterpolator::PosAttShift(void (*f)(const double*,const int,DataHandler*,NavDataCollection*,std::string,std::string),const double toffset)
+void NavigationInterpolator::PosAttShift(void (*f)(const double*,const int,DataHandler*,NavDataCollection*,std::string,std::string,const unsigned int),const double toffset)
 {
    //Create a temporary navdataline object to hold the shifted data
    NavDataCollection tmpnavdata(this->nscans);
@@ -285,7 +453,7 @@ void NavigationInterpolator::PosAttShift(void (*f)(const double*,const int,DataH
       times[i]=this->navcollection->GetValue(i,NavDataCollection::TIME)+toffset;
 
    //Call the interpolation function, storing the result in tmpnavdata
-   f(times,this->nscans,this->dhandle,&tmpnavdata,this->gpsstarttime,this->gpsstoptime);
+   f(times,this->nscans,this->dhandle,&tmpnavdata,this->gpsstarttime,this->gpsstoptime,maxthreads);
 
    //Now copy the attitude data from the tmp to "proper" storage cells
    for(unsigned int i=0;i<this->nscans;i++)
@@ -31,8 +31,14 @@ class NavigationInterpolator
 public:
    //default constructor
    NavigationInterpolator();
-   //constructor taking input nav data and lev1 filenames
-   NavigationInterpolator(std::string navfilename,std::string lev1filename);
+   //constructor taking input nav data and lev1 filenames - and optionally a time 
+   //window (plus padding records) of the nav data to load if end > start and a
+   //binary cache file to read SBET/SOL data through
+   NavigationInterpolator(std::string navfilename,std::string lev1filename,const double windowstart=0,const double windowend=0,
+                          const unsigned long windowpadrecords=0,const std::string navcachefilename="");
+   //constructor taking navigation that has already been read in - this is not deleted
+   //by the interpolator so that it can be shared between the lines of a flight
+   NavigationInterpolator(DataHandler* const navigation,std::string lev1filename);
    //destructor
    ~NavigationInterpolator();
 
@@ -41,28 +47,36 @@ public:
    void WriteFlags(std::string outfilename,std::string extrainfo="");
    //Function to interpolate the navigation data to the level 1 scan times
    //void Interpolate(void (*f)(double,DataHandler*,NavDataLine*,std::string,std::string));
-   void Interpolate(void (*f)(const double*,const int,DataHandler*,NavDataCollection*,std::string,std::string));
+   void Interpolate(void (*f)(const double*,const int,DataHandler*,NavDataCollection*,std::string,std::string,const unsigned int));
    //Function to interpolate the navigation data to time t
    //void Interpolate(const double t, void (*f)(double,DataHandler*,NavDataLine*,std::string,std::string),NavDataLine* store);
    //Function to assign scan line times
    void SetTimes(const double* const times);
    //Function to apply boresight offsets to scanline data
-   void ApplyBoresight(Boresight* boresight);
+   void ApplyBoresight(const Boresight* const boresight);
    //Function to apply leverarm offsets to scanline data
-   void ApplyLeverarm(Leverarm* leverarm);
+   void ApplyLeverarm(const Leverarm* const leverarm);
    //Function to smooth the navigation data (use for the raw data)
    //void Smooth(void (*f)(const unsigned long ,DataHandler* ,NavDataLine* ,const int),const int element, NavDataLine* store);
    //NavDataLine* Smooth(void (*f)(const unsigned long ,DataHandler* ,NavDataLine* ,const int));
-   void SmoothNavData(void (*f)(const unsigned long ,DataHandler* ,NavDataLine* ,const int),const unsigned int smoothkernelsize){dhandle->Smooth(f,smoothkernelsize);};
+   void SmoothNavData(void (*f)(const double* const,double* const,const unsigned long,const int),const unsigned int smoothkernelsize){dhandle->Smooth(f,smoothkernelsize);};
    //Apply a shift between the positions and attitude data
-   void PosAttShift(void (*f)(const double*,const int,DataHandler*,NavDataCollection*,std::string,std::string),const double toffset);
+   void PosAttShift(void (*f)(const double*,const int,DataHandler*,NavDataCollection*,std::string,std::string,const unsigned int),const double toffset);
    //Check the plausibilty of the interpolated data
    void CheckPlausibility();
+   //Limit the number of threads used to interpolate and apply the lever arm (0 for one per processor)
+   void SetMaxThreads(const unsigned int n){maxthreads=n;}
+   //Create a handler for the navigation file and read in the (optional) time window of it
+   static DataHandler* LoadNavigation(std::string navfilename,const double windowstart=0,const double windowend=0,
+                                      const unsigned long windowpadrecords=0,const std::string navcachefilename="");
 private:
    //Function to set up the navdataline and scanid arrays
    void SetupArrays();
+   //Function to read nscans and the start/stop times from the lev1 hdr file
+   void ReadLevel1Header(std::string lev1filename);
    //Handle the input nav data
    DataHandler* dhandle;
+   bool ownsdhandle; //false if dhandle is shared and deleted elsewhere
    //Store the interpolated per scan line data
 //   NavDataLine* navdata;
    NavDataCollection* navcollection;
@@ -71,8 +85,11 @@ private:
    unsigned long nscans; // number of scan lines from level 1 hdr file
    std::string gpsstarttime; //Strings of the start and stop times from the hdr
    std::string gpsstoptime;
+   unsigned int maxthreads; //maximum threads to use, 0 for one per processor
 
-   FILETYPE DetectFileType(std::string filename);
+   static FILETYPE DetectFileType(std::string filename);
+   //Create the cache file for the SBET/SOL file if it is missing or out of date
+   static bool UpdateNavigationCache(const std::string navfilename,const FILETYPE ftype,const std::string navcachefilename);
 };
 
 #endif
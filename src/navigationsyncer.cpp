@@ -384,20 +384,20 @@ void NavigationSyncer::CompareLev1ToNavTimes(double first_scan_time)
 
    //Do some comparisons
    // if the end time of the nav data is greater than the start time from the lev1 header
-   if(navfile->GetLine(navfile->GetNumEntries()-1)->time < lev1starttime)
+   if(navfile->GetLine(navfile->GetNumEntries()-1).time < lev1starttime)
    {
-         throw "Error: The level-1 start time is after the end of the navigation data: nav end time: "+ToString(navfile->GetLine(navfile->GetNumEntries()-1)->time)+" lev 1 time: "+ToString(lev1starttime);
+         throw "Error: The level-1 start time is after the end of the navigation data: nav end time: "+ToString(navfile->GetLine(navfile->GetNumEntries()-1).time)+" lev 1 time: "+ToString(lev1starttime);
    }
    //Test if data is more than a day (of week) out from both start and end times of nav data
-   if((fabs(navfile->GetLine(0)->time - lev1starttime) > numsecsperday )&&(fabs(navfile->GetLine(navfile->GetNumEntries()-1)->time - lev1starttime) > numsecsperday))
+   if((fabs(navfile->GetLine(0).time - lev1starttime) > numsecsperday )&&(fabs(navfile->GetLine(navfile->GetNumEntries()-1).time - lev1starttime) > numsecsperday))
    {
       throw "Error: The level-1 start time is on a different week day to both the navigation start time and end times";
    }
-   else if (fabs(navfile->GetLine(0)->time - lev1starttime) > numsecsperday)
+   else if (fabs(navfile->GetLine(0).time - lev1starttime) > numsecsperday)
    {
       Logger::Warning("The level-1 start time is on a different week day to the navigation start time.");
    }
-   else if(fabs(navfile->GetLine(navfile->GetNumEntries()-1)->time - lev1starttime) > numsecsperday)
+   else if(fabs(navfile->GetLine(navfile->GetNumEntries()-1).time - lev1starttime) > numsecsperday)
    {
       Logger::Warning("The level-1 start time is on a different week day to the navigation end time.");
    }
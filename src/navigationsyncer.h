@@ -65,6 +65,8 @@ public:
    void FindScanTimes();
    //Function to return a pointer to the times array
    double* PtrToTimes(){return time;};
+   //Function to return the number of scan times
+   unsigned long NumScans()const{return nscans;}
    //Function to apply a time shift to the data
    void ApplyTimeShift(const double shift);
    //Function to apply Lead seconds
@@ -436,12 +436,8 @@ int main (int argc, char* argv[])
    unsigned int number_of_scans=inNav->GetNumEntries();
 
    //get the start and end times of the nav data
-   NavDataLine* navdata=NULL;
-   navdata=inNav->GetLine(0);
-   double start_time=navdata->time;
-
-   navdata=inNav->GetLine(number_of_scans-1);
-   double end_time=navdata->time;
+   double start_time=inNav->GetLine(0).time;
+   double end_time=inNav->GetLine(number_of_scans-1).time;
 
    //Get the scan separation (= 1 / fps)
    if(fps != 0)
@@ -514,7 +510,7 @@ int main (int argc, char* argv[])
    Logger::Log("Interpolating data to new times...");
    try
    {
-      Linear(offset_times,number_of_offset_scans,inNav,&interpolated_nav,"","");
+      Linear(offset_times,number_of_offset_scans,inNav,&interpolated_nav,"","",1);
    }
    catch(std::string e)
    {
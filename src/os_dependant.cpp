@@ -8,7 +8,10 @@
 //If not, please contact arsf-processing@pml.ac.uk 
 //-------------------------------------------------------------------------
 
+#include <exception>
+
 #include "os_dependant.h"
+#include "binaryreader.h"
 
 //-------------------------------------------------------------------------
 //Constructor - create new databuffer struct
@@ -85,6 +88,116 @@ uint64_t DiskSpace::GetTotalSpace(std::string diskname)
 }
 
 
+//-------------------------------------------------------------------------
+//Constructor for FileStatus - get the size and modification time of file
+//-------------------------------------------------------------------------
+FileStatus::FileStatus(const std::string filename)
+{
+   exists=false;
+   size=0;
+   modificationtime=0;
+   #ifdef _W32
+   {
+      WIN32_FILE_ATTRIBUTE_DATA attributes;
+      if(GetFileAttributesEx(filename.c_str(),GetFileExInfoStandard,&attributes))
+      {
+         exists=true;
+         size=((uint64_t)attributes.nFileSizeHigh<<32) + attributes.nFileSizeLow;
+         modificationtime=((int64_t)attributes.ftLastWriteTime.dwHighDateTime<<32) + attributes.ftLastWriteTime.dwLowDateTime;
+      }
+   }
+   #else
+   {
+      struct stat status;
+      if(stat(filename.c_str(),&status)==0)
+      {
+         exists=true;
+         size=status.st_size;
+         modificationtime=status.st_mtime;
+      }
+   }
+   #endif
+}
+
+//-------------------------------------------------------------------------
+//Constructor for MappedFile - map the file into memory, throws on failure
+//-------------------------------------------------------------------------
+MappedFile::MappedFile(const std::string filename)
+{
+   data=NULL;
+   size=0;
+   #ifdef _W32
+   {
+      mapping=NULL;
+      file=CreateFile(filename.c_str(),GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+      if(file==INVALID_HANDLE_VALUE)
+         throw "Failed to open file for mapping: "+filename;
+      LARGE_INTEGER filesize;
+      GetFileSizeEx(file,&filesize);
+      size=filesize.QuadPart;
+      if(size!=0)
+      {
+         mapping=CreateFileMapping(file,NULL,PAGE_READONLY,0,0,NULL);
+         if(mapping!=NULL)
+            data=static_cast<const char*>(MapViewOfFile(mapping,FILE_MAP_READ,0,0,0));
+         if(data==NULL)
+         {
+            if(mapping!=NULL)
+               CloseHandle(mapping);
+            CloseHandle(file);
+            throw "Failed to map file into memory: "+filename;
+         }
+      }
+   }
+   #else
+   {
+      int fd=open(filename.c_str(),O_RDONLY);
+      if(fd<0)
+         throw "Failed to open file for mapping: "+filename;
+      struct stat status;
+      if(fstat(fd,&status)!=0)
+      {
+         close(fd);
+         throw "Failed to get size of file for mapping: "+filename;
+      }
+      size=status.st_size;
+      if(size!=0)
+      {
+         void* mapped=mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+         if(mapped==MAP_FAILED)
+         {
+            close(fd);
+            throw "Failed to map file into memory: "+filename;
+         }
+         data=static_cast<const char*>(mapped);
+      }
+      //The mapping remains valid after the file is closed
+      close(fd);
+   }
+   #endif
+}
+
+//-------------------------------------------------------------------------
+//Destructor for MappedFile - unmap the file
+//-------------------------------------------------------------------------
+MappedFile::~MappedFile()
+{
+   #ifdef _W32
+   {
+      if(data!=NULL)
+         UnmapViewOfFile(data);
+      if(mapping!=NULL)
+         CloseHandle(mapping);
+      CloseHandle(file);
+   }
+   #else
+   {
+      if(data!=NULL)
+         munmap(const_cast<char*>(data),size);
+   }
+   #endif
+}
+
 //-------------------------------------------------------------------------
 //Constructor for ComputerInfo class
 //-------------------------------------------------------------------------
@@ -174,3 +287,140 @@ std::string ComputerInfo::GetOutput()
    return strout.str();
 }
 
+//-------------------------------------------------------------------------
+//Return the ID of the running process
+//-------------------------------------------------------------------------
+unsigned long ComputerInfo::ProcessID()
+{
+   #ifdef _W32
+      return GetCurrentProcessId();
+   #else
+      return getpid();
+   #endif
+}
+
+
+//-------------------------------------------------------------------------
+//Constructor for ThreadedTask class
+//-------------------------------------------------------------------------
+ThreadedTask::ThreadedTask()
+{
+   error="";
+}
+
+//-------------------------------------------------------------------------
+//Destructor for ThreadedTask class - derived classes should call Join
+//before they are destroyed as Run() is a member of the derived class
+//-------------------------------------------------------------------------
+ThreadedTask::~ThreadedTask()
+{
+   for(std::vector<pthread_t>::iterator it=threads.begin();it!=threads.end();it++)
+      pthread_join(*it,NULL);
+}
+
+//-------------------------------------------------------------------------
+//Start nthreads threads each running the Run() function
+//-------------------------------------------------------------------------
+void ThreadedTask::Start(const unsigned int nthreads)
+{
+   if(Running())
+      throw "Cannot start threads for a task that is already running.";
+   if(nthreads==0)
+      throw "Number of threads to start must be greater than 0.";
+
+   error="";
+   //Reserve the arguments first so that the pointers passed to the threads remain valid
+   threadargs.resize(nthreads);
+   for(unsigned int t=0;t<nthreads;t++)
+   {
+      threadargs[t].task=this;
+      threadargs[t].index=t;
+      pthread_t thread;
+      if(pthread_create(&thread,NULL,ThreadEntry,&(threadargs[t]))!=0)
+      {
+         //Could not create the thread - wait for the ones we did create and report
+         Join();
+         throw "Failed to create thread number "+ToString(t)+" of "+ToString(nthreads);
+      }
+      threads.push_back(thread);
+   }
+}
+
+//-------------------------------------------------------------------------
+//Wait for all the threads to finish and rethrow the first error (if any)
+//-------------------------------------------------------------------------
+void ThreadedTask::Join()
+{
+   for(std::vector<pthread_t>::iterator it=threads.begin();it!=threads.end();it++)
+      pthread_join(*it,NULL);
+   threads.clear();
+   threadargs.clear();
+
+   if(error.compare("")!=0)
+   {
+      std::string e=error;
+      error="";
+      throw e;
+   }
+}
+
+//-------------------------------------------------------------------------
+//Function passed to pthread_create - calls Run and stores any error
+//-------------------------------------------------------------------------
+void* ThreadedTask::ThreadEntry(void* args)
+{
+   ThreadArgs* targs=static_cast<ThreadArgs*>(args);
+   std::string e="";
+   try
+   {
+      targs->task->Run(targs->index);
+   }
+   catch(std::string s)
+   {
+      e=s;
+   }
+   catch(const char* s)
+   {
+      e=std::string(s);
+   }
+   catch(BinaryReader::BRexception s)
+   {
+      e=std::string(s.what())+"\n"+s.info;
+   }
+   catch(std::exception& s)
+   {
+      e=std::string(s.what());
+   }
+   catch(...)
+   {
+      e="Unknown error occurred on thread "+ToString(targs->index);
+   }
+
+   if(e.compare("")!=0)
+   {
+      //Only keep the first error to occur
+      ScopedLock lock(targs->task->errormutex);
+      if(targs->task->error.compare("")==0)
+         targs->task->error=e;
+   }
+   return NULL;
+}
+
+//-------------------------------------------------------------------------
+//Return the number of processors available or 1 if unknown
+//-------------------------------------------------------------------------
+unsigned int ThreadedTask::NumberOfProcessors()
+{
+   #ifdef _W32
+   {
+      SYSTEM_INFO si;
+      GetSystemInfo(&si);
+      return (si.dwNumberOfProcessors > 0) ? si.dwNumberOfProcessors : 1;
+   }
+   #else
+   {
+      long n=sysconf(_SC_NPROCESSORS_ONLN);
+      return (n > 0) ? static_cast<unsigned int>(n) : 1;
+   }
+   #endif
+}
@@ -15,6 +15,8 @@
 #include <iostream>
 #include <string>
 #include <stdint.h>
+#include <vector>
+#include <pthread.h> //For Mutex, Condition and ThreadedTask classes (winpthreads under mingw)
 #include "commonfunctions.h"
 #include "logger.h"
 
@@ -24,6 +26,10 @@
 #else
    #include <sys/statvfs.h> //For DiskSpace class
    #include <sys/utsname.h> //For ComputerInfo class
+   #include <unistd.h> //For number of processors
+   #include <sys/stat.h> //For FileStatus class
+   #include <sys/mman.h> //For MappedFile class
+   #include <fcntl.h>
 #endif
 
 //-------------------------------------------------------------------------
@@ -57,10 +63,154 @@ public:
    ~ComputerInfo();
    
    std::string GetOutput();
+   //ID of the running process
+   static unsigned long ProcessID();
 
 private:
    std::string host,domain,machine,system,version,release;
 };
 
+//-------------------------------------------------------------------------
+// Class to get the size and last modification time of a file
+//-------------------------------------------------------------------------
+class FileStatus
+{
+public:
+   FileStatus(const std::string filename);
+
+   bool Exists()const{return exists;}
+   uint64_t Size()const{return size;}
+   //Modification time - only for comparing with another FileStatus
+   int64_t ModificationTime()const{return modificationtime;}
+
+private:
+   bool exists;
+   uint64_t size;
+   int64_t modificationtime;
+};
+
+//-------------------------------------------------------------------------
+// Class to map a whole file read-only into memory
+//-------------------------------------------------------------------------
+class MappedFile
+{
+public:
+   MappedFile(const std::string filename);
+   ~MappedFile();
+
+   const char* Data()const{return data;}
+   uint64_t Size()const{return size;}
+
+private:
+   const char* data;
+   uint64_t size;
+   #ifdef _W32
+      HANDLE file;
+      HANDLE mapping;
+   #endif
+   //Do not allow copying of a mapping
+   MappedFile(const MappedFile&);
+   MappedFile& operator=(const MappedFile&);
+};
+
+//-------------------------------------------------------------------------
+// Class to wrap a (optionally recursive) mutex
+//-------------------------------------------------------------------------
+class Mutex
+{
+public:
+   Mutex(bool recursive=false)
+   {
+      pthread_mutexattr_t attr;
+      pthread_mutexattr_init(&attr);
+      if(recursive)
+         pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+      pthread_mutex_init(&mutex,&attr);
+      pthread_mutexattr_destroy(&attr);
+   }
+   ~Mutex(){pthread_mutex_destroy(&mutex);}
+
+   void Lock(){pthread_mutex_lock(&mutex);}
+   void Unlock(){pthread_mutex_unlock(&mutex);}
+
+private:
+   friend class Condition;
+   pthread_mutex_t mutex;
+   //Do not allow copying of a mutex
+   Mutex(const Mutex&);
+   Mutex& operator=(const Mutex&);
+};
+
+//-------------------------------------------------------------------------
+// Class to lock a mutex for the lifetime of the object
+//-------------------------------------------------------------------------
+class ScopedLock
+{
+public:
+   ScopedLock(Mutex& m):mutex(m){mutex.Lock();}
+   ~ScopedLock(){mutex.Unlock();}
+private:
+   Mutex& mutex;
+   ScopedLock(const ScopedLock&);
+   ScopedLock& operator=(const ScopedLock&);
+};
+
+//-------------------------------------------------------------------------
+// Class to wrap a condition variable - Wait must be called with the
+// mutex locked
+//-------------------------------------------------------------------------
+class Condition
+{
+public:
+   Condition(){pthread_cond_init(&cond,NULL);}
+   ~Condition(){pthread_cond_destroy(&cond);}
+
+   void Wait(Mutex& m){pthread_cond_wait(&cond,&(m.mutex));}
+   void Signal(){pthread_cond_signal(&cond);}
+   void Broadcast(){pthread_cond_broadcast(&cond);}
+
+private:
+   pthread_cond_t cond;
+   Condition(const Condition&);
+   Condition& operator=(const Condition&);
+};
+
+//-------------------------------------------------------------------------
+// Base class for a task to run on a number of threads. Derived classes
+// implement Run() which is called once on each thread with the index of
+// that thread. Errors thrown from Run() are rethrown as a std::string
+// from Join().
+//-------------------------------------------------------------------------
+class ThreadedTask
+{
+public:
+   ThreadedTask();
+   virtual ~ThreadedTask();
+
+   void Start(const unsigned int nthreads);
+   void Join();
+   void RunOnThreads(const unsigned int nthreads){Start(nthreads);Join();}
+   bool Running()const{return (threads.size()!=0);}
+
+   static unsigned int NumberOfProcessors();
+
+protected:
+   virtual void Run(const unsigned int threadindex)=0;
+
+private:
+   struct ThreadArgs
+   {
+      ThreadedTask* task;
+      unsigned int index;
+   };
+
+   static void* ThreadEntry(void* args);
+
+   std::vector<pthread_t> threads;
+   std::vector<ThreadArgs> threadargs;
+   Mutex errormutex;
+   std::string error;
+};
+
 
 #endif
@@ -30,7 +30,7 @@ const std::string DESCRIPTION="Radiometric Calibration Software";
 //-------------------------------------------------------------------------
 //Number of options that can be on command line
 //-------------------------------------------------------------------------
-const int number_of_possible_options = 22;
+const int number_of_possible_options = 27;
 
 //-------------------------------------------------------------------------
 //Option names that can be on command line
@@ -56,6 +56,11 @@ const std::string availableopts[number_of_possible_options]={
 "-corruptscans",
 "-qcfailures",
 "-darkforce",
+"-threads",
+"-blocklines",
+"-frameindex",
+"-bandlist",
+"-stats",
 "-help"
 };  
 
@@ -83,6 +88,11 @@ const std::string optsdescription[number_of_possible_options]={
 "A space separated list of scan lines to ignore and mark as corrupt.",
 "Give a filename containing a list of space separated band sample pairs (one pair per line) of pixels to mask as QCFailure. NOTE these pixels are in the raw data geometry with band/sample starting from 0.",
 "Force the use of the autodarkstartline number given in the hdr file. If using this please check first that it is correct - this should be used as a last resort.",
+"Number of threads to use to calibrate the scan lines. Default is 1 (2 for Fenix so that VNIR and SWIR are calibrated concurrently).",
+"Number of raw scan lines to read from disk at a time. Default is 32.",
+"Write the frame counters of the raw file to a sidecar index file (<raw file>.frameindex). If an index file matching the raw file (size, lines and modification time) exists it is used in place of reading the counters from the raw file, and an index file that does not match is rewritten.",
+"A space separated list of raw bands (starting from 0) to calibrate and output. Default is to output all bands.",
+"Output per band statistics (valid/ignored counts, minimum, maximum, mean and standard deviation) of the calibrated data to the hdr file. Follow with 'sidecar' to write them to a separate <output>.stats text file instead. Default is no statistics.",
 "Show this help text."
 }; 
 
@@ -113,6 +123,7 @@ int main(int argc,char* argv[])
 
    unsigned int number_of_corrupt_lines=0;
    unsigned int* corrupt_lines=NULL;
+   std::vector<unsigned int> bandlist; //raw bands to calibrate - empty for all bands
 
    bool OUTPUT_AVERAGED_DARKFRAMES=false;
    bool OUTPUT_BINNED_GAINS=false;
@@ -132,6 +143,16 @@ int main(int argc,char* argv[])
    //Do we want to force the use of autodarkstart frame number
    bool DARKFORCE=false;
 
+   //Number of threads to calibrate lines on - 0 means use the default for the sensor
+   unsigned int numthreads=0;
+
+   //Number of raw lines to read in one go
+   unsigned int blocklines=32;
+
+   //Do we want per band statistics of the calibrated data, and in a sidecar file rather than the hdr
+   bool DO_STATISTICS=false;
+   bool STATISTICS_TO_SIDECAR=false;
+
    Logger log; //create logger to terminal only
    std::stringstream strout; //string to hold text messages in
 
@@ -344,6 +365,21 @@ int main(int argc,char* argv[])
          Logger::Warning("These "+ToString(number_of_corrupt_lines)+"lines will be marked as corrupt and set to 0 in output file: "+cl->GetArg("-corruptscans"));
       }
 
+      //----------------------------------------------------------------------
+      // Get the subset of raw bands to calibrate and output
+      //----------------------------------------------------------------------
+      if(cl->OnCommandLine("-bandlist"))
+      {
+         if(cl->NumArgsOfOpt("-bandlist")==0)
+         {
+            throw CommandLine::CommandLineException("-bandlist should immediately preceed a list of raw bands to calibrate.");
+         }
+         for(int i=0;i<cl->NumArgsOfOpt("-bandlist");i++)
+         {
+            bandlist.push_back(StringToUINT(cl->GetArg("-bandlist",i)));
+         }
+      }
+
       //----------------------------------------------------------------------
       // Get a filename containing pixels to be masked with QCFailure flag
       //----------------------------------------------------------------------
@@ -378,6 +414,56 @@ int main(int argc,char* argv[])
          DARKFORCE=false;
       }
 
+      //----------------------------------------------------------------------
+      // Get the number of threads to calibrate the lines on
+      //----------------------------------------------------------------------
+      if(cl->OnCommandLine("-threads"))
+      {
+         if(cl->NumArgsOfOpt("-threads")!=1)
+         {
+            throw CommandLine::CommandLineException("-threads should immediately preceed the number of threads to use. Got: "+cl->GetArg("-threads"));      
+         }
+         numthreads=StringToUINT(TrimWhitespace(cl->GetArg("-threads")));
+         if(numthreads==0)
+         {
+            throw CommandLine::CommandLineException("-threads should be at least 1. Got: "+cl->GetArg("-threads"));      
+         }
+      }
+
+      //----------------------------------------------------------------------
+      // Get the number of raw lines to read at a time
+      //----------------------------------------------------------------------
+      if(cl->OnCommandLine("-blocklines"))
+      {
+         if(cl->NumArgsOfOpt("-blocklines")!=1)
+         {
+            throw CommandLine::CommandLineException("-blocklines should immediately preceed the number of lines to read at a time. Got: "+cl->GetArg("-blocklines"));      
+         }
+         blocklines=StringToUINT(TrimWhitespace(cl->GetArg("-blocklines")));
+         if(blocklines==0)
+         {
+            throw CommandLine::CommandLineException("-blocklines should be at least 1. Got: "+cl->GetArg("-blocklines"));      
+         }
+      }
+
+      //----------------------------------------------------------------------
+      // Get whether to keep per band statistics of the calibrated data
+      //----------------------------------------------------------------------
+      if(cl->OnCommandLine("-stats"))
+      {
+         if(cl->NumArgsOfOpt("-stats")==0)
+            DO_STATISTICS=true;
+         else if((cl->NumArgsOfOpt("-stats")==1)&&(TrimWhitespace(cl->GetArg("-stats")).compare("sidecar")==0))
+         {
+            DO_STATISTICS=true;
+            STATISTICS_TO_SIDECAR=true;
+         }
+         else
+         {
+            throw CommandLine::CommandLineException("-stats should be given on its own or followed by 'sidecar'. Got: "+cl->GetArg("-stats"));      
+         }
+      }
+
 
 
       //----------------------------------------------------------------------
@@ -492,6 +578,18 @@ int main(int argc,char* argv[])
   
       job->SetTask(MainWorker::flip_bands,DO_FLIP_BANDS);
       job->SetTask(MainWorker::flip_samples,DO_FLIP_SAMPLES);
+
+      //Set the number of threads to calibrate lines on. By default Fenix uses
+      //one per subsensor so the VNIR and SWIR parts of a frame are done together
+      if(numthreads==0)
+      {
+         if(CheckSensorID(FENIX,job->sensor->SensorID()))
+            numthreads=2;
+         else
+            numthreads=1;
+      }
+      job->SetNumThreads(numthreads);
+      job->SetStatistics(DO_STATISTICS,STATISTICS_TO_SIDECAR);
          
       //----------------------------------------------------------------------
       //Set the limits of the number of lines to process
@@ -534,6 +632,13 @@ int main(int argc,char* argv[])
       //this also sets up all the arrays required based on the job tasks
       //----------------------------------------------------------------------
       job->InitialiseCalibration(strCalibFileName,strDarkFileName,strQCFailureFileName);
+      job->cal->SetReadBlockLines(blocklines);
+      if(!bandlist.empty())
+         job->cal->SetBandList(bandlist);
+
+      //Save the frame counters so later runs need not read them from the raw file
+      if(cl->OnCommandLine("-frameindex"))
+         job->sensor->WriteFrameCounterIndex();
 
       Logger::Log("Number of frames of image (minus dark frames) should be: "+ToString(job->sensor->GetNumImageFrames()));
       Logger::Log("Number of dark frames is: "+ToString(job->sensor->GetNumDarkFrames()));      
@@ -672,6 +777,11 @@ int main(int argc,char* argv[])
             linecorrupt=false;
       }
 
+      //----------------------------------------------------------------------
+      // Write out any lines still being calibrated on other threads
+      //----------------------------------------------------------------------
+      job->FinishCalibration();
+
       //----------------------------------------------------------------------
       // Do we want to output the binned gain values
       //----------------------------------------------------------------------
@@ -102,6 +102,56 @@ std::string SpecimBinFile::TestFile()
    return br->FromHeader("sensorid");
 }
 
+//-------------------------------------------------------------------------
+// Convert nbands bands, starting from firstband, of a raw frame (as read 
+// by ReadFrames) to doubles or floats
+//-------------------------------------------------------------------------
+template<class T>
+void SpecimBinFile::ConvertFrame(char* const frame,T* const values,const unsigned int firstband,const unsigned int nbands)
+{
+   const uint64_t offset=firstband*NumSamples();
+   const uint64_t numtoconvert=nbands*NumSamples();
+
+   if(GetDataType()==12)
+   {
+      //16 bit unsigned - the usual raw data type, convert directly so that
+      //the compiler can vectorise the loop
+      const unsigned short int* const usip=reinterpret_cast<const unsigned short int*>(frame)+offset;
+      for(uint64_t i=0;i<numtoconvert;i++)
+         values[i]=static_cast<T>(usip[i]);
+   }
+   else
+   {
+      for(uint64_t i=0;i<numtoconvert;i++)
+         values[i]=static_cast<T>(br->DerefToDouble(&frame[(offset+i)*GetDataSize()]));
+   }
+}
+
+void SpecimBinFile::FrameToValues(char* const frame,double* const values,const unsigned int firstband,const unsigned int nbands)
+{
+   ConvertFrame(frame,values,firstband,nbands);
+}
+
+void SpecimBinFile::FrameToValues(char* const frame,float* const values,const unsigned int firstband,const unsigned int nbands)
+{
+   ConvertFrame(frame,values,firstband,nbands);
+}
+
+//-------------------------------------------------------------------------
+// Read the frame counter (band 0, sample 0 of the raw file) of every line
+// in a single pass down the file, only reading band 0 of each frame
+//-------------------------------------------------------------------------
+void SpecimBinFile::ReadFrameCounters(std::vector<double>& counters)
+{
+   counters.resize(br->NumLines());
+   std::vector<char> chdata(br->NumSamples()*br->GetDataSize());
+   for(unsigned int line=0;line<counters.size();line++)
+   {
+      br->Readbandline(&chdata[0],0,line);
+      counters[line]=br->DerefToDouble(&chdata[0]);
+   }
+}
+
 //-------------------------------------------------------------------------
 // EagleHawkBinFile Constructor
 //-------------------------------------------------------------------------
@@ -521,8 +571,8 @@ unsigned short Specim::TotalMissingFrames(const unsigned int start, const unsign
    //Updating end to be end-1 as we only process in the main loop from start < end (not start <= end)
    unsigned int newend=end-1;
 
-   double first=bin->ReadCell(0,start,0);
-   double last=bin->ReadCell(0,newend,0);
+   double first=FrameCounter(start);
+   double last=FrameCounter(newend);
 
    if((last > first)&&((newend-start)<MAXFRAMECOUNT))
    {
@@ -554,307 +604,430 @@ unsigned short Specim::TotalMissingFrames(const unsigned int start, const unsign
 }
 
 //-------------------------------------------------------------------------
-// Function to read in the dark frames and return in dlstorage
+// Return the frame counter of the given line. The counters of all lines are
+// loaded on the first call so that the per line checks need no file reads
 //-------------------------------------------------------------------------
-void Specim::ReadInAllDarkFrames(double* dlstorage,std::string externalFileName,uint64_t linecellsize,unsigned int subsensor)
+double Specim::FrameCounter(const unsigned int line)
 {
-   //Check the linecellsize - this is the number of cells of 1 line of the dlstorage array (i.e. numsamples*nbands)
-   //has a default value of 0 meaning to use file dimensions   
+   if(framecounters.empty())
+      LoadFrameCounters();
 
-   if(externalFileName.compare("")==0)
-   {
-      if(linecellsize==0)
-         linecellsize=NumSamples()*NumBands();
-
-      if(linecellsize!=NumSamples()*NumBands())
-         Logger::Log("Reading in dark frames using an array of different size to number of samples * number of bands. This should only happen for Fenix sensors.");
+   if(line>=framecounters.size())
+      throw "Requested frame counter of line beyond end of raw file: "+ToString(line);
 
-      //Read in numdarklines of data
-      for(unsigned int dl=0;dl<this->ndarklines;dl++)
-      {
-         bin->ReadlineToDoubles(&dlstorage[dl*linecellsize],darklinestart+dl);    
-      }
-   }
-   else
-   {
-      //Read dark frames from another file
-      //First try to open the BIL/BSQ file
-      SpecimBinFile* dark=NULL;
-      //If we're looking at a fenix raw file then we expect fenix dark frames - we need a fenix bil reader to read them
-      if(CheckSensorID(FENIX,SENSOR_ID))
-      {
-         dark=new FenixBinFile(externalFileName);
-      }
-      else
-      {
-         dark=new SpecimBinFile(externalFileName);
-      }
+   return framecounters[line];
+}
 
-      //Set up data arrays
-      //Get the size in bytes of 1 lines worth of data (for all bands)
-      unsigned int nsamples=StringToUINT(dark->FromHeader("samples"));
-      unsigned int nbands=StringToUINT(dark->FromHeader("bands"));
-      unsigned int nlines=StringToUINT(dark->FromHeader("lines"));
+//-------------------------------------------------------------------------
+// Load the frame counters - from the sidecar index file if there is a valid
+// one, else from the raw file. An index file that is out of date is then
+// rewritten so that later runs can use it.
+//-------------------------------------------------------------------------
+void Specim::LoadFrameCounters()
+{
+   const bool haveindex=FileStatus(FrameCounterIndexFilename()).Exists();
+   if((haveindex)&&(ReadFrameCounterIndex()))
+      return;
 
-      if(linecellsize==0)
-         linecellsize=nsamples*nbands;
+   Logger::Log("Reading frame counters from raw file.");
+   bin->ReadFrameCounters(framecounters);
 
-      if(linecellsize!=nsamples*nbands)
+   if(haveindex)
+   {
+      try
       {
-         Logger::Log("Reading in dark frames using an array of different size to number of samples * number of bands. This should only happen for Fenix sensors.");
-         //Open up for reading specific subsensor as defined by the subsensor parameter
-         dark->SetSubSensor(subsensor);
+         WriteFrameCounterIndex();
       }
-
-      //Read in darklines from file 
-      Logger::Log("Reading in dark lines...");
-
-      //For each line of data
-      for(unsigned int line=0;line<nlines;line++)
+      catch(std::string e)
       {
-         //Read in the line of data for all bands
-         dark->ReadlineToDoubles(&dlstorage[line*linecellsize],line); 
+         Logger::Warning("Failed to rewrite out of date frame counter index file: "+e);
       }
-      delete dark;
    }
 }
 
 //-------------------------------------------------------------------------
-// Function to average all the dark frames into data array
+// Read the frame counters from the sidecar index file. Returns false if 
+// there is no index file or it does not match the raw file (size, number
+// of lines and modification time)
 //-------------------------------------------------------------------------
-void Specim::AverageAllDarkFrames(double* const data,std::string externalFileName,uint64_t linecellsize,unsigned int subsensor)
+bool Specim::ReadFrameCounterIndex()
 {
-   double* dlstorage=NULL;
+   std::ifstream fin(FrameCounterIndexFilename().c_str());
+   if(!fin.is_open())
+      return false;
+
+   std::string line;
+   uint64_t filesize=0;
+   int64_t filetime=0;
    unsigned int nlines=0;
-   unsigned int nsamples=0;
-   if(externalFileName.compare("")==0)
+   std::getline(fin,line);
+   if(line.compare(";APL frame counter index")!=0)
    {
-      //Do not use an external file and read from this one
-      if(linecellsize==0)
-         linecellsize=NumSamples()*NumBands();
-      nsamples=NumSamples();
-      nlines=this->ndarklines;      
+      Logger::Warning("Ignoring frame counter index file as it is not in the expected format: "+FrameCounterIndexFilename());
+      return false;
    }
-   else
+   std::getline(fin,line);
+   if(line.find("raw file size = ")==0)
+      std::istringstream(line.substr(16))>>filesize;
+   std::getline(fin,line);
+   if(line.find("raw file time = ")==0)
+      std::istringstream(line.substr(16))>>filetime;
+   std::getline(fin,line);
+   if(line.find("lines = ")==0)
+      nlines=StringToUINT(line.substr(8));
+
+   FileStatus rawstatus(strRawFilename);
+   if((filesize!=bin->GetFileSize())||(filetime!=rawstatus.ModificationTime())||(nlines!=bin->NumLines()))
    {
-      //Read dark frames from another file
-      //First try to open the BIL/BSQ file
-      SpecimBinFile* dark=NULL;
-      if(CheckSensorID(FENIX,SENSOR_ID))
-      {
-         dark=new FenixBinFile(externalFileName);
-      }
-      else
-      {
-         dark=new SpecimBinFile(externalFileName);
-      }
-      //This does nothing if not a FenixBinFile
-      dark->SetSubSensor(subsensor);
-
-      //Set up data arrays
-      //Get the size in bytes of 1 lines worth of data (for all bands)
-      nsamples=StringToUINT(dark->FromHeader("samples"));
-      unsigned int nbands=StringToUINT(dark->FromHeader("bands"));
-      nlines=StringToUINT(dark->FromHeader("lines"));
-
-      if(linecellsize==0)
-         linecellsize=nsamples*nbands;
-
-      //Update darkscalar value
-      double raw_integration_time=StringToDouble(bin->GetFromFile("integrationtime"));
-      double dark_integration_time=StringToDouble(dark->GetFromFile("integrationtime"));
-      this->darkscalar=raw_integration_time/dark_integration_time;
-      Logger::Log("Updated dark scalar based on integration times:"+ToString(this->darkscalar));
-      dark->Close();
-      delete dark;
+      Logger::Warning("Ignoring frame counter index file as it does not match the raw file: "+FrameCounterIndexFilename());
+      return false;
    }
 
-   //Read in the dark frames casting as doubles
-   dlstorage=new double[nlines*linecellsize];
-   ReadInAllDarkFrames(dlstorage, externalFileName,linecellsize,subsensor);
-   //Sum up the darkframes for each sample of each band
-   for(unsigned int line=0;line<nlines;line++)
+   std::vector<double> counters(nlines);
+   for(unsigned int l=0;l<nlines;l++)
    {
-      data[0]=0; //first element is 1st sample of 1st band which is frame number, so set to 0
-      for(unsigned int s=1;s<linecellsize;s++)//loop from 1 onwards
+      if(!(fin>>counters[l]))
       {
-         data[s]=data[s]+dlstorage[line*linecellsize + s];
-      }  
-   }
-
-   //Average them up
-   for(unsigned int s=0;s<linecellsize;s++)
-   {
-      data[s]=data[s]/static_cast<double>(nlines);
+         Logger::Warning("Ignoring frame counter index file as it is truncated: "+FrameCounterIndexFilename());
+         return false;
+      }
    }
 
-   delete[] dlstorage;
+   framecounters.swap(counters);
+   Logger::Log("Read frame counters from index file: "+FrameCounterIndexFilename());
+   return true;
+}
 
+//-------------------------------------------------------------------------
+// Write the frame counters to the sidecar index file
+//-------------------------------------------------------------------------
+void Specim::WriteFrameCounterIndex()
+{
+   if(framecounters.empty())
+      LoadFrameCounters();
+
+   std::ofstream fout(FrameCounterIndexFilename().c_str());
+   if(!fout.is_open())
+      throw "Failed to open frame counter index file for writing: "+FrameCounterIndexFilename();
+
+   fout<<";APL frame counter index"<<std::endl;
+   fout<<"raw file size = "<<bin->GetFileSize()<<std::endl;
+   fout<<"raw file time = "<<FileStatus(strRawFilename).ModificationTime()<<std::endl;
+   fout<<"lines = "<<framecounters.size()<<std::endl;
+   fout.precision(15);
+   for(unsigned int l=0;l<framecounters.size();l++)
+      fout<<framecounters[l]<<"\n";
+
+   if(!fout.good())
+      throw "Failed to write frame counter index file: "+FrameCounterIndexFilename();
+   fout.close();
+   Logger::Log("Written frame counter index file: "+FrameCounterIndexFilename());
 }
 
 //-------------------------------------------------------------------------
-// Function to calculate the standard deviation of the dark frames
+// Function to set up an accumulator over the dark frames - these are from 
+// the raw file unless an external file name is given. Also updates the
+// dark scalar if an external file is used.
 //-------------------------------------------------------------------------
-void Specim::DarkFramesStdDeviation(double* const stdev,const double* const mean, std::string externalFileName,uint64_t linecellsize,unsigned int subsensor)
+DarkFrameAccumulator* Specim::NewDarkFrameAccumulator(std::string externalFileName,uint64_t& linecellsize,unsigned int subsensor)
 {
-   double* dlstorage=NULL;
-   unsigned int nlines=0;
-   unsigned int nsamples=0;
+   const bool isfenix=CheckSensorID(FENIX,SENSOR_ID);
+   unsigned int firstline=0,nlines=0;
+   std::string filename;
+
    if(externalFileName.compare("")==0)
    {
       //Do not use an external file and read from this one
       if(linecellsize==0)
          linecellsize=NumSamples()*NumBands();
-      nsamples=NumSamples();
+
+      if(linecellsize!=NumSamples()*NumBands())
+         Logger::Log("Reading in dark frames using an array of different size to number of samples * number of bands. This should only happen for Fenix sensors.");
+
+      filename=strRawFilename;
+      firstline=darklinestart;
       nlines=this->ndarklines;
    }
    else
    {
       //Read dark frames from another file
-      //First try to open the BIL/BSQ file
+      //If we're looking at a fenix raw file then we expect fenix dark frames - we need a fenix bil reader to read them
       SpecimBinFile* dark=NULL;
-      if(CheckSensorID(FENIX,SENSOR_ID))
+      if(isfenix)
       {
          dark=new FenixBinFile(externalFileName);
+         dark->SetSubSensor(subsensor);
       }
       else
       {
-         dark=new SpecimBinFile(externalFileName);
+         dark=new EagleHawkBinFile(externalFileName);
       }
-      //This does nothing if not a FenixBinFile
-      dark->SetSubSensor(subsensor);
 
-      //Set up data arrays
-      //Get the size in bytes of 1 lines worth of data (for all bands)
-      nsamples=StringToUINT(dark->FromHeader("samples"));
+      //Get the size of 1 lines worth of data (for all bands)
+      unsigned int nsamples=StringToUINT(dark->FromHeader("samples"));
       unsigned int nbands=StringToUINT(dark->FromHeader("bands"));
       nlines=StringToUINT(dark->FromHeader("lines"));
 
       if(linecellsize==0)
          linecellsize=nsamples*nbands;
 
+      if(linecellsize!=nsamples*nbands)
+         Logger::Log("Reading in dark frames using an array of different size to number of samples * number of bands. This should only happen for Fenix sensors.");
+
       //Update darkscalar value
       double raw_integration_time=StringToDouble(bin->GetFromFile("integrationtime"));
       double dark_integration_time=StringToDouble(dark->GetFromFile("integrationtime"));
       this->darkscalar=raw_integration_time/dark_integration_time;
-      Logger::Log("Updated dark scalar based on integration times:"+ToString(this->darkscalar));
+      Logger::Log("Updated dark scalar based on integration times, using a scalar of:"+ToString(this->darkscalar));
       dark->Close();
       delete dark;
+
+      filename=externalFileName;
+      firstline=0;
    }
 
-   //Read in the dark frames casting as doubles
-   dlstorage=new double[nlines*linecellsize];
-   ReadInAllDarkFrames(dlstorage, externalFileName,linecellsize,subsensor);
+   if(nlines==0)
+      throw "There are no dark lines to average.";
 
-   for(unsigned int line=0;line<nlines;line++)
-   {  
-      stdev[0]=0; //first element is 1st sample of 1st band which is frame number, so set to 0
-      for(unsigned int s=1;s<linecellsize;s++)//loop from 1 onwards
-      {
-         stdev[s]=stdev[s]+pow((dlstorage[line*linecellsize + s]-mean[s]),2);
-      }  
-   }   
+   return new DarkFrameAccumulator(filename,isfenix,subsensor,firstline,nlines,linecellsize);
+}
 
-   //Now finalise the standard devs
-   for(unsigned int s=0;s<linecellsize;s++)
+//-------------------------------------------------------------------------
+// Function to calculate the mean and standard deviation of the dark 
+// frames, in a single pass through the dark lines
+//-------------------------------------------------------------------------
+void Specim::DarkFrameStatistics(double* const mean,double* const stdev,std::string externalFileName,uint64_t linecellsize,unsigned int subsensor,unsigned int numthreads)
+{
+   DarkFrameAccumulator* accumulator=NewDarkFrameAccumulator(externalFileName,linecellsize,subsensor);
+   Logger::Log("Reading in dark lines...");
+   try
    {
-      if(nlines > 1)
-         stdev[s]=sqrt(stdev[s]/(nlines-1.0));
-      else
-         stdev[s]=sqrt(stdev[s]/(nlines));
+      accumulator->Statistics(mean,stdev,numthreads);
    }
-
-   delete[] dlstorage;
+   catch(...)
+   {
+      delete accumulator;
+      throw;
+   }
+   delete accumulator;
 }
 
 //-------------------------------------------------------------------------
 // Function to check dark values against standard deviation and mean, then
 // remove ones it considers outliers before calculating the average
 //-------------------------------------------------------------------------
-void Specim::AverageRefinedDarkFrames(double* const data,const double* const stdev,const double* const mean, std::string externalFileName,uint64_t linecellsize,unsigned int subsensor)
+void Specim::AverageRefinedDarkFrames(double* const data,const double* const stdev,const double* const mean, std::string externalFileName,uint64_t linecellsize,unsigned int subsensor,unsigned int numthreads)
 {
-   unsigned long int* numitems=NULL;
-   double* dlstorage=NULL;
-   unsigned int nlines=0;
-   unsigned int nsamples=0;
-   if(externalFileName.compare("")==0)
+   DarkFrameAccumulator* accumulator=NewDarkFrameAccumulator(externalFileName,linecellsize,subsensor);
+   try
    {
-      //Do not use an external file and read from this one
-      if(linecellsize==0)
-         linecellsize=NumSamples()*NumBands();
-      nsamples=NumSamples();
-      nlines=this->ndarklines;      
+      accumulator->RefinedAverage(data,mean,stdev,numthreads);
+   }
+   catch(...)
+   {
+      delete accumulator;
+      throw;
+   }
+   delete accumulator;
+}
+
+//-------------------------------------------------------------------------
+// Constructor for the dark frame accumulator. Reads nlines lines from 
+// firstline of filename, using the subsensor bands if a fenix file.
+//-------------------------------------------------------------------------
+DarkFrameAccumulator::DarkFrameAccumulator(std::string filename,const bool isfenix,const unsigned int subsensor,
+                                           const unsigned int firstline,const unsigned int nlines,const uint64_t linecellsize)
+{
+   this->filename=filename;
+   this->isfenix=isfenix;
+   this->subsensor=subsensor;
+   this->firstline=firstline;
+   this->nlines=nlines;
+   this->linecellsize=linecellsize;
+   pass=STATISTICS;
+   mean=NULL;
+   stdev=NULL;
+}
+
+//-------------------------------------------------------------------------
+// Run the pass over the dark lines on up to numthreads threads
+//-------------------------------------------------------------------------
+void DarkFrameAccumulator::StartPass(const Pass p,const unsigned int numthreads)
+{
+   pass=p;
+   unsigned int nthreads=numthreads;
+   if(nthreads > nlines)
+      nthreads=nlines;
+   if(nthreads==0)
+      nthreads=1;
+
+   partials.clear();
+   partials.resize(nthreads);
+   for(unsigned int t=0;t<nthreads;t++)
+   {
+      partials[t].nlines=0;
+      partials[t].first.assign(linecellsize,0);
+      partials[t].second.assign(linecellsize,0);
+      partials[t].count.assign(linecellsize,0);
+   }
+
+   RunOnThreads(nthreads);
+}
+
+//-------------------------------------------------------------------------
+// Function run on each thread - accumulates this threads share of the 
+// dark lines
+//-------------------------------------------------------------------------
+void DarkFrameAccumulator::Run(const unsigned int threadindex)
+{
+   Partial& partial=partials[threadindex];
+   const unsigned int start=firstline+static_cast<unsigned int>((static_cast<uint64_t>(nlines)*threadindex)/partials.size());
+   const unsigned int end=firstline+static_cast<unsigned int>((static_cast<uint64_t>(nlines)*(threadindex+1))/partials.size());
+
+   //Each thread has its own reader as they hold a file position
+   SpecimBinFile* file=NULL;
+   unsigned int firstband=0;
+   if(isfenix)
+   {
+      FenixBinFile* fenixfile=new FenixBinFile(filename);
+      fenixfile->SetSubSensor(subsensor);
+      firstband=fenixfile->SubsensorLowerBand();
+      file=fenixfile;
    }
    else
+      file=new EagleHawkBinFile(filename);
+
+   const unsigned int blocklines=32;
+   const uint64_t framesize=file->FrameSize();
+   const unsigned int nbands=static_cast<unsigned int>(linecellsize/file->NumSamples());
+   char* block=NULL;
+   double* line=NULL;
+
+   try
    {
-      //Read dark frames from another file
-      //First try to open the BIL/BSQ file
-      SpecimBinFile* dark=NULL;
-      if(CheckSensorID(FENIX,SENSOR_ID))
-      {
-         dark=new FenixBinFile(externalFileName);
-      }
-      else
+      block=new char[blocklines*framesize];
+      line=new double[linecellsize];
+
+      for(unsigned int blockstart=start;blockstart<end;blockstart+=blocklines)
       {
-         dark=new SpecimBinFile(externalFileName);
+         unsigned int nread=blocklines;
+         if(blockstart+nread > end)
+            nread=end-blockstart;
+         file->ReadFrames(block,blockstart,nread);
+
+         for(unsigned int l=0;l<nread;l++)
+         {
+            file->FrameToValues(&block[l*framesize],line,firstband,nbands);
+            partial.nlines++;
+
+            //first element is 1st sample of 1st band which is frame number, so skip it
+            if(pass==STATISTICS)
+            {
+               //Welford's update of the running mean and sum of squared differences
+               for(uint64_t s=1;s<linecellsize;s++)
+               {
+                  double delta=line[s]-partial.first[s];
+                  partial.first[s]+=delta/partial.nlines;
+                  partial.second[s]+=delta*(line[s]-partial.first[s]);
+               }
+            }
+            else
+            {
+               for(uint64_t s=1;s<linecellsize;s++)
+               {
+                  //If the dark value is within 3 times the stdev from the mean, use the data
+                  if( (line[s] <= (mean[s] + 3*stdev[s])) && (line[s] >= (mean[s] - 3*stdev[s])))
+                  {
+                     partial.first[s]+=line[s];
+                     partial.count[s]++;//individual counter for each pixel
+                  }
+               }
+            }
+         }
       }
-      //This does nothing if not a FenixBinFile
-      dark->SetSubSensor(subsensor);
+   }
+   catch(...)
+   {
+      delete[] block;
+      delete[] line;
+      delete file;
+      throw;
+   }
 
-      //Set up data arrays
-      //Get the size in bytes of 1 lines worth of data (for all bands)
-      nsamples=StringToUINT(dark->FromHeader("samples"));
-      unsigned int nbands=StringToUINT(dark->FromHeader("bands"));
-      nlines=StringToUINT(dark->FromHeader("lines"));
+   delete[] block;
+   delete[] line;
+   delete file;
+}
 
-      if(linecellsize==0)
-         linecellsize=nsamples*nbands;
+//-------------------------------------------------------------------------
+// Calculate the mean and standard deviation of each pixel of the dark
+// frames, merging the partial results from each thread
+//-------------------------------------------------------------------------
+void DarkFrameAccumulator::Statistics(double* const mean,double* const stdev,const unsigned int numthreads)
+{
+   StartPass(STATISTICS,numthreads);
 
-      //Update darkscalar value
-      double raw_integration_time=StringToDouble(bin->GetFromFile("integrationtime"));
-      double dark_integration_time=StringToDouble(dark->GetFromFile("integrationtime"));
-      this->darkscalar=raw_integration_time/dark_integration_time;
-      Logger::Log("Updated dark scalar based on integration times, using a scalar of:"+ToString(this->darkscalar));
-      dark->Close();
-      delete dark;
+   //Merge the partial means / sum of squares (Chan et al)
+   Partial& total=partials[0];
+   for(unsigned int t=1;t<partials.size();t++)
+   {
+      const double na=static_cast<double>(total.nlines);
+      const double nb=static_cast<double>(partials[t].nlines);
+      const double n=na+nb;
+      for(uint64_t s=1;s<linecellsize;s++)
+      {
+         double delta=partials[t].first[s]-total.first[s];
+         total.first[s]+=delta*nb/n;
+         total.second[s]+=partials[t].second[s]+delta*delta*na*nb/n;
+      }
+      total.nlines+=partials[t].nlines;
    }
-   //Read in the dark frames casting as doubles
-   dlstorage=new double[nlines*linecellsize];
-   ReadInAllDarkFrames(dlstorage, externalFileName,linecellsize,subsensor);
 
-   //Set up the numitems array
-   numitems=new unsigned long int[linecellsize];
-   for(unsigned int s=0;s<linecellsize;s++)
+   //first element is 1st sample of 1st band which is frame number, so set to 0
+   mean[0]=stdev[0]=0;
+   for(uint64_t s=1;s<linecellsize;s++)
    {
-      numitems[s]=0;
+      mean[s]=total.first[s];
+      if(total.nlines > 1)
+         stdev[s]=sqrt(total.second[s]/(total.nlines-1.0));
+      else
+         stdev[s]=sqrt(total.second[s]/(total.nlines));
    }
+}
 
-   for(unsigned int line=0;line<nlines;line++)
+//-------------------------------------------------------------------------
+// Calculate the average of each pixel of the dark frames using only the
+// values within 3 standard deviations of the mean
+//-------------------------------------------------------------------------
+void DarkFrameAccumulator::RefinedAverage(double* const data,const double* const mean,const double* const stdev,const unsigned int numthreads)
+{
+   this->mean=mean;
+   this->stdev=stdev;
+   StartPass(REFINEDAVERAGE,numthreads);
+
+   //Sum up the partial results - raw dark values are integers so the order
+   //they are added in does not change the result
+   Partial& total=partials[0];
+   for(unsigned int t=1;t<partials.size();t++)
    {
-      data[0]=0; //first element is 1st sample of 1st band which is frame number, so set to 0
-      for(unsigned int s=1;s<linecellsize;s++)//loop from 1 onwards
+      for(uint64_t s=1;s<linecellsize;s++)
       {
-         //If the dark value is within 3 times the stdev from the mean, use the data
-         if( (dlstorage[line*linecellsize + s] <= (mean[s] + 3*stdev[s])) && (dlstorage[line*linecellsize + s] >= (mean[s] - 3*stdev[s])))
-         {
-            data[s]=data[s]+dlstorage[line*linecellsize + s];
-            numitems[s]++;//individual counter for each pixel
-         }
-      }  
+         total.first[s]+=partials[t].first[s];
+         total.count[s]+=partials[t].count[s];
+      }
+      total.nlines+=partials[t].nlines;
    }
 
    //average them up - skip the first entry
-   for(unsigned int s=1;s<linecellsize;s++)
+   data[0]=0;
+   for(uint64_t s=1;s<linecellsize;s++)
    {
-      if(numitems[s] < (nlines/2.0))
+      if(total.count[s] < (total.nlines/2.0))
       {
          Logger::Warning("Less than half the dark values for this pixel (of the ccd - i.e. 0 to samples*bands) have been used to calculate the average: "+ToString(s));
       }
-      data[s]=data[s]/static_cast<double>(numitems[s]);
+      data[s]=total.first[s]/static_cast<double>(total.count[s]);
    }
-
-   delete[] dlstorage;
-   delete[] numitems;
 }
 
 //-------------------------------------------------------------------------
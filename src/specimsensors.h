@@ -15,6 +15,7 @@
 #include "bilwriter.h"
 #include "commonfunctions.h"
 #include "logger.h"
+#include "os_dependant.h"
 
 //-------------------------------------------------------------------------
 // Constants defined for sensors used in aplcal
@@ -104,8 +105,19 @@ public:
    virtual void SetSubSensor(const Subsensor sub){throw "Trying to set subsensor for a SpecimBinFile - did you mean to use a FenixBinFile?";}
    virtual void SetSubSensor(const unsigned int sub){throw "Trying to set subsensor for a SpecimBinFile - did you mean to use a FenixBinFile?";}
 
+   //Read whole raw frames (all bands of every subsensor) with a single read
+   //and convert a range of bands of a frame to doubles/floats
+   uint64_t FrameSize()const{return br->NumSamples()*br->NumBands()*GetDataSize();}
+   void ReadFrames(char* const chdata,unsigned int startline,unsigned int numlines){br->Readlines(chdata,startline,numlines);}
+   void FrameToValues(char* const frame,double* const values,const unsigned int firstband,const unsigned int nbands);
+   void FrameToValues(char* const frame,float* const values,const unsigned int firstband,const unsigned int nbands);
+   //Read the frame counter of every line of the raw file
+   void ReadFrameCounters(std::vector<double>& counters);
+
 private:
    std::string sensorid;
+   template<class T>
+   void ConvertFrame(char* const frame,T* const values,const unsigned int firstband,const unsigned int nbands);
 };
 
 //-------------------------------------------------------------------------
@@ -173,6 +185,51 @@ private:
    std::string fodisunits;
 };
 
+//-------------------------------------------------------------------------
+// Class to accumulate statistics of dark frames by streaming through the
+// dark lines. The lines are split between threads, each of which reads its
+// own part of the file, and the partial results are merged at the end.
+//-------------------------------------------------------------------------
+class DarkFrameAccumulator : public ThreadedTask
+{
+public:
+   DarkFrameAccumulator(std::string filename,const bool isfenix,const unsigned int subsensor,
+                        const unsigned int firstline,const unsigned int nlines,const uint64_t linecellsize);
+
+   void Statistics(double* const mean,double* const stdev,const unsigned int numthreads);
+   void RefinedAverage(double* const data,const double* const mean,const double* const stdev,const unsigned int numthreads);
+
+protected:
+   void Run(const unsigned int threadindex);
+
+private:
+   enum Pass {STATISTICS,REFINEDAVERAGE};
+
+   //Results for one threads part of the dark lines - either the running 
+   //mean and sum of squared differences (Welford), or the sum and count of
+   //values within 3 standard deviations of the mean
+   class Partial
+   {
+   public:
+      unsigned long nlines;
+      std::vector<double> first,second;
+      std::vector<unsigned long> count;
+   };
+
+   void StartPass(const Pass p,const unsigned int numthreads);
+
+   std::string filename;
+   bool isfenix;
+   unsigned int subsensor;
+   unsigned int firstline,nlines;
+   uint64_t linecellsize;
+
+   Pass pass;
+   const double* mean;
+   const double* stdev;
+   std::vector<Partial> partials;
+};
+
 //-------------------------------------------------------------------------
 // Specim object
 //-------------------------------------------------------------------------
@@ -215,22 +272,29 @@ public:
    unsigned int GetNumDarkFrames() const {return ndarklines;}
    double DarkScalar() const {return darkscalar;}
 
-   void ReadInAllDarkFrames(double* dlstorage,std::string externalFileName,uint64_t linecellsize=0,unsigned int subsensor=0);
-   void AverageAllDarkFrames(double* const data,std::string externalFileName="",uint64_t linecellsize=0,unsigned int subsensor=0);
-   void DarkFramesStdDeviation(double* const stdev,const double* const mean, std::string externalFileName="",uint64_t linecellsize=0,unsigned int subsensor=0);
-   void AverageRefinedDarkFrames(double* const data,const double* const stdev,const double* const mean, std::string externalFileName="",uint64_t linecellsize=0,unsigned int subsensor=0);
+   void DarkFrameStatistics(double* const mean,double* const stdev,std::string externalFileName="",uint64_t linecellsize=0,unsigned int subsensor=0,unsigned int numthreads=1);
+   void AverageRefinedDarkFrames(double* const data,const double* const stdev,const double* const mean, std::string externalFileName="",uint64_t linecellsize=0,unsigned int subsensor=0,unsigned int numthreads=1);
    unsigned short GetMissingFramesBetweenLimits(unsigned int start,unsigned int end){return TotalMissingFrames(start,end);}
 
    //Reads the first/last frame IDs and compare to number of lines to get total number of missing frames
    virtual void TotalMissingFrames(){throw "Undefined function: TotalMissingFrames";}
    //Reads the start/end frame IDs and compare to number of lines within these limits to get number of missing frames
    virtual unsigned short TotalMissingFrames(const unsigned int start, const unsigned int end);
+
+   //Frame counter of the given line - all counters are read in a single pass on first use
+   double FrameCounter(const unsigned int line);
+   //Write the frame counters to a sidecar index file next to the raw file for use in later runs
+   void WriteFrameCounterIndex();
+   std::string FrameCounterIndexFilename()const{return strRawFilename+".frameindex";}
    //Function to return the lower band in the band range - normalised to 0.
    unsigned int LowerBandLimit()const{return StringToUINT(bin->GetFromFile("lowervimg"))-1;}
 
 protected:
 
    void DarkFrameSanityCheck();
+   void LoadFrameCounters();
+   bool ReadFrameCounterIndex();
+   DarkFrameAccumulator* NewDarkFrameAccumulator(std::string externalFileName,uint64_t& linecellsize,unsigned int subsensor);
 
    //-------------------------------------------------------------------------
    //Constants relating to the Specim sensors
@@ -254,6 +318,7 @@ protected:
    unsigned int scanlineupperlimit, scanlinelowerlimit; //himg {} values from specim header
 
    short int totalmissing;//total number of missing frames
+   std::vector<double> framecounters; //frame counter of each line of the raw file
    unsigned int ndarklines;
    unsigned int darklinestart;
    double darkscalar; //scalar if separate dark file used of different integration time